@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PESLIB_ALLOCATOR_H
+#define PESLIB_ALLOCATOR_H
+
+#include <stdlib.h>
+
+/**
+ * Memory allocator for libpes objects. Objects keep the allocator they were
+ * created with, and free all their memory with it, so an arena allocator
+ * may for example ignore frees and release all memory at once.
+ */
+struct libpes_allocator {
+	/**
+	 * Allocate memory, like `malloc()`.
+	 *
+	 * @param size Size of memory in bytes.
+	 * @param arg Argument pointer of allocator.
+	 * @return Allocated memory, or NULL on failure.
+	 */
+	void *(*alloc_cb)(const size_t size, void * const arg);
+
+	/**
+	 * Change size of allocated memory, like `realloc()`.
+	 *
+	 * @param ptr Allocated memory, or NULL to allocate new memory.
+	 * @param size New size of memory in bytes.
+	 * @param arg Argument pointer of allocator.
+	 * @return Reallocated memory, or NULL on failure in which case the
+	 * given memory is left unchanged.
+	 */
+	void *(*realloc_cb)(void * const ptr, const size_t size, void * const arg);
+
+	/**
+	 * Free allocated memory, like `free()`.
+	 *
+	 * @param ptr Allocated memory. Ignored if NULL.
+	 * @param arg Argument pointer of allocator.
+	 */
+	void (*free_cb)(void * const ptr, void * const arg);
+
+	void *arg; /** Argument pointer supplied to callbacks. Can be NULL. */
+};
+
+/**
+ * Set the allocator of objects created by `*_init()` functions. The default
+ * allocator uses `malloc()`, `realloc()` and `free()`. This is not thread
+ * safe, and is typically done once before any objects are created.
+ * Objects created by `*_init_with_allocator()` functions are unaffected.
+ *
+ * @param allocator Allocator, copied, or NULL for the default allocator.
+ * An allocator with a NULL callback is also replaced by the default.
+ */
+void libpes_allocator_set(const struct libpes_allocator * const allocator);
+
+#endif /* PESLIB_ALLOCATOR_H */
@@ -19,13 +19,17 @@
 #define PESLIB_PEC_DECODER_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 
+#include "allocator.h"
 #include "pec.h"
 
 struct pec_decoder; /* PEC decoder object forward declaration. */
 
 /**
- * Create a PEC decoder object.
+ * Create a PEC decoder object. The PEC header, with label, thread palette
+ * and thumbnail geometry, is parsed once and cached by the decoder.
  *
  * @param data Pointer to PEC data.
  * @param size Size of PEC data in bytes.
@@ -34,6 +38,37 @@ struct pec_decoder; /* PEC decoder object forward declaration. */
  */
 struct pec_decoder *pec_decoder_init(const void * const data, const size_t size);
 
+/**
+ * Create a PEC decoder object that borrows the given PEC data instead of
+ * copying it. The data must remain valid and unmodified for the lifetime
+ * of the PEC decoder object.
+ *
+ * @param data Pointer to PEC data.
+ * @param size Size of PEC data in bytes.
+ * @return Allocated PEC decoder object or NULL. Must be freed using
+ * `pec_decoder_free()`.
+ */
+struct pec_decoder *pec_decoder_init_borrowed(const void * const data,
+	const size_t size);
+
+/**
+ * Create a PEC decoder object with the given allocator, which is used for
+ * all memory of the object.
+ *
+ * @param data Pointer to PEC data.
+ * @param size Size of PEC data in bytes.
+ * @param borrowed True to borrow the data as `pec_decoder_init_borrowed()`,
+ * else false to copy it.
+ * @param allocator Allocator, copied, or NULL for the allocator set by
+ * `libpes_allocator_set()`. NULL is returned if any of its callbacks
+ * is NULL.
+ * @return Allocated PEC decoder object or NULL. Must be freed using
+ * `pec_decoder_free()`.
+ */
+struct pec_decoder *pec_decoder_init_with_allocator(const void * const data,
+	const size_t size, const bool borrowed,
+	const struct libpes_allocator * const allocator);
+
 /**
  * Free allocated PEC decoder object.
  *
@@ -69,13 +104,36 @@ const struct pec_thread pec_thread(const struct pec_decoder * const decoder,
 	const int thread_index);
 
 /**
- * Return number of PEC object stitches.
+ * Return number of PEC object stitches. The count is computed when the
+ * decoder is initialised.
  *
  * @param decoder PEC decoder object.
  * @return Number of stitches.
  */
 int pec_stitch_count(const struct pec_decoder * const decoder);
 
+/**
+ * Return number of PEC object stitches for given thread, excluding stop
+ * stitches. The counts are computed when the decoder is initialised.
+ *
+ * @param decoder PEC decoder object.
+ * @param thread_index Index of thread.
+ * @return Number of stitches, or zero if the thread index is undefined.
+ */
+int pec_thread_stitch_count(const struct pec_decoder * const decoder,
+	const int thread_index);
+
+/**
+ * Return number of PEC object stitches of given type. The counts are
+ * computed when the decoder is initialised.
+ *
+ * @param decoder PEC decoder object.
+ * @param stitch_type Type of stitch.
+ * @return Number of stitches.
+ */
+int pec_stitch_type_count(const struct pec_decoder * const decoder,
+	const enum pec_stitch_type stitch_type);
+
 /**
  * Callback for PEC stitch iteration.
  *
@@ -103,6 +161,86 @@ typedef bool (*pec_stitch_callback)(const int stitch_index,
 bool pec_stitch_foreach(const struct pec_decoder * const decoder,
 	const pec_stitch_callback stitch_cb, void * const arg);
 
+/**
+ * Callback for PEC stitch iteration in batches.
+ *
+ * @see pec_stitch_foreach_batch
+ *
+ * @param stitch_index Index of the first stitch of the batch.
+ * @param x X coordinates of stitches [millimeter].
+ * @param y Y coordinates of stitches [millimeter].
+ * @param stitch_type Stitch types, PEC_STITCH_STOP indicates change of
+ * threads.
+ * @param count Number of stitches in the batch.
+ * @param arg Argument pointer supplied to `pec_stitch_foreach_batch()`.
+ * @return Return true to continue processing or false to abort.
+ */
+typedef bool (*pec_stitch_batch_callback)(const int stitch_index,
+	const float * const x, const float * const y,
+	const uint8_t * const stitch_type, const int count, void * const arg);
+
+/**
+ * Iterate over all PEC stitches in batches of up to 256 stitches, decoded
+ * into stack buffers. The callback is invoked once per batch rather than
+ * once per stitch as with `pec_stitch_foreach()`, where the calls rather
+ * than the decoding dominate the time.
+ *
+ * @param decoder PEC decoder object.
+ * @param batch_cb Callback to invoke for all batches of stitches.
+ * @param arg Optional argument pointer supplied to callback. Can be NULL.
+ * @return True on successful completion, else false.
+ */
+bool pec_stitch_foreach_batch(const struct pec_decoder * const decoder,
+	const pec_stitch_batch_callback batch_cb, void * const arg);
+
+/**
+ * Callback for PEC stitch iteration with raw coordinates.
+ *
+ * @see pec_stitch_foreach_raw
+ *
+ * @param stitch_index Index of stitch.
+ * @param x Raw X coordinate [0.1 millimeter].
+ * @param y Raw Y coordinate [0.1 millimeter].
+ * @param stitch_type Stitch type, PEC_STITCH_STOP indicates change of threads.
+ * @param arg Argument pointer supplied to `pec_stitch_foreach_raw()`.
+ * @return Turn true to continue processing or false to abort.
+ */
+typedef bool (*pec_stitch_raw_callback)(const int stitch_index,
+	const int32_t x, const int32_t y, const enum pec_stitch_type stitch_type,
+	void * const arg);
+
+/**
+ * Iterate over all PEC stitches with exact raw coordinates, avoiding
+ * conversions to and from millimeters.
+ *
+ * @param decoder PEC decoder object.
+ * @param stitch_cb Callback to invoke for all stitches.
+ * @param arg Optional argument pointer supplied to callback. Can be NULL.
+ * @return True on successful completion, else false.
+ */
+bool pec_stitch_foreach_raw(const struct pec_decoder * const decoder,
+	const pec_stitch_raw_callback stitch_cb, void * const arg);
+
+/**
+ * Decode PEC stitches into caller-provided structure-of-arrays buffers,
+ * without invoking any callbacks. Use `pec_stitch_count()` to size the
+ * buffers.
+ *
+ * @param decoder PEC decoder object.
+ * @param x X coordinates of stitches [millimeter]. Ignored if NULL.
+ * @param y Y coordinates of stitches [millimeter]. Ignored if NULL.
+ * @param type Stitch types, PEC_STITCH_STOP indicates change of threads.
+ * Ignored if NULL.
+ * @param thread Thread indices of stitches. Ignored if NULL.
+ * @param capacity Maximum number of stitches to store in each buffer.
+ * @return Number of decoded stitches, being less than `pec_stitch_count()`
+ * only if the capacity is smaller, or zero on failure. Partially decoded
+ * stitches are never reported as a count.
+ */
+size_t pec_decode_stitches(const struct pec_decoder * const decoder,
+	float * const x, float * const y, uint8_t * const type,
+	uint16_t * const thread, const size_t capacity);
+
 /**
  * Return pixel width of PEC thumbnails.
  *
@@ -133,6 +271,31 @@ int pec_thumbnail_height(const struct pec_decoder * const decoder);
 bool pec_thumbnail_pixel(const struct pec_decoder * const decoder,
 	const int thumbnail_index, const int x, const int y);
 
+/** Pixel formats of PEC thumbnail bitmaps. */
+enum pec_thumbnail_format {
+	PEC_THUMBNAIL_1BPP, /** 1 bit per pixel, least significant bit first. */
+	PEC_THUMBNAIL_8BPP  /** 8 bits per pixel, 0xFF if set else 0. */
+};
+
+/**
+ * Expand a whole PEC thumbnail into a bitmap. Coordinate origin is top-left
+ * corner at (0,0).
+ *
+ * @param decoder PEC decoder object.
+ * @param thumbnail_index Index of thumbnail. 0 is main thumbnail and 1..
+ * represent all PEC threads.
+ * @param bitmap Bitmap of `pec_thumbnail_height()` rows.
+ * @param stride Number of bytes between rows of the bitmap. At least
+ * `pec_thumbnail_width() / 8` for 1 bit per pixel and
+ * `pec_thumbnail_width()` for 8 bits per pixel.
+ * @param format Pixel format of bitmap.
+ * @return True on success, else false if the thumbnail index is not in
+ * 0..`pec_thread_count()` or the thumbnail is outside of the data.
+ */
+bool pec_thumbnail_bitmap(const struct pec_decoder * const decoder,
+	const int thumbnail_index, uint8_t * const bitmap, const size_t stride,
+	const enum pec_thumbnail_format format);
+
 /**
  * Convert raw PEC coordinate value to physical value [millimeter].
  *
@@ -20,7 +20,9 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 
+#include "allocator.h"
 #include "pec.h"
 
 struct pec_encoder; /* PEC encoder object forward declaration. */
@@ -33,6 +35,19 @@ struct pec_encoder; /* PEC encoder object forward declaration. */
  */
 struct pec_encoder *pec_encoder_init();
 
+/**
+ * Create a PEC encoder object with the given allocator, which is used for
+ * all memory of the object.
+ *
+ * @param allocator Allocator, copied, or NULL for the allocator set by
+ * `libpes_allocator_set()`. NULL is returned if any of its callbacks
+ * is NULL.
+ * @return Allocated PEC encoder object or NULL. Must be freed using
+ * `pec_encoder_free()`.
+ */
+struct pec_encoder *pec_encoder_init_with_allocator(
+	const struct libpes_allocator * const allocator);
+
 /**
  * Free allocated PEC encoder object.
  *
@@ -40,6 +55,27 @@ struct pec_encoder *pec_encoder_init();
  */
 void pec_encoder_free(struct pec_encoder * const encoder);
 
+/**
+ * Reset PEC encoder object to its initial state, removing all threads and
+ * stitches but keeping allocated capacity, so that it can be reused for
+ * another PEC object without allocating. The buffer size is kept.
+ *
+ * @param encoder PEC encoder object.
+ */
+void pec_encoder_reset(struct pec_encoder * const encoder);
+
+/**
+ * Reserve capacity for a total number of stitches, to allocate once when
+ * the number of stitches is known in advance. Capacity otherwise grows
+ * geometrically as stitches are appended.
+ *
+ * @param encoder PEC encoder object.
+ * @param stitch_count Total number of stitches.
+ * @return True if capacity was successfully reserved, else false.
+ */
+bool pec_encoder_reserve(struct pec_encoder * const encoder,
+	const size_t stitch_count);
+
 /**
  * Append a color to the PEC object. General RGB colors can be approximated to
  * a palette index using `pec_palette_index_by_rgb()`. Appending a color implies
@@ -56,6 +92,9 @@ bool pec_append_thread(struct pec_encoder * const encoder,
  * Append a regular stitch to the PEC object. Note that at least one color
  * must have been appended using `pec_append_thread()` before this call.
  *
+ * Coordinates are quantized to raw PEC coordinates of 0.1 mm when appended,
+ * and stitches beyond the 16-bit range of about +/-3276 mm are rejected.
+ *
  * @param encoder PEC encoder object.
  * @param x X coordinate of stitch [millimeter].
  * @param y Y coordinate of stitch [millimeter].
@@ -64,6 +103,20 @@ bool pec_append_thread(struct pec_encoder * const encoder,
 bool pec_append_stitch(struct pec_encoder * const encoder,
 	const float x, const float y);
 
+/**
+ * Append regular stitches to the PEC object, equivalent to but faster than
+ * calling `pec_append_stitch()` for each stitch. Note that at least one
+ * color must have been appended using `pec_append_thread()` before this call.
+ *
+ * @param encoder PEC encoder object.
+ * @param xy Interleaved X and Y coordinates of stitches [millimeter].
+ * @param n Number of stitches.
+ * @return True if all stitches were successfully appended, else false in
+ * which case none of them were appended.
+ */
+bool pec_append_stitches(struct pec_encoder * const encoder,
+	const float * const xy, const size_t n);
+
 /**
  * Append a jump stitch to the PEC object. Note that at least one color
  * must have been appended using `pec_append_thread()` before this call.
@@ -115,6 +168,37 @@ typedef bool (*pec_encode_callback)(const void * const data,
 bool pec_encode(const struct pec_encoder * const encoder,
 	const pec_encode_callback encode_cb, void * const arg);
 
+/**
+ * Encode PEC directly into caller-provided memory, without callback.
+ * The required capacity is given by `pec_encoded_size()`.
+ *
+ * @param encoder PEC encoder object.
+ * @param dst Memory to write encoded data into.
+ * @param capacity Capacity of memory in bytes.
+ * @param written Size of encoded data in bytes. If the capacity is
+ * insufficient this is the required capacity, and zero if the data cannot
+ * be encoded. Ignored if NULL.
+ * @return True on successful completion, else false.
+ */
+bool pec_encode_into(const struct pec_encoder * const encoder,
+	void * const dst, const size_t capacity, size_t * const written);
+
+/**
+ * Set size of the internal buffer used by `pec_encode()`. Encoded data is
+ * staged in the buffer and the callback is invoked with chunks of up to
+ * this size rather than with a few bytes at a time. The default size is
+ * 64 KiB. The buffer is allocated here, kept across encodings and resets,
+ * and freed with the encoder. An encoder must therefore not encode from
+ * several threads at once.
+ *
+ * @param encoder PEC encoder object.
+ * @param size Size of buffer in bytes, or zero to invoke the callback
+ * directly for every piece of encoded data, as is also done if the buffer
+ * cannot be allocated.
+ */
+void pec_encoder_buffer_size(struct pec_encoder * const encoder,
+	const size_t size);
+
 /**
  * Return size of encoded PEC data in bytes.
  *
@@ -18,6 +18,8 @@
 #ifndef PESLIB_PEC_H
 #define PESLIB_PEC_H
 
+#include <stdlib.h>
+
 #define PEC_MAX_THREADS 256
 
 /** PEC stitch types. */
@@ -61,6 +63,37 @@ struct pec_thread pec_palette_thread(const int palette_index);
  */
 int pec_palette_index_by_rgb(const struct pec_rgb rgb);
 
+/**
+ * Return PEC thread closest to given RGB color by the perceptual CIEDE2000
+ * color difference. Colors are matched in cells of 4x4x4 RGB colors, by
+ * the centre of their cell, which are computed once and cached. All
+ * palette threads are considered, unlike `pec_palette_index_by_rgb()`.
+ *
+ * @param rgb PEC RGB color. Components are clamped to 0 to 255.
+ * @return PEC palette index.
+ */
+int pec_palette_index_by_rgb_perceptual(const struct pec_rgb rgb);
+
+/**
+ * Function returning the PEC palette index of a color, such as
+ * `pec_palette_index_by_rgb()` or `pec_palette_index_by_rgb_perceptual()`.
+ *
+ * @param rgb PEC RGB color.
+ * @return PEC palette index.
+ */
+typedef int (*pec_palette_match)(const struct pec_rgb rgb);
+
+/**
+ * Return PEC threads closest to given RGB colors by RGB distance metric,
+ * equivalent to `pec_palette_index_by_rgb()` for each color.
+ *
+ * @param rgb PEC RGB colors.
+ * @param palette_index PEC palette indices of colors.
+ * @param n Number of colors.
+ */
+void pec_palette_indices_by_rgb(const struct pec_rgb * const rgb,
+	int * const palette_index, const size_t n);
+
 /**
  * Return PEC thread representing an undefined thread.
  *
@@ -19,13 +19,23 @@
 #define PESLIB_PES_DECODER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+#include "allocator.h"
 #include "pec.h"
 #include "pes.h"
 
 struct pes_decoder; /* PES decoder object forward declaration. */
 
+/** PES block of stitches. */
+struct pes_block_info {
+	struct pec_thread thread;          /** Thread for the stitches. */
+	int stitch_index;                  /** Index of first stitch. */
+	int stitch_count;                  /** Number of stitches. */
+	enum pec_stitch_type stitch_type;  /** Type of stitch. */
+};
+
 /**
  * Create a PES decoder object.
  *
@@ -36,6 +46,37 @@ struct pes_decoder; /* PES decoder object forward declaration. */
  */
 struct pes_decoder *pes_decoder_init(const void * const data, const size_t size);
 
+/**
+ * Create a PES decoder object that borrows the given PES data instead of
+ * copying it, for example memory-mapped files. The data must remain valid
+ * and unmodified for the lifetime of the PES decoder object.
+ *
+ * @param data Pointer to PES data.
+ * @param size Size of PES data in bytes.
+ * @return Allocated PES decoder object or NULL. Must be freed using
+ * `pes_decoder_free()`.
+ */
+struct pes_decoder *pes_decoder_init_borrowed(const void * const data,
+	const size_t size);
+
+/**
+ * Create a PES decoder object with the given allocator, which is used for
+ * all memory of the object.
+ *
+ * @param data Pointer to PES data.
+ * @param size Size of PES data in bytes.
+ * @param borrowed True to borrow the data as `pes_decoder_init_borrowed()`,
+ * else false to copy it.
+ * @param allocator Allocator, copied, or NULL for the allocator set by
+ * `libpes_allocator_set()`. NULL is returned if any of its callbacks
+ * is NULL.
+ * @return Allocated PES decoder object or NULL. Must be freed using
+ * `pes_decoder_free()`.
+ */
+struct pes_decoder *pes_decoder_init_with_allocator(const void * const data,
+	const size_t size, const bool borrowed,
+	const struct libpes_allocator * const allocator);
+
 /**
  * Free allocated PES decoder object.
  *
@@ -80,13 +121,35 @@ const struct pec_thread pes_thread(const struct pes_decoder * const decoder,
 	const int thread_index);
 
 /**
- * Return number of PES object stitches.
+ * Return number of PES object stitches in constant time.
  *
  * @param decoder PES decoder object.
  * @return Number of stitches.
  */
 int pes_stitch_count(const struct pes_decoder * const decoder);
 
+/**
+ * Return number of PES object stitches for given thread. The counts are
+ * computed when the decoder is initialised.
+ *
+ * @param decoder PES decoder object.
+ * @param thread_index Index of thread.
+ * @return Number of stitches, or zero if the thread index is undefined.
+ */
+int pes_thread_stitch_count(const struct pes_decoder * const decoder,
+	const int thread_index);
+
+/**
+ * Return number of PES object stitches of given type. The counts are
+ * computed when the decoder is initialised.
+ *
+ * @param decoder PES decoder object.
+ * @param stitch_type Type of stitch.
+ * @return Number of stitches.
+ */
+int pes_stitch_type_count(const struct pes_decoder * const decoder,
+	const enum pec_stitch_type stitch_type);
+
 /**
  * Return affine PES transform matrix.
  *
@@ -211,6 +274,20 @@ typedef bool (*pes_block_callback)(const struct pec_thread thread,
 typedef bool (*pes_stitch_callback)(const int stitch_index,
 	const float x, const float y, void * const arg);
 
+/**
+ * Callback for PES stitch iteration with raw coordinates.
+ *
+ * @see pes_stitch_foreach_raw
+ *
+ * @param stitch_index Index of stitch within the block.
+ * @param x Raw X coordinate [0.1 millimeter].
+ * @param y Raw Y coordinate [0.1 millimeter].
+ * @param arg Argument pointer supplied to `pes_stitch_foreach_raw()`.
+ * @return Turn true to continue processing or false to abort.
+ */
+typedef bool (*pes_stitch_raw_callback)(const int stitch_index,
+	const int32_t x, const int32_t y, void * const arg);
+
 /**
  * Iterate over all PES stitches.
  *
@@ -224,6 +301,100 @@ bool pes_stitch_foreach(const struct pes_decoder * const decoder,
 	const pes_block_callback block_cb, const pes_stitch_callback stitch_cb,
 	void * const arg);
 
+/**
+ * Iterate over all PES stitches with exact raw coordinates, avoiding
+ * conversions to and from millimeters.
+ *
+ * @param decoder PES decoder object.
+ * @param block_cb Callback to invoke for all stitch blocks. Ignored if NULL.
+ * @param stitch_cb Callback to invoke for all stitches. Ignored if NULL.
+ * @param arg Optional argument pointer supplied to callback. Can be NULL.
+ * @return True on successful completion, else false.
+ */
+bool pes_stitch_foreach_raw(const struct pes_decoder * const decoder,
+	const pes_block_callback block_cb,
+	const pes_stitch_raw_callback stitch_cb, void * const arg);
+
+/**
+ * Decode PES stitches into caller-provided structure-of-arrays buffers,
+ * without invoking any callbacks. Use `pes_stitch_count()` to size the
+ * buffers.
+ *
+ * @param decoder PES decoder object.
+ * @param x X coordinates of stitches [millimeter]. Ignored if NULL.
+ * @param y Y coordinates of stitches [millimeter]. Ignored if NULL.
+ * @param type Stitch types of the blocks of the stitches. Ignored if NULL.
+ * @param thread Thread indices of the blocks of the stitches, or UINT16_MAX
+ * for blocks with an undefined thread. Ignored if NULL.
+ * @param capacity Maximum number of stitches to store in each buffer.
+ * @return Number of decoded stitches, being less than `pes_stitch_count()`
+ * only if the capacity is smaller. PES stitches are validated when the
+ * decoder is initialised, so unlike `pec_decode_stitches()` this cannot
+ * fail with zero on a malformed stitch.
+ */
+size_t pes_decode_stitches(const struct pes_decoder * const decoder,
+	float * const x, float * const y, uint8_t * const type,
+	uint16_t * const thread, const size_t capacity);
+
+/**
+ * Return number of PES stitch blocks.
+ *
+ * @param decoder PES decoder object.
+ * @return Number of blocks.
+ */
+int pes_block_count(const struct pes_decoder * const decoder);
+
+/**
+ * Return PES block for given block index in constant time.
+ *
+ * @param decoder PES decoder object.
+ * @param block_index Index of block.
+ * @return PES block for given index, or an empty block with an undefined
+ * thread.
+ */
+struct pes_block_info pes_block_info(const struct pes_decoder * const decoder,
+	const int block_index);
+
+/**
+ * Return index of PES block containing the given stitch in logarithmic time.
+ *
+ * @param decoder PES decoder object.
+ * @param stitch_index Index of stitch among all stitches.
+ * @return Index of block, or -1 if the stitch index is out of range.
+ */
+int pes_stitch_block_index(const struct pes_decoder * const decoder,
+	const int stitch_index);
+
+/**
+ * Decode the stitch coordinates of a single PES block into caller-provided
+ * buffers. The conversion is vectorized where the CPU supports it.
+ *
+ * @param decoder PES decoder object.
+ * @param block_index Index of block.
+ * @param x X coordinates of stitches [millimeter]. Ignored if NULL.
+ * @param y Y coordinates of stitches [millimeter]. Ignored if NULL.
+ * @param capacity Maximum number of stitches to store in each buffer.
+ * @return Number of decoded stitches, or zero if the block index is out of
+ * range.
+ */
+size_t pes_block_decode_stitches(const struct pes_decoder * const decoder,
+	const int block_index, float * const x, float * const y,
+	const size_t capacity);
+
+/**
+ * Iterate over the stitches of a single PES block. Only the stitches of
+ * the given block are decoded.
+ *
+ * @param decoder PES decoder object.
+ * @param block_index Index of block.
+ * @param stitch_cb Callback to invoke for all stitches within the block.
+ * @param arg Optional argument pointer supplied to callback. Can be NULL.
+ * @return True on successful completion, else false.
+ */
+bool pes_block_stitches(const struct pes_decoder * const decoder,
+	const int block_index, const pes_stitch_callback stitch_cb,
+	void * const arg);
+
 /**
  * Return PEC decoder object for PES object. Note that this particular PEC
  * decoder object must not be freed using `pec_decoder_free()`.
@@ -19,8 +19,10 @@
 #define PESLIB_PES_ENCODER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+#include "allocator.h"
 #include "pec.h"
 #include "pes.h"
 
@@ -34,6 +36,19 @@ struct pes_encoder; /* PES encoder object forward declaration. */
  */
 struct pes_encoder *pes_encoder_init();
 
+/**
+ * Create a PES encoder object with the given allocator, which is used for
+ * all memory of the object.
+ *
+ * @param allocator Allocator, copied, or NULL for the allocator set by
+ * `libpes_allocator_set()`. NULL is returned if any of its callbacks
+ * is NULL.
+ * @return Allocated PES encoder object or NULL. Must be freed using
+ * `pes_encoder_free()`.
+ */
+struct pes_encoder *pes_encoder_init_with_allocator(
+	const struct libpes_allocator * const allocator);
+
 /**
  * Free allocated PES encoder object.
  *
@@ -41,6 +56,28 @@ struct pes_encoder *pes_encoder_init();
  */
 void pes_encoder_free(struct pes_encoder * const encoder);
 
+/**
+ * Reset PES encoder object to its initial state, removing all threads,
+ * stitches and transforms but keeping allocated capacity, so that it can be
+ * reused for another PES object without allocating. The palette match and
+ * buffer size are kept.
+ *
+ * @param encoder PES encoder object.
+ */
+void pes_encoder_reset(struct pes_encoder * const encoder);
+
+/**
+ * Reserve capacity for a total number of stitches, to allocate once when
+ * the number of stitches is known in advance. Capacity otherwise grows
+ * geometrically as stitches are appended.
+ *
+ * @param encoder PES encoder object.
+ * @param stitch_count Total number of stitches.
+ * @return True if capacity was successfully reserved, else false.
+ */
+bool pes_encoder_reserve(struct pes_encoder * const encoder,
+	const size_t stitch_count);
+
 /**
  * Append a thread to the PES encoder object. Appended threads are indexed
  * from zero.
@@ -56,6 +93,9 @@ bool pes_append_thread(struct pes_encoder * const encoder,
  * Append a stitch to the PES encoder object. Note that the given thread
  * index must have been appended using `pes_append_thread()` before this call.
  *
+ * Coordinates are quantized to raw PEC coordinates of 0.1 mm when appended,
+ * and stitches beyond the 16-bit range of about +/-3276 mm are rejected.
+ *
  * @param encoder PES encoder object.
  * @param thread_index Thread index starting from zero.
  * @param x X coordinate of stitch [millimeter].
@@ -78,6 +118,63 @@ bool pes_append_stitch(struct pes_encoder * const encoder,
 bool pes_append_jump_stitch(struct pes_encoder * const encoder,
 	const int thread_index, const float x, const float y);
 
+/**
+ * Flags for appending stitches using `pes_append_stitches()`.
+ */
+enum pes_append_flag {
+	PES_APPEND_JUMP = 1 << 0, /* The first stitch is a jump stitch. */
+};
+
+/**
+ * Append stitches to the PES encoder object, equivalent to but faster than
+ * calling `pes_append_stitch()` for each stitch. Note that the given thread
+ * index must have been appended using `pes_append_thread()` before this call.
+ *
+ * @param encoder PES encoder object.
+ * @param thread_index Thread index starting from zero.
+ * @param xy Interleaved X and Y coordinates of stitches [millimeter].
+ * @param n Number of stitches.
+ * @param flags Zero or `PES_APPEND_JUMP` to append the first stitch using
+ * `pes_append_jump_stitch()`.
+ * @return True if all stitches were successfully appended, else false in
+ * which case some of them may have been appended.
+ */
+bool pes_append_stitches(struct pes_encoder * const encoder,
+	const int thread_index, const float * const xy, const size_t n,
+	const int flags);
+
+/**
+ * Append stitches to the PES encoder object using raw PEC coordinates.
+ *
+ * @see pes_append_stitches
+ *
+ * @param encoder PES encoder object.
+ * @param thread_index Thread index starting from zero.
+ * @param xy Interleaved raw X and Y coordinates of stitches [0.1 mm].
+ * @param n Number of stitches.
+ * @param flags Zero or `PES_APPEND_JUMP` to append the first stitch using
+ * `pes_append_jump_stitch()`.
+ * @return True if all stitches were successfully appended, else false in
+ * which case some of them may have been appended.
+ */
+bool pes_append_stitches_raw(struct pes_encoder * const encoder,
+	const int thread_index, const int32_t * const xy, const size_t n,
+	const int flags);
+
+/**
+ * Set how thread colors are matched to PEC palette threads. The default is
+ * `pec_palette_index_by_rgb()`. The PEC and CSewSeg sections would disagree
+ * if the match changed midway, so it cannot be changed once threads have
+ * been appended, until the encoder is reset.
+ *
+ * @param encoder PES encoder object.
+ * @param palette_match Function matching colors to PEC palette indices.
+ * @return True if the function was set, else false if threads have been
+ * appended.
+ */
+bool pes_encoder_palette_match(struct pes_encoder * const encoder,
+	const pec_palette_match palette_match);
+
 /**
  * Set affine transform for PES object.
  *
@@ -90,6 +187,22 @@ bool pes_append_jump_stitch(struct pes_encoder * const encoder,
 void pes_encode_transform(struct pes_encoder * const encoder,
 	const struct pes_transform affine_transform);
 
+/**
+ * Set size of the internal buffer used by `pes_encode1()`. Encoded data is
+ * staged in the buffer and the callback is invoked with chunks of up to
+ * this size rather than with a few bytes at a time. The default size is
+ * 64 KiB. The buffer is allocated here, kept across encodings and resets,
+ * and freed with the encoder. An encoder must therefore not encode from
+ * several threads at once.
+ *
+ * @param encoder PES encoder object.
+ * @param size Size of buffer in bytes, or zero to invoke the callback
+ * directly for every piece of encoded data, as is also done if the buffer
+ * cannot be allocated.
+ */
+void pes_encoder_buffer_size(struct pes_encoder * const encoder,
+	const size_t size);
+
 /**
  * Callback with successively encoded PES data.
  *
@@ -116,6 +229,21 @@ typedef bool (*pes_encode_callback)(const void * const data,
 bool pes_encode1(const struct pes_encoder * const encoder,
 	const pes_encode_callback encode_cb, void * const arg);
 
+/**
+ * Encode PES version 1 directly into caller-provided memory, without
+ * callback. The required capacity is given by `pes_encode1_size()`.
+ *
+ * @param encoder PES encoder object.
+ * @param dst Memory to write encoded data into.
+ * @param capacity Capacity of memory in bytes.
+ * @param written Size of encoded data in bytes. If the capacity is
+ * insufficient this is the required capacity, and zero if the data cannot
+ * be encoded. Ignored if NULL.
+ * @return True on successful completion, else false.
+ */
+bool pes_encode1_into(const struct pes_encoder * const encoder,
+	void * const dst, const size_t capacity, size_t * const written);
+
 /**
  * Encode PES version 4 sending data to the provided callback.
  *
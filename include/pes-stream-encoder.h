@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PESLIB_PES_STREAM_ENCODER_H
+#define PESLIB_PES_STREAM_ENCODER_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "pec.h"
+#include "pes.h"
+#include "pes-encoder.h"
+
+/*
+ * The PES stream encoder writes PES version 1 data as stitches are
+ * appended, instead of encoding the design once it is complete as the PES
+ * encoder does. The PEC offset, the bounds and the block counts that
+ * precede the stitches are patched when the encoding is finished. The
+ * encoded data is identical to that of the PES encoder.
+ *
+ * The embedded PEC section follows the stitches and is relative to their
+ * bounds. Its stitch data is therefore written to a spill as stitches are
+ * appended, and copied from the spill to the sink when the encoding is
+ * finished, while the PEC thumbnails are drawn. Memory is bounded
+ * regardless of the number of stitches. The 24-bit thumbnail offset of
+ * the PEC header limits stitch data to about 16 MiB, or about 4 to 8
+ * million stitches, and stitches beyond that limit are rejected.
+ */
+
+struct pes_stream_encoder; /* PES stream encoder forward declaration. */
+
+/**
+ * Callback to overwrite previously written PES data.
+ *
+ * @param offset Offset of data from the beginning of the PES data.
+ * @param data Data to overwrite with.
+ * @param size Size of data.
+ * @param arg Argument pointer of the sink.
+ * @return True to continue processing or false to abort.
+ */
+typedef bool (*pes_stream_patch_callback)(const size_t offset,
+	const void * const data, const size_t size, void * const arg);
+
+/** Seekable sink of PES stream encoders. Both callbacks are required. */
+struct pes_stream_sink {
+	pes_encode_callback write_cb;       /* Append data. */
+	pes_stream_patch_callback patch_cb; /* Overwrite written data. */
+	void *arg;                          /* Argument of callbacks. */
+};
+
+/**
+ * Callback to read previously spilled PEC stitch data.
+ *
+ * @param offset Offset of data from the beginning of the spill.
+ * @param data Data to read into.
+ * @param size Size of data.
+ * @param arg Argument pointer of the spill.
+ * @return True to continue processing or false to abort.
+ */
+typedef bool (*pes_stream_read_callback)(const size_t offset,
+	void * const data, const size_t size, void * const arg);
+
+/**
+ * Spill of PEC stitch data, for example a temporary file. Both callbacks
+ * are required. The spill is read once, from the beginning to the end, by
+ * `pes_stream_encoder_finish()`.
+ */
+struct pes_stream_spill {
+	pes_encode_callback write_cb;       /* Append data. */
+	pes_stream_read_callback read_cb;   /* Read written data. */
+	void *arg;                          /* Argument of callbacks. */
+};
+
+/**
+ * Create a PES stream encoder object. Data is written to the sink and the
+ * spill in chunks of up to 64 KiB, and written data is patched only by
+ * `pes_stream_encoder_finish()`.
+ *
+ * @param sink Sink to write PES data to.
+ * @param spill Spill to write PEC stitch data to until finished.
+ * @return Allocated PES stream encoder object or NULL, for example if a
+ * callback of the sink or the spill is NULL. Must be freed using
+ * `pes_stream_encoder_free()`.
+ */
+struct pes_stream_encoder *pes_stream_encoder_init(
+	const struct pes_stream_sink sink,
+	const struct pes_stream_spill spill);
+
+/**
+ * Create a PES stream encoder object with the given allocator, which is
+ * used for all memory of the object.
+ *
+ * @param sink Sink to write PES data to.
+ * @param spill Spill to write PEC stitch data to until finished.
+ * @param allocator Allocator, copied, or NULL for the allocator set by
+ * `libpes_allocator_set()`. NULL is returned if any of its callbacks
+ * is NULL.
+ * @return Allocated PES stream encoder object or NULL, for example if a
+ * callback of the sink or the spill is NULL. Must be freed using
+ * `pes_stream_encoder_free()`.
+ */
+struct pes_stream_encoder *pes_stream_encoder_init_with_allocator(
+	const struct pes_stream_sink sink,
+	const struct pes_stream_spill spill,
+	const struct libpes_allocator * const allocator);
+
+/**
+ * Free allocated PES stream encoder object. Data that has not been
+ * finished is discarded.
+ *
+ * @param encoder PES stream encoder object to free. Ignored if NULL.
+ */
+void pes_stream_encoder_free(struct pes_stream_encoder * const encoder);
+
+/**
+ * Append a thread to the PES stream encoder object. Appended threads are
+ * indexed from zero.
+ *
+ * @param encoder PES stream encoder object.
+ * @param thread Thread to append.
+ * @return True if thread was successfully appended, else false.
+ */
+bool pes_stream_append_thread(struct pes_stream_encoder * const encoder,
+	const struct pec_thread thread);
+
+/**
+ * Set how thread colors are matched to PEC palette threads. The default is
+ * `pec_palette_index_by_rgb()`. The match cannot be changed once threads
+ * have been appended.
+ *
+ * @param encoder PES stream encoder object.
+ * @param palette_match Function matching colors to PEC palette indices.
+ * @return True if the function was set, else false if threads have been
+ * appended.
+ */
+bool pes_stream_encoder_palette_match(
+	struct pes_stream_encoder * const encoder,
+	const pec_palette_match palette_match);
+
+/**
+ * Append a stitch to the PES stream encoder object. Note that the given
+ * thread index must have been appended using `pes_stream_append_thread()`
+ * before this call.
+ *
+ * @param encoder PES stream encoder object.
+ * @param thread_index Thread index starting from zero.
+ * @param x X coordinate of stitch [millimeter].
+ * @param y Y coordinate of stitch [millimeter].
+ * @return True if stitch was successfully appended, else false. The
+ * encoding can continue if the stitch was invalid or beyond the limit of
+ * PEC stitch data, but not if the sink or the spill failed.
+ */
+bool pes_stream_append_stitch(struct pes_stream_encoder * const encoder,
+	const int thread_index, const float x, const float y);
+
+/**
+ * Append a jump stitch to the PES stream encoder object. Note that the given
+ * thread index must have been appended using `pes_stream_append_thread()`
+ * before this call.
+ *
+ * @param encoder PES stream encoder object.
+ * @param thread_index Thread index starting from zero.
+ * @param x X coordinate of stitch [millimeter].
+ * @param y Y coordinate of stitch [millimeter].
+ * @return True if stitch was successfully appended, else false.
+ */
+bool pes_stream_append_jump_stitch(struct pes_stream_encoder * const encoder,
+	const int thread_index, const float x, const float y);
+
+/**
+ * Append stitches to the PES stream encoder object, equivalent to
+ * appending them one at a time with `pes_stream_append_stitch()`.
+ *
+ * @param encoder PES stream encoder object.
+ * @param thread_index Thread index starting from zero.
+ * @param xy Interleaved X and Y coordinates of stitches [millimeter].
+ * @param n Number of stitches.
+ * @param flags Flags of `enum pes_append_flag`.
+ * @return True if all stitches were successfully appended, else false in
+ * which case the stitches before the failed one were appended.
+ */
+bool pes_stream_append_stitches(struct pes_stream_encoder * const encoder,
+	const int thread_index, const float * const xy, const size_t n,
+	const int flags);
+
+/**
+ * Set affine transform for PES stream object. The transform can be set
+ * any time before the encoding is finished.
+ *
+ * @param encoder PES stream encoder object.
+ * @param affine_transform Affine PES transform matrix.
+ */
+void pes_stream_encode_transform(struct pes_stream_encoder * const encoder,
+	const struct pes_transform affine_transform);
+
+/**
+ * Finish the PES version 1 encoding by writing the thread list and the
+ * embedded PEC data, and patching the header and the block counts. No
+ * stitches can be appended afterwards.
+ *
+ * @param encoder PES stream encoder object.
+ * @param size Size of encoded PES data, or zero on failure. Ignored if NULL.
+ * @return True on successful completion, else false.
+ */
+bool pes_stream_encoder_finish(struct pes_stream_encoder * const encoder,
+	size_t * const size);
+
+#endif /* PESLIB_PES_STREAM_ENCODER_H */
@@ -35,6 +35,42 @@ struct svg_emb_decoder; /* SVG embroidery decoder object forward declaration. */
 struct svg_emb_decoder *svg_emb_decoder_init(const char * const text,
 	const sax_error_callback error_cb, void * const arg);
 
+/**
+ * Create an SVG embroidery decoder object, matching thread colors to PEC
+ * palette threads with the given function.
+ *
+ * @param text Pointer to SVG XML text.
+ * @param palette_match Function matching colors to PEC palette indices,
+ * such as `pec_palette_index_by_rgb_perceptual()`.
+ * @param error_cb Invoked for parsing errors. Ignored if NULL.
+ * @param arg Optional argument pointer supplied to callback. Can be NULL.
+ * @return Allocated SVG embroidery decoder object or NULL. Must be freed using
+ * `svg_emb_decoder_free()`.
+ */
+struct svg_emb_decoder *svg_emb_decoder_init_palette(const char * const text,
+	const pec_palette_match palette_match,
+	const sax_error_callback error_cb, void * const arg);
+
+/**
+ * Create an SVG embroidery decoder object with the given allocator, which
+ * is used for all memory of the object.
+ *
+ * @param text Pointer to SVG XML text.
+ * @param palette_match Function matching colors to PEC palette indices,
+ * such as `pec_palette_index_by_rgb()`.
+ * @param allocator Allocator, copied, or NULL for the allocator set by
+ * `libpes_allocator_set()`. NULL is returned if any of its callbacks
+ * is NULL.
+ * @param error_cb Invoked for parsing errors. Ignored if NULL.
+ * @param arg Optional argument pointer supplied to callback. Can be NULL.
+ * @return Allocated SVG embroidery decoder object or NULL. Must be freed using
+ * `svg_emb_decoder_free()`.
+ */
+struct svg_emb_decoder *svg_emb_decoder_init_with_allocator(
+	const char * const text, const pec_palette_match palette_match,
+	const struct libpes_allocator * const allocator,
+	const sax_error_callback error_cb, void * const arg);
+
 /**
  * Free allocated SVG embroidery decoder object.
  *
@@ -21,6 +21,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+#include "allocator.h"
 #include "pes.h"
 #include "pec.h"
 
@@ -34,6 +35,19 @@ struct svg_emb_encoder; /* SVG embroidery encoder object forward declaration. */
  */
 struct svg_emb_encoder *svg_emb_encoder_init();
 
+/**
+ * Create an SVG embroidery encoder object with the given allocator, which
+ * is used for all memory of the object.
+ *
+ * @param allocator Allocator, copied, or NULL for the allocator set by
+ * `libpes_allocator_set()`. NULL is returned if any of its callbacks
+ * is NULL.
+ * @return Allocated SVG embroidery encoder object or NULL. Must be freed
+ * using `svg_emb_encoder_free()`.
+ */
+struct svg_emb_encoder *svg_emb_encoder_init_with_allocator(
+	const struct libpes_allocator * const allocator);
+
 /**
  * Free allocated SVG embroidery encoder object.
  *
@@ -41,6 +55,27 @@ struct svg_emb_encoder *svg_emb_encoder_init();
  */
 void svg_emb_encoder_free(struct svg_emb_encoder * const encoder);
 
+/**
+ * Reset SVG embroidery encoder object to its initial state, removing all
+ * threads, stitches and transforms but keeping allocated capacity, so that
+ * it can be reused without allocating. The buffer size is kept.
+ *
+ * @param encoder SVG embroidery encoder object.
+ */
+void svg_emb_encoder_reset(struct svg_emb_encoder * const encoder);
+
+/**
+ * Reserve capacity for a total number of stitches, to allocate once when
+ * the number of stitches is known in advance. Capacity otherwise grows
+ * geometrically as stitches are appended.
+ *
+ * @param encoder SVG embroidery encoder object.
+ * @param stitch_count Total number of stitches.
+ * @return True if capacity was successfully reserved, else false.
+ */
+bool svg_emb_encoder_reserve(struct svg_emb_encoder * const encoder,
+	const size_t stitch_count);
+
 /**
  * Append a thread to the SVG embroidery encoder object. Appended threads are
  * indexed from zero.
@@ -89,6 +124,22 @@ void svg_emb_encode_transform(struct svg_emb_encoder * const encoder,
 bool svg_emb_append_jump_stitch(struct svg_emb_encoder * const encoder,
 	const int thread_index, const float x, const float y);
 
+/**
+ * Set size of the internal buffer used by `svg_emb_encode()`. Encoded data
+ * is staged in the buffer and the callback is invoked with chunks of up to
+ * this size rather than with a few bytes at a time. The default size is
+ * 64 KiB. The buffer is allocated here, kept across encodings and resets,
+ * and freed with the encoder. An encoder must therefore not encode from
+ * several threads at once.
+ *
+ * @param encoder SVG embroidery encoder object.
+ * @param size Size of buffer in bytes, or zero to invoke the callback
+ * directly for every piece of encoded data, as is also done if the buffer
+ * cannot be allocated.
+ */
+void svg_emb_encoder_buffer_size(struct svg_emb_encoder * const encoder,
+	const size_t size);
+
 /**
  * Callback with successively encoded SVG embroidery data.
  *
@@ -113,6 +164,22 @@ typedef bool (*svg_emb_encode_callback)(const void * const data,
 bool svg_emb_encode(const struct svg_emb_encoder * const encoder,
 	const svg_emb_encode_callback encode_cb, void * const arg);
 
+/**
+ * Encode SVG embroidery directly into caller-provided memory, without
+ * callback. The required capacity is given by `svg_emb_encode_size()`,
+ * which is only computed here if the capacity turns out to be insufficient.
+ *
+ * @param encoder SVG embroidery encoder object.
+ * @param dst Memory to write encoded data into.
+ * @param capacity Capacity of memory in bytes.
+ * @param written Size of encoded data in bytes. If the capacity is
+ * insufficient this is the required capacity, and zero if the data cannot
+ * be encoded. Ignored if NULL.
+ * @return True on successful completion, else false.
+ */
+bool svg_emb_encode_into(const struct svg_emb_encoder * const encoder,
+	void * const dst, const size_t capacity, size_t * const written);
+
 /**
  * Return size of encoded SVG embroidery data in bytes.
  *
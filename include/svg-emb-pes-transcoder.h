@@ -35,6 +35,24 @@ bool svg_emb_pes1_transcode(const char * const svg_emb_text,
 	const pes_encode_callback encode_cb,
 	const sax_error_callback error_cb, void * const arg);
 
+/**
+ * Transcode SVG embroidery to PES version 1 by sending data to the provided
+ * callback, matching thread colors to PEC palette threads with the given
+ * function.
+ *
+ * @param svg_emb_text SVG embroidery XML text.
+ * @param palette_match Function matching colors to PEC palette indices,
+ * such as `pec_palette_index_by_rgb_perceptual()`.
+ * @param encode_cb Callback to invoke for encoded data.
+ * @param error_cb Invoked for SVG embroidery parsing errors. Ignored if NULL.
+ * @param arg Optional argument pointer supplied to callback. Can be NULL.
+ * @return True on successful completion, else false.
+ */
+bool svg_emb_pes1_transcode_palette(const char * const svg_emb_text,
+	const pec_palette_match palette_match,
+	const pes_encode_callback encode_cb,
+	const sax_error_callback error_cb, void * const arg);
+
 /**
  * Transcode SVG embroidery to PES version 4 by sending data to the provided
  * callback.
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "allocate.h"
+
+static void *default_alloc(const size_t size, void * const arg)
+{
+	(void)arg;
+
+	return malloc(size);
+}
+
+static void *default_realloc(void * const ptr, const size_t size,
+	void * const arg)
+{
+	(void)arg;
+
+	return realloc(ptr, size);
+}
+
+static void default_free(void * const ptr, void * const arg)
+{
+	(void)arg;
+
+	free(ptr);
+}
+
+static const struct libpes_allocator default_allocator = {
+	.alloc_cb = default_alloc,
+	.realloc_cb = default_realloc,
+	.free_cb = default_free
+};
+
+static struct libpes_allocator global_allocator = {
+	.alloc_cb = default_alloc,
+	.realloc_cb = default_realloc,
+	.free_cb = default_free
+};
+
+void libpes_allocator_set(const struct libpes_allocator * const allocator)
+{
+	global_allocator = allocator_valid(allocator) ?
+		*allocator : default_allocator;
+}
+
+bool allocator_valid(const struct libpes_allocator * const allocator)
+{
+	return allocator != NULL &&
+		allocator->alloc_cb != NULL &&
+		allocator->realloc_cb != NULL &&
+		allocator->free_cb != NULL;
+}
+
+const struct libpes_allocator *allocator_global()
+{
+	return &global_allocator;
+}
+
+void *allocate(const struct libpes_allocator * const allocator,
+	const size_t size)
+{
+	return size != 0 ? allocator->alloc_cb(size, allocator->arg) : NULL;
+}
+
+void *allocate_zero(const struct libpes_allocator * const allocator,
+	const size_t count, const size_t size)
+{
+	if (size != 0 && SIZE_MAX / size < count)
+		return NULL;
+
+	void * const ptr = allocate(allocator, count * size);
+
+	return ptr != NULL ? memset(ptr, 0, count * size) : NULL;
+}
+
+void *reallocate(const struct libpes_allocator * const allocator,
+	void * const ptr, const size_t size)
+{
+	return allocator->realloc_cb(ptr, size, allocator->arg);
+}
+
+void deallocate(const struct libpes_allocator * const allocator,
+	void * const ptr)
+{
+	if (ptr != NULL)
+		allocator->free_cb(ptr, allocator->arg);
+}
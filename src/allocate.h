@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PESLIB_ALLOCATE_H
+#define PESLIB_ALLOCATE_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "allocator.h"
+
+/**
+ * Return the allocator set by `libpes_allocator_set()`.
+ *
+ * @return Allocator of objects created by `*_init()` functions.
+ */
+const struct libpes_allocator *allocator_global();
+
+/**
+ * Check that an allocator has all its callbacks.
+ *
+ * @param allocator Allocator, or NULL.
+ * @return True if the allocator is nonnull with nonnull callbacks,
+ * otherwise false.
+ */
+bool allocator_valid(const struct libpes_allocator * const allocator);
+
+/**
+ * Allocate memory.
+ *
+ * @param allocator Allocator.
+ * @param size Size of memory in bytes.
+ * @return Allocated memory, or NULL on failure or if the size is zero in
+ * which case the allocator is not called.
+ */
+void *allocate(const struct libpes_allocator * const allocator,
+	const size_t size);
+
+/**
+ * Allocate memory for an array, with all bytes cleared, like `calloc()`.
+ *
+ * @param allocator Allocator.
+ * @param count Number of elements.
+ * @param size Size of each element in bytes.
+ * @return Allocated memory, or NULL on failure or if the total size is
+ * zero in which case the allocator is not called.
+ */
+void *allocate_zero(const struct libpes_allocator * const allocator,
+	const size_t count, const size_t size);
+
+/**
+ * Change size of allocated memory.
+ *
+ * @param allocator Allocator that allocated the memory.
+ * @param ptr Allocated memory, or NULL to allocate new memory.
+ * @param size New size of memory in bytes.
+ * @return Reallocated memory, or NULL on failure in which case the given
+ * memory is left unchanged.
+ */
+void *reallocate(const struct libpes_allocator * const allocator,
+	void * const ptr, const size_t size);
+
+/**
+ * Free allocated memory.
+ *
+ * @param allocator Allocator that allocated the memory.
+ * @param ptr Allocated memory. Ignored if NULL.
+ */
+void deallocate(const struct libpes_allocator * const allocator,
+	void * const ptr);
+
+#endif /* PESLIB_ALLOCATE_H */
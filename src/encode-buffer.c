@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "allocate.h"
+#include "encode-buffer.h"
+
+static bool flush_data(struct encode_buffer * const buffer)
+{
+	const size_t size = buffer->size;
+
+	buffer->size = 0;
+
+	return size == 0 || buffer->encode_cb(buffer->data, size, buffer->arg);
+}
+
+void encode_buffer_init(struct encode_buffer * const buffer,
+	const struct libpes_allocator * const allocator,
+	const size_t capacity, const encode_buffer_callback encode_cb,
+	void * const arg)
+{
+	buffer->encode_cb = encode_cb;
+	buffer->arg = arg;
+	buffer->allocator = allocator;
+	buffer->size = 0;
+	buffer->data = capacity != 0 ? allocate(allocator, capacity) : NULL;
+	buffer->capacity = buffer->data != NULL ? capacity : 0;
+}
+
+void encode_buffer_init_staging(struct encode_buffer * const buffer,
+	void * const data, const size_t capacity,
+	const encode_buffer_callback encode_cb, void * const arg)
+{
+	buffer->encode_cb = encode_cb;
+	buffer->arg = arg;
+	buffer->allocator = NULL;
+	buffer->size = 0;
+	buffer->data = data;
+	buffer->capacity = data != NULL ? capacity : 0;
+}
+
+void encode_buffer_init_memory(struct encode_buffer * const buffer,
+	void * const data, const size_t capacity)
+{
+	buffer->encode_cb = NULL;
+	buffer->arg = NULL;
+	buffer->allocator = NULL;
+	buffer->size = 0;
+	buffer->data = data;
+	buffer->capacity = data != NULL ? capacity : 0;
+}
+
+bool encode_buffer_write(const void * const data,
+	const size_t size, void * const arg)
+{
+	struct encode_buffer * const buffer = arg;
+
+	if (buffer->capacity == 0)
+		return buffer->encode_cb != NULL &&
+		       buffer->encode_cb(data, size, buffer->arg);
+
+	if (buffer->capacity - buffer->size < size) {
+		/* Memory buffers without callback cannot be flushed. */
+		if (buffer->encode_cb == NULL || !flush_data(buffer))
+			return false;
+
+		/* Data that does not fit is passed directly to the callback. */
+		if (buffer->capacity < size)
+			return buffer->encode_cb(data, size, buffer->arg);
+	}
+
+	memcpy(&buffer->data[buffer->size], data, size);
+	buffer->size += size;
+
+	return true;
+}
+
+bool encode_buffer_flush(struct encode_buffer * const buffer,
+	const bool valid)
+{
+	const bool flushed = valid && flush_data(buffer);
+
+	if (buffer->allocator != NULL)
+		deallocate(buffer->allocator, buffer->data);
+	buffer->data = NULL;
+	buffer->capacity = 0;
+
+	return flushed;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PESLIB_ENCODE_BUFFER_H
+#define PESLIB_ENCODE_BUFFER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "allocator.h"
+
+#define ENCODE_BUFFER_SIZE (64 * 1024) /* Default size of encode buffers. */
+
+/**
+ * Callback with successively encoded data. This is the same signature as
+ * the PEC, PES and SVG embroidery encode callbacks.
+ */
+typedef bool (*encode_buffer_callback)(const void * const data,
+	const size_t size, void * const arg);
+
+/**
+ * Encode buffer staging small pieces of encoded data, to invoke the
+ * underlying callback with large chunks.
+ */
+struct encode_buffer {
+	encode_buffer_callback encode_cb;
+	void *arg;
+
+	const struct libpes_allocator *allocator;
+	size_t size;
+	size_t capacity;
+	uint8_t *data;
+};
+
+/**
+ * Initialise encode buffer. Data is passed directly to the callback if the
+ * capacity is zero or if the buffer cannot be allocated.
+ *
+ * @param buffer Encode buffer to initialise.
+ * @param allocator Allocator of buffer, which must remain valid until the
+ * buffer is freed by `encode_buffer_flush()`.
+ * @param capacity Capacity of buffer in bytes.
+ * @param encode_cb Callback to invoke for buffered data.
+ * @param arg Argument pointer supplied to callback.
+ */
+void encode_buffer_init(struct encode_buffer * const buffer,
+	const struct libpes_allocator * const allocator,
+	const size_t capacity, const encode_buffer_callback encode_cb,
+	void * const arg);
+
+/**
+ * Initialise encode buffer staging data in caller-provided memory, such as
+ * memory kept by an encoder object across encodings. Data is passed
+ * directly to the callback if the capacity is zero. The memory is not
+ * freed by `encode_buffer_flush()`.
+ *
+ * @param buffer Encode buffer to initialise.
+ * @param data Memory to stage encoded data in. Can be NULL if the capacity
+ * is zero.
+ * @param capacity Capacity of memory in bytes.
+ * @param encode_cb Callback to invoke for buffered data.
+ * @param arg Argument pointer supplied to callback.
+ */
+void encode_buffer_init_staging(struct encode_buffer * const buffer,
+	void * const data, const size_t capacity,
+	const encode_buffer_callback encode_cb, void * const arg);
+
+/**
+ * Initialise encode buffer writing into caller-provided memory, without
+ * callback. Writes beyond the capacity fail. The memory is not freed by
+ * `encode_buffer_flush()`, which must not be called for such buffers.
+ *
+ * @param buffer Encode buffer to initialise.
+ * @param data Memory to write encoded data into.
+ * @param capacity Capacity of memory in bytes.
+ */
+void encode_buffer_init_memory(struct encode_buffer * const buffer,
+	void * const data, const size_t capacity);
+
+/**
+ * Encode callback appending data to the encode buffer given as argument.
+ *
+ * @param data Encoded data.
+ * @param size Size of encoded data.
+ * @param arg Encode buffer.
+ * @return True on success, else false if the underlying callback failed
+ * or if a memory buffer is full.
+ */
+bool encode_buffer_write(const void * const data,
+	const size_t size, void * const arg);
+
+/**
+ * Flush remaining data if the encoding was valid, and free the buffer
+ * unless its memory was provided by the caller.
+ *
+ * @param buffer Encode buffer to flush and free.
+ * @param valid False if the encoding failed, in which case remaining data
+ * is discarded.
+ * @return True if the encoding was valid and successfully flushed, else
+ * false.
+ */
+bool encode_buffer_flush(struct encode_buffer * const buffer,
+	const bool valid);
+
+#endif /* PESLIB_ENCODE_BUFFER_H */
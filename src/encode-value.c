@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "encode-value.h"
+
+bool encode_u8(const int value,
+	const encode_buffer_callback encode_cb, void * const arg)
+{
+	const uint8_t data[] = { value & 0xFF };
+
+	return 0 <= value && value <= 0xFF &&
+		encode_cb(data, sizeof(data), arg);
+}
+
+bool encode_u16lsb(const int value,
+	const encode_buffer_callback encode_cb, void * const arg)
+{
+	const uint8_t data[] = {
+		(value >>  0) & 0xFF,
+		(value >>  8) & 0xFF
+	};
+
+	return 0 <= value && value <= 0xFFFF &&
+		encode_cb(data, sizeof(data), arg);
+}
+
+bool encode_u24lsb(const int value,
+	const encode_buffer_callback encode_cb, void * const arg)
+{
+	const uint8_t data[] = {
+		(value >>  0) & 0xFF,
+		(value >>  8) & 0xFF,
+		(value >> 16) & 0xFF
+	};
+
+	return 0 <= value && value <= 0xFFFFFF &&
+		encode_cb(data, sizeof(data), arg);
+}
+
+bool encode_i16lsb(const int value,
+	const encode_buffer_callback encode_cb, void * const arg)
+{
+	return -0x8000 <= value && value <= 0x7FFF &&
+		encode_u16lsb(value & 0xFFFF, encode_cb, arg);
+}
+
+bool encode_i32lsb(const int value,
+	const encode_buffer_callback encode_cb, void * const arg)
+{
+	const uint8_t data[] = {
+		(value >>  0) & 0xFF,
+		(value >>  8) & 0xFF,
+		(value >> 16) & 0xFF,
+		(value >> 24) & 0xFF
+	};
+
+	return encode_cb(data, sizeof(data), arg);
+}
+
+bool encode_f32lsb(const float f,
+	const encode_buffer_callback encode_cb, void * const arg)
+{
+	uint32_t raw;
+
+	if (sizeof(raw) != sizeof(f))
+		return false;
+	memcpy(&raw, &f, sizeof(raw));
+
+	const int value = (int)raw;
+	return encode_i32lsb(value, encode_cb, arg);
+}
+
+bool encode_string(const char * const s,
+	const encode_buffer_callback encode_cb, void * const arg)
+{
+	const size_t size = strlen(s);
+
+	return size <= 0xFFFF &&
+	       encode_u16lsb((int)size, encode_cb, arg) &&
+	       encode_cb(s, (int)size, arg);
+}
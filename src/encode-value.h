@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PESLIB_ENCODE_VALUE_H
+#define PESLIB_ENCODE_VALUE_H
+
+#include <stdbool.h>
+
+#include "encode-buffer.h"
+
+/*
+ * Little-endian values and strings of the PEC and PES formats, shared by
+ * the encoders. Values out of range are not encoded, and false is returned
+ * without invoking the callback.
+ */
+
+/**
+ * Encode an unsigned 8-bit value.
+ *
+ * @param value Value in the range 0 to 0xFF.
+ * @param encode_cb Callback with encoded data.
+ * @param arg Argument pointer supplied to callback.
+ * @return True if the value was successfully encoded, else false.
+ */
+bool encode_u8(const int value,
+	const encode_buffer_callback encode_cb, void * const arg);
+
+/**
+ * Encode an unsigned 16-bit value, least significant byte first.
+ *
+ * @param value Value in the range 0 to 0xFFFF.
+ * @param encode_cb Callback with encoded data.
+ * @param arg Argument pointer supplied to callback.
+ * @return True if the value was successfully encoded, else false.
+ */
+bool encode_u16lsb(const int value,
+	const encode_buffer_callback encode_cb, void * const arg);
+
+/**
+ * Encode an unsigned 24-bit value, least significant byte first.
+ *
+ * @param value Value in the range 0 to 0xFFFFFF.
+ * @param encode_cb Callback with encoded data.
+ * @param arg Argument pointer supplied to callback.
+ * @return True if the value was successfully encoded, else false.
+ */
+bool encode_u24lsb(const int value,
+	const encode_buffer_callback encode_cb, void * const arg);
+
+/**
+ * Encode a signed 16-bit value, least significant byte first.
+ *
+ * @param value Value in the range -0x8000 to 0x7FFF.
+ * @param encode_cb Callback with encoded data.
+ * @param arg Argument pointer supplied to callback.
+ * @return True if the value was successfully encoded, else false.
+ */
+bool encode_i16lsb(const int value,
+	const encode_buffer_callback encode_cb, void * const arg);
+
+/**
+ * Encode a signed 32-bit value, least significant byte first.
+ *
+ * @param value Value.
+ * @param encode_cb Callback with encoded data.
+ * @param arg Argument pointer supplied to callback.
+ * @return True if the value was successfully encoded, else false.
+ */
+bool encode_i32lsb(const int value,
+	const encode_buffer_callback encode_cb, void * const arg);
+
+/**
+ * Encode a 32-bit floating point value, least significant byte first.
+ *
+ * @param f Value.
+ * @param encode_cb Callback with encoded data.
+ * @param arg Argument pointer supplied to callback.
+ * @return True if the value was successfully encoded, else false.
+ */
+bool encode_f32lsb(const float f,
+	const encode_buffer_callback encode_cb, void * const arg);
+
+/**
+ * Encode a string preceded by its 16-bit length.
+ *
+ * @param s NUL-terminated string of at most 0xFFFF characters.
+ * @param encode_cb Callback with encoded data.
+ * @param arg Argument pointer supplied to callback.
+ * @return True if the string was successfully encoded, else false.
+ */
+bool encode_string(const char * const s,
+	const encode_buffer_callback encode_cb, void * const arg);
+
+#endif /* PESLIB_ENCODE_VALUE_H */
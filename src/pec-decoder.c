@@ -22,7 +22,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "allocate.h"
 #include "pec-decoder.h"
+#include "stitch-kernel.h"
 
 struct pec_string {
 	int length;  /* Length is 0-31. */
@@ -30,10 +32,99 @@ struct pec_string {
 };
 
 struct pec_decoder {
+	struct libpes_allocator allocator;
 	int size;
-	uint8_t *data;
+	const uint8_t *data;
+
+	struct {
+		struct pec_string label;
+		int thread_count;
+		uint8_t palette[PEC_MAX_THREADS];
+		int stitch_offset;    /* Offset of first stitch. */
+		int thumbnail_offset; /* Offset of first thumbnail. */
+		int thumbnail_width;  /* Width of thumbnails [pixel]. */
+		int thumbnail_height; /* Height of thumbnails [pixel]. */
+	} header;
+
+	struct {
+		int count;
+		int thread_list[PEC_MAX_THREADS];
+		int type_list[PEC_STITCH_STOP + 1];
+	} stitch_counts;
+};
+
+struct stitch_delta {
+	int16_t delta; /* Delta, excluding the second byte of 2-byte forms. */
+	uint8_t mask;  /* Mask of the second byte, 0xFF for 2-byte forms. */
+	int8_t type;   /* PEC_STITCH_JUMP, PEC_STITCH_TRIM or zero. */
+};
+
+/*
+ * Lookup table indexed by the first byte of a coordinate delta. Bytes below
+ * 0x80 are 7-bit two's complement deltas. Other bytes are followed by the
+ * low 8 bits of a 12-bit two's complement delta, with flags for jump and
+ * trim stitches.
+ */
+#define STITCH_DELTA(b) {						\
+	((b) & 0x80) != 0 ? (((b) & 0x0F) << 8) - ((b) & 0x08 ? 0x1000 : 0) :\
+	(b) >= 0x40 ? (b) - 0x80 : (b),					\
+	((b) & 0x80) != 0 ? 0xFF : 0,					\
+	((b) & 0x80) == 0 ? 0 :						\
+	((b) & 0x10) != 0 ? PEC_STITCH_JUMP :				\
+	((b) & 0x20) != 0 ? PEC_STITCH_TRIM : 0 }
+#define STITCH_DELTA_4(b)						\
+	STITCH_DELTA((b) + 0), STITCH_DELTA((b) + 1),			\
+	STITCH_DELTA((b) + 2), STITCH_DELTA((b) + 3)
+#define STITCH_DELTA_16(b)						\
+	STITCH_DELTA_4((b) + 0), STITCH_DELTA_4((b) + 4),		\
+	STITCH_DELTA_4((b) + 8), STITCH_DELTA_4((b) + 12)
+#define STITCH_DELTA_64(b)						\
+	STITCH_DELTA_16((b) + 0), STITCH_DELTA_16((b) + 16),		\
+	STITCH_DELTA_16((b) + 32), STITCH_DELTA_16((b) + 48)
+
+static const struct stitch_delta stitch_delta_table[256] = {
+	STITCH_DELTA_64(0), STITCH_DELTA_64(64),
+	STITCH_DELTA_64(128), STITCH_DELTA_64(192)
+};
+
+/*
+ * Lookup table expanding 8 thumbnail pixels of a byte, least significant
+ * bit first, into one 8-bit pixel each.
+ */
+#define THUMBNAIL_PIXELS(b) {						\
+	(b) & 0x01 ? 0xFF : 0, (b) & 0x02 ? 0xFF : 0,			\
+	(b) & 0x04 ? 0xFF : 0, (b) & 0x08 ? 0xFF : 0,			\
+	(b) & 0x10 ? 0xFF : 0, (b) & 0x20 ? 0xFF : 0,			\
+	(b) & 0x40 ? 0xFF : 0, (b) & 0x80 ? 0xFF : 0 }
+#define THUMBNAIL_PIXELS_4(b)						\
+	THUMBNAIL_PIXELS((b) + 0), THUMBNAIL_PIXELS((b) + 1),		\
+	THUMBNAIL_PIXELS((b) + 2), THUMBNAIL_PIXELS((b) + 3)
+#define THUMBNAIL_PIXELS_16(b)						\
+	THUMBNAIL_PIXELS_4((b) + 0), THUMBNAIL_PIXELS_4((b) + 4),	\
+	THUMBNAIL_PIXELS_4((b) + 8), THUMBNAIL_PIXELS_4((b) + 12)
+#define THUMBNAIL_PIXELS_64(b)						\
+	THUMBNAIL_PIXELS_16((b) + 0), THUMBNAIL_PIXELS_16((b) + 16),	\
+	THUMBNAIL_PIXELS_16((b) + 32), THUMBNAIL_PIXELS_16((b) + 48)
+
+static const uint8_t thumbnail_pixels_table[256][8] = {
+	THUMBNAIL_PIXELS_64(0), THUMBNAIL_PIXELS_64(64),
+	THUMBNAIL_PIXELS_64(128), THUMBNAIL_PIXELS_64(192)
+};
+
+#define STITCH_BATCH 256
+
+struct stitch_batch {
+	int x[STITCH_BATCH];          /* Raw x coordinates. */
+	int y[STITCH_BATCH];          /* Raw y coordinates. */
+	uint8_t type[STITCH_BATCH];   /* Types of stitches. */
+};
 
-	struct pec_string label;
+struct stitch_cursor {
+	int offset;                /* Offset of next stitch. */
+	int x;                     /* Raw x coordinate of current stitch. */
+	int y;                     /* Raw y coordinate of current stitch. */
+	enum pec_stitch_type type; /* Type of current stitch. */
+	bool end;                  /* End of stitches has been reached. */
 };
 
 static bool decode_u8(const struct pec_decoder * const decoder,
@@ -47,50 +138,58 @@ static bool decode_u8(const struct pec_decoder * const decoder,
 	return true;
 }
 
-static bool decode_u16lsb(const struct pec_decoder * const decoder,
+static bool decode_u24lsb(const struct pec_decoder * const decoder,
 	const int offset, int * const value)
 {
-	if (offset < 0 || decoder->size < offset + 2)
+	if (offset < 0 || decoder->size < offset + 3)
 		return false;
 
-	*value = ((int)decoder->data[offset + 0] << 0) |
-	         ((int)decoder->data[offset + 1] << 8);
+	*value = ((int)decoder->data[offset + 0] <<  0) |
+	         ((int)decoder->data[offset + 1] <<  8) |
+	         ((int)decoder->data[offset + 2] << 16);
 
 	return true;
 }
 
-static bool decode_thumbnail_offset(const struct pec_decoder * const decoder,
-	int * const image_offset)
+static bool init_label(struct pec_decoder * const decoder)
 {
-	if (!decode_u16lsb(decoder, 514, image_offset))
+	const int label_length = 19;
+
+	if (decoder->size < label_length)
 		return false;
 
-	*image_offset += 512;
+	/* FIXME: Remove spaces and/or carrige return from label? */
+	memcpy(&decoder->header.label.s[0], &decoder->data[0], label_length);
+	decoder->header.label.length = (int)strlen(decoder->header.label.s);
 
 	return true;
 }
 
-static bool stitch_count(const int stitch_index,
-	const float x, const float y, const enum pec_stitch_type stitch_type,
-	void * const arg)
+static bool init_header(struct pec_decoder * const decoder)
 {
-	int * const counter = (int *)arg;
+	int thread_count, thumbnail_offset, thumbnail_width, thumbnail_height;
 
-	(*counter)++;
+	if (!init_label(decoder) ||
+	    !decode_u8(decoder, 34, &thumbnail_width) ||
+	    !decode_u8(decoder, 35, &thumbnail_height) ||
+	    !decode_u8(decoder, 48, &thread_count) ||
+	    !decode_u24lsb(decoder, 514, &thumbnail_offset))
+		return false;
 
-	return true;
-}
+	decoder->header.thread_count = thread_count + 1;
+	decoder->header.stitch_offset = 532;
+	decoder->header.thumbnail_offset = thumbnail_offset + 512;
+	decoder->header.thumbnail_width = 8 * thumbnail_width;
+	decoder->header.thumbnail_height = thumbnail_height;
 
-static bool init_label(struct pec_decoder * const decoder)
-{
-	const int label_length = 19;
+	for (int i = 0; i < decoder->header.thread_count; i++) {
+		int palette_index;
 
-	if (decoder->size < label_length)
-		return false;
+		if (!decode_u8(decoder, 49 + i, &palette_index))
+			return false;
 
-	/* FIXME: Remove spaces and/or carrige return from label? */
-	memcpy(&decoder->label.s[0], &decoder->data[0], label_length);
-	decoder->label.length = (int)strlen(decoder->label.s);
+		decoder->header.palette[i] = palette_index;
+	}
 
 	return true;
 }
@@ -126,54 +225,204 @@ static bool decode_stitch_coordinate(const struct pec_decoder * const decoder,
 	return true;
 }
 
-struct pec_decoder *pec_decoder_init(const void * const data, const size_t size)
+static bool next_stitch(const struct pec_decoder * const decoder,
+	struct stitch_cursor * const cursor)
+{
+	int cmd;
+
+	if (!decode_u8(decoder, cursor->offset, &cmd))
+		return false;
+
+	if (cmd == 0xFF) {
+		cursor->end = true;
+		return false;
+	} else if (cmd == 0xFE) {
+		cursor->type = PEC_STITCH_STOP;
+		cursor->offset += 3; /* FIXME: Unknown data */
+		return true;
+	}
+
+	cursor->type = PEC_STITCH_NORMAL;
+
+	return decode_stitch_coordinate(decoder,
+			&cursor->offset, &cursor->x, &cursor->type) &&
+	       decode_stitch_coordinate(decoder,
+			&cursor->offset, &cursor->y, &cursor->type);
+}
+
+static int next_stitch_batch(const struct pec_decoder * const decoder,
+	struct stitch_cursor * const cursor,
+	struct stitch_batch * const batch, const int capacity)
+{
+	const uint8_t * const data = decoder->data;
+	int offset = cursor->offset, x = cursor->x, y = cursor->y;
+	int n = 0;
+
+	memset(batch->type, PEC_STITCH_NORMAL, capacity);
+
+	/*
+	 * A stitch is at most 4 bytes, so the remaining length is validated
+	 * once for as many stitches as are guaranteed to be available.
+	 */
+	for (int safe; !cursor->end && n < capacity &&
+	     0 <= offset && (safe = (decoder->size - offset) / 4) > 0; ) {
+		const int last = capacity - n < safe ? capacity : n + safe;
+
+		for (; n < last; n++) {
+			const uint8_t * const p = &data[offset];
+
+			/* Runs of 1-byte forms are by far the most common. */
+			if (((p[0] | p[1]) & 0x80) == 0) {
+				const int k = (int)stitch_kernel_delta_run(p,
+					last - n, &batch->x[n], &batch->y[n],
+					x, y);
+
+				x = batch->x[n + k - 1];
+				y = batch->y[n + k - 1];
+
+				offset += 2 * k;
+				n += k - 1;
+				continue;
+			}
+
+			if (p[0] >= 0xFE) {
+				if (p[0] == 0xFF) {
+					cursor->end = true;
+					break;
+				}
+
+				batch->x[n] = x;
+				batch->y[n] = y;
+				batch->type[n] = PEC_STITCH_STOP;
+				offset += 3; /* FIXME: Unknown data */
+				continue;
+			}
+
+			/*
+			 * Lengths follow directly from the most significant
+			 * bits, keeping table lookups off the offset chain.
+			 */
+			const int k = 1 + (p[0] >> 7);
+			const struct stitch_delta u = stitch_delta_table[p[0]];
+			const struct stitch_delta v = stitch_delta_table[p[k]];
+
+			x += u.delta + (p[1] & u.mask);
+			y += v.delta + (p[k + 1] & v.mask);
+			offset += k + 1 + (p[k] >> 7);
+
+			batch->x[n] = x;
+			batch->y[n] = y;
+			batch->type[n] = v.type != 0 ? v.type : u.type;
+		}
+	}
+
+	cursor->offset = offset;
+	cursor->x = x;
+	cursor->y = y;
+
+	/* Bounds are checked byte by byte for the last few stitches. */
+	for (; !cursor->end && n < capacity && next_stitch(decoder, cursor); n++) {
+		batch->x[n] = cursor->x;
+		batch->y[n] = cursor->y;
+		batch->type[n] = cursor->type;
+	}
+
+	return n;
+}
+
+static void count_stitches(struct pec_decoder * const decoder)
+{
+	struct stitch_cursor cursor = {
+		.offset = decoder->header.stitch_offset
+	};
+	struct stitch_batch batch;
+
+	for (int n; (n = next_stitch_batch(decoder,
+			&cursor, &batch, STITCH_BATCH)) > 0; )
+		for (int i = 0; i < n; i++) {
+			/* Threads are separated by stop stitches. */
+			const int thread_index =
+				decoder->stitch_counts.type_list[PEC_STITCH_STOP];
+
+			if (batch.type[i] != PEC_STITCH_STOP &&
+			    thread_index < PEC_MAX_THREADS)
+				decoder->stitch_counts.thread_list[thread_index]++;
+			decoder->stitch_counts.type_list[batch.type[i]]++;
+			decoder->stitch_counts.count++;
+		}
+}
+
+struct pec_decoder *pec_decoder_init_with_allocator(const void * const data,
+	const size_t size, const bool borrowed,
+	const struct libpes_allocator * const allocator)
 {
+	if (allocator == NULL)
+		return pec_decoder_init_with_allocator(data, size, borrowed,
+			allocator_global());
+	if (!allocator_valid(allocator))
+		return NULL;
+
 	if (size < 534 || INT_MAX/2 < size) /* PEC structure is at least 534 bytes. */
 		return NULL;
 
-	struct pec_decoder * const decoder = calloc(1, sizeof(*decoder) + size);
+	struct pec_decoder * const decoder = allocate_zero(allocator,
+		1, sizeof(*decoder) + (borrowed ? 0 : size));
 
 	if (decoder != NULL) {
-		decoder->data = (uint8_t *)&decoder[1];
+		decoder->allocator = *allocator;
 		decoder->size = (int)size;
-		memcpy(decoder->data, data, size);
+		if (borrowed)
+			decoder->data = data;
+		else
+			decoder->data = memcpy(&decoder[1], data, size);
 
-		if (!init_label(decoder)) {
+		if (!init_header(decoder)) {
 			pec_decoder_free(decoder);
 			return NULL;
 		}
+
+		count_stitches(decoder);
 	}
 
 	return decoder;
 }
 
+struct pec_decoder *pec_decoder_init(const void * const data, const size_t size)
+{
+	return pec_decoder_init_with_allocator(data, size, false,
+		allocator_global());
+}
+
+struct pec_decoder *pec_decoder_init_borrowed(const void * const data,
+	const size_t size)
+{
+	return pec_decoder_init_with_allocator(data, size, true,
+		allocator_global());
+}
+
 void pec_decoder_free(struct pec_decoder * const decoder)
 {
-	free(decoder);
+	if (decoder != NULL)
+		deallocate(&decoder->allocator, decoder);
 }
 
 const char *pec_label(const struct pec_decoder * const decoder)
 {
-	return decoder->label.s;
+	return decoder->header.label.s;
 }
 
 int pec_thread_count(const struct pec_decoder * const decoder)
 {
-	int raw;
-
-	return decode_u8(decoder, 48, &raw) ? raw + 1 : 0;
+	return decoder->header.thread_count;
 }
 
 const struct pec_thread pec_thread(const struct pec_decoder * const decoder,
 	const int thread_index)
 {
 	struct pec_thread thread = pec_undefined_thread();
-	const int palette_offset = 49 + thread_index;
-	int palette_index;
 
-	if (0 <= thread_index && thread_index < pec_thread_count(decoder) &&
-	       decode_u8(decoder, palette_offset, &palette_index)) {
-		thread = pec_palette_thread(palette_index);
+	if (0 <= thread_index && thread_index < decoder->header.thread_count) {
+		thread = pec_palette_thread(decoder->header.palette[thread_index]);
 		thread.index = thread_index;
 	}
 
@@ -182,87 +431,176 @@ const struct pec_thread pec_thread(const struct pec_decoder * const decoder,
 
 int pec_stitch_count(const struct pec_decoder * const decoder)
 {
-	int counter = 0;
+	return decoder->stitch_counts.count;
+}
 
-	pec_stitch_foreach(decoder, stitch_count, &counter);
+int pec_thread_stitch_count(const struct pec_decoder * const decoder,
+	const int thread_index)
+{
+	return 0 <= thread_index && thread_index < pec_thread_count(decoder) ?
+		decoder->stitch_counts.thread_list[thread_index] : 0;
+}
 
-	return counter;
+int pec_stitch_type_count(const struct pec_decoder * const decoder,
+	const enum pec_stitch_type stitch_type)
+{
+	return 0 <= stitch_type && stitch_type <= PEC_STITCH_STOP ?
+		decoder->stitch_counts.type_list[stitch_type] : 0;
 }
 
 bool pec_stitch_foreach(const struct pec_decoder * const decoder,
 	const pec_stitch_callback stitch_cb, void * const arg)
 {
-	int stitch_offset = 532;
-	int x = 0, y = 0;
+	struct stitch_cursor cursor = {
+		.offset = decoder->header.stitch_offset
+	};
+	struct stitch_batch batch;
+	int stitch_index = 0;
+
+	for (int n; (n = next_stitch_batch(decoder,
+			&cursor, &batch, STITCH_BATCH)) > 0; )
+		for (int i = 0; i < n; i++, stitch_index++)
+			if (!stitch_cb(stitch_index,
+				pec_physical_coordinate(batch.x[i]),
+				pec_physical_coordinate(batch.y[i]),
+				batch.type[i], arg))
+				return false;
 
-	for (int stitch_index = 0; ; stitch_index++) {
-		enum pec_stitch_type stitch_type = PEC_STITCH_NORMAL;
-		int cmd;
+	return cursor.end;
+}
 
-		if (!decode_u8(decoder, stitch_offset, &cmd))
+bool pec_stitch_foreach_batch(const struct pec_decoder * const decoder,
+	const pec_stitch_batch_callback batch_cb, void * const arg)
+{
+	struct stitch_cursor cursor = {
+		.offset = decoder->header.stitch_offset
+	};
+	struct stitch_batch batch;
+	float x[STITCH_BATCH], y[STITCH_BATCH];
+	int stitch_index = 0;
+
+	for (int n; (n = next_stitch_batch(decoder,
+			&cursor, &batch, STITCH_BATCH)) > 0; stitch_index += n) {
+		stitch_kernel_physical(batch.x, n, x);
+		stitch_kernel_physical(batch.y, n, y);
+
+		if (!batch_cb(stitch_index, x, y, batch.type, n, arg))
 			return false;
+	}
 
-		if (cmd == 0xFF) {
-			break;
-		} else if (cmd == 0xFE) {
-			if (!stitch_cb(stitch_index,
-				pec_physical_coordinate(x),
-				pec_physical_coordinate(y),
-			       	PEC_STITCH_STOP, arg))
+	return cursor.end;
+}
+
+bool pec_stitch_foreach_raw(const struct pec_decoder * const decoder,
+	const pec_stitch_raw_callback stitch_cb, void * const arg)
+{
+	struct stitch_cursor cursor = {
+		.offset = decoder->header.stitch_offset
+	};
+	struct stitch_batch batch;
+	int stitch_index = 0;
+
+	for (int n; (n = next_stitch_batch(decoder,
+			&cursor, &batch, STITCH_BATCH)) > 0; )
+		for (int i = 0; i < n; i++, stitch_index++)
+			if (!stitch_cb(stitch_index, batch.x[i], batch.y[i],
+				batch.type[i], arg))
 				return false;
-			stitch_offset += 3; /* FIXME: Unknown data */
-			continue;
-		}
 
-		if (!decode_stitch_coordinate(decoder,
-			&stitch_offset, &x, &stitch_type) ||
-		    !decode_stitch_coordinate(decoder,
-			&stitch_offset, &y, &stitch_type))
-			return false;
+	return cursor.end;
+}
 
-		if (!stitch_cb(stitch_index,
-			pec_physical_coordinate(x),
-			pec_physical_coordinate(y), stitch_type, arg))
-			return false;
+size_t pec_decode_stitches(const struct pec_decoder * const decoder,
+	float * const x, float * const y, uint8_t * const type,
+	uint16_t * const thread, const size_t capacity)
+{
+	struct stitch_cursor cursor = {
+		.offset = decoder->header.stitch_offset
+	};
+	struct stitch_batch batch;
+	int thread_index = 0;
+	size_t n = 0;
+
+	for (int count; n < capacity && (count = next_stitch_batch(decoder,
+			&cursor, &batch, capacity - n < STITCH_BATCH ?
+				(int)(capacity - n) : STITCH_BATCH)) > 0;
+	     n += count) {
+		if (x != NULL)
+			stitch_kernel_physical(batch.x, count, &x[n]);
+		if (y != NULL)
+			stitch_kernel_physical(batch.y, count, &y[n]);
+		if (type != NULL)
+			memcpy(&type[n], batch.type, count);
+
+		/* Threads are separated by stop stitches. */
+		if (thread != NULL)
+			for (int i = 0; i < count; i++) {
+				thread[n + i] = thread_index;
+				if (batch.type[i] == PEC_STITCH_STOP)
+					thread_index++;
+			}
 	}
 
-	return true;
+	return n == capacity || cursor.end ? n : 0;
 }
 
 int pec_thumbnail_width(const struct pec_decoder * const decoder)
 {
-	int width;
-
-	return decode_u8(decoder, 34, &width) ? 8 * width : 0;
+	return decoder->header.thumbnail_width;
 }
 
 int pec_thumbnail_height(const struct pec_decoder * const decoder)
 {
-	int height;
-
-	return decode_u8(decoder, 35, &height) ? height : 0;
+	return decoder->header.thumbnail_height;
 }
 
 bool pec_thumbnail_pixel(const struct pec_decoder * const decoder,
 	const int thumbnail_index, const int x, const int y)
 {
-	int thumbnail_offset, raw;
-
-	if (!decode_thumbnail_offset(decoder, &thumbnail_offset))
-		return false;
-
-	const int w = pec_thumbnail_width(decoder);
-       	const int h = pec_thumbnail_height(decoder);
+	const int w = decoder->header.thumbnail_width;
+	const int h = decoder->header.thumbnail_height;
 	const int image_offset = thumbnail_index * w * h / 8;
 	const int pixel_offset = (x + w * y) / 8;
+	int raw;
 
-	if (!decode_u8(decoder, thumbnail_offset +
+	if (!decode_u8(decoder, decoder->header.thumbnail_offset +
 		image_offset + pixel_offset, &raw))
 		return false;
 
 	return (raw & (1 << (x % 8))) != 0;
 }
 
+bool pec_thumbnail_bitmap(const struct pec_decoder * const decoder,
+	const int thumbnail_index, uint8_t * const bitmap, const size_t stride,
+	const enum pec_thumbnail_format format)
+{
+	if (thumbnail_index < 0 || pec_thread_count(decoder) < thumbnail_index)
+		return false;
+
+	const int w = decoder->header.thumbnail_width / 8;
+	const int h = decoder->header.thumbnail_height;
+	const int image_offset = decoder->header.thumbnail_offset +
+		thumbnail_index * w * h;
+
+	/* The whole thumbnail is bounds checked once. */
+	if (decoder->size < image_offset + w * h)
+		return false;
+
+	for (int y = 0; y < h; y++) {
+		const uint8_t * const row = &decoder->data[image_offset + w * y];
+		uint8_t * const dst = &bitmap[stride * y];
+
+		if (format == PEC_THUMBNAIL_1BPP)
+			memcpy(dst, row, w);
+		else
+			for (int x = 0; x < w; x++)
+				memcpy(&dst[8 * x],
+					thumbnail_pixels_table[row[x]], 8);
+	}
+
+	return true;
+}
+
 float pec_physical_coordinate(const int c)
 {
 	return 0.1f * (float)c;
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PESLIB_PEC_ENCODER_INTERNAL_H
+#define PESLIB_PEC_ENCODER_INTERNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "pec-encoder.h"
+#include "stitch-list.h"
+
+/*
+ * PEC encoder functions for the PES encoders, which store their stitches
+ * in the list of an embedded PEC encoder, or encode the PEC sections
+ * themselves as the PES stream encoder does.
+ */
+
+/*
+ * Largest size of PEC stitch data, including the end marker. The 24-bit
+ * thumbnail offset of the header is 20 bytes more than the size.
+ */
+#define PEC_STITCH_SIZE_MAX (0xFFFFFF - 20)
+
+/**
+ * Encode the 532 bytes of the PEC header that precede the stitch data.
+ *
+ * @param thread_count Number of threads, at least one.
+ * @param palette PEC palette indices of threads.
+ * @param bounds Bounds of stitches, including stop stitches [0.1 mm].
+ * @param stitch_size Size of stitch data, including the end marker.
+ * @param encode_cb Callback to invoke for encoded data.
+ * @param arg Optional argument pointer supplied to callback. Can be NULL.
+ * @return True if the header was successfully encoded, else false.
+ */
+bool pec_encode_header(const int thread_count, const int * const palette,
+	const struct stitch_bounds * const bounds, const int stitch_size,
+	const pec_encode_callback encode_cb, void * const arg);
+
+/**
+ * Encode PEC data without staging it in the buffer of the PEC encoder,
+ * for PES encoders that stage the PEC data along with the PES data.
+ *
+ * @param encoder PEC encoder object.
+ * @param encode_cb Callback to invoke for encoded data.
+ * @param arg Optional argument pointer supplied to callback. Can be NULL.
+ * @return True if the PEC data was successfully encoded, else false.
+ */
+bool pec_encode_sections(const struct pec_encoder * const encoder,
+	const pec_encode_callback encode_cb, void * const arg);
+
+/**
+ * Return the stitch list of a PEC encoder.
+ *
+ * @param encoder PEC encoder object.
+ * @return Stitch list of PEC encoder.
+ */
+struct stitch_list *pec_encoder_stitch_list(struct pec_encoder * const encoder);
+
+/**
+ * Append stitches of the same type to the current thread of a PEC encoder
+ * using raw PEC coordinates.
+ *
+ * @param encoder PEC encoder object.
+ * @param type Type of stitches.
+ * @param xy Interleaved raw X and Y coordinates of stitches [0.1 mm].
+ * @param n Number of stitches.
+ * @return True if all stitches were successfully appended, else false in
+ * which case none of them were appended.
+ */
+bool pec_encoder_append_raw(struct pec_encoder * const encoder,
+	const enum pec_stitch_type type, const int32_t * const xy,
+	const size_t n);
+
+#endif /* PESLIB_PEC_ENCODER_INTERNAL_H */
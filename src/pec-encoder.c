@@ -20,96 +20,56 @@
 #include <string.h>
 #include <math.h>
 
+#include "allocate.h"
+#include "encode-buffer.h"
+#include "encode-value.h"
 #include "pec-encoder.h"
-
-#define PEC_THUMBNAIL_WIDTH  48
-#define PEC_THUMBNAIL_HEIGHT 38
-
-struct pec_stitch {
-	float x;
-	float y;
-	enum pec_stitch_type type;
-};
-
-struct pec_thumbnail {
-	uint8_t image[PEC_THUMBNAIL_HEIGHT][PEC_THUMBNAIL_WIDTH / 8];
-};
-
-struct pec_bounds {
-	float min_x;
-	float min_y;
-	float max_x;
-	float max_y;
-	bool valid;
+#include "pec-encoder-internal.h"
+#include "pec-thumbnail.h"
+#include "stitch-list.h"
+
+struct pec_layout {
+	struct stitch_bounds bounds; /* Bounds including stop stitches. */
+	int stitch_size;     /* Size of stitch list, including end marker. */
+	int thumbnail_size;  /* Size of all thumbnails. */
+	int size;            /* Size of PEC data, or zero on failure. */
 };
 
 struct pec_encoder {
-	struct pec_bounds bounds;
-
-	int stitch_count;
-	int stitch_capacity;
-	struct pec_stitch *stitch_list;
+	struct libpes_allocator allocator;
+	struct stitch_list stitch_list;
 
 	int thread_count;
 	int palette[PEC_MAX_THREADS];
-};
-
-static bool encoded_size(const void * const data, const size_t size,
-	void * const arg)
-{
-	int * const s = arg;
-
-	*s += size;
-
-	return *s >= 0;
-}
-
-static bool encode_u8(const int value,
-	const pec_encode_callback encode_cb, void * const arg)
-{
-	const uint8_t data[] = { value & 0xFF };
-
-	return 0 <= value && value <= 0xFF &&
-		encode_cb(data, sizeof(data), arg);
-}
-
-static bool encode_u16lsb(const int value,
-	const pec_encode_callback encode_cb, void * const arg)
-{
-	const uint8_t data[] = {
-		(value >>  0) & 0xFF,
-		(value >>  8) & 0xFF
-	};
 
-	return 0 <= value && value <= 0xFFFF &&
-		encode_cb(data, sizeof(data), arg);
-}
+	size_t buffer_size;
+	uint8_t *buffer;
+};
 
-static bool encode_threads(const struct pec_encoder * const encoder,
+static bool encode_threads(const int thread_count, const int * const palette,
 	const pec_encode_callback encode_cb, void * const arg)
 {
-	if (encoder->thread_count < 1 || PEC_MAX_THREADS < encoder->thread_count)
+	if (thread_count < 1 || PEC_MAX_THREADS < thread_count)
 		return false;
 
 	if (!encode_cb("            ", 12, arg)) /* FIXME: Unknown data */
 		return false;
 
-	if (!encode_u8(encoder->thread_count - 1, encode_cb, arg))
+	if (!encode_u8(thread_count - 1, encode_cb, arg))
 		return false;
 
-	for (int i = 0; i < encoder->thread_count; i++)
-		if (!encode_u8(encoder->palette[i], encode_cb, arg))
+	for (int i = 0; i < thread_count; i++)
+		if (!encode_u8(palette[i], encode_cb, arg))
 			return false;
 
-	for (int i = encoder->thread_count; i < 463; i++)
+	for (int i = thread_count; i < 463; i++)
 		if (!encode_u8(0x20, encode_cb, arg))
 			return false;
 
 	return true;
 }
 
-static bool encode_label(const struct pec_encoder * const encoder,
-	const pec_encode_callback encode_cb, void * const arg)
+static bool encode_label(const pec_encode_callback encode_cb, void * const arg)
 {
 	const char label[32 + 1] = "LA:                \r            ";
 
@@ -117,22 +77,28 @@ static bool encode_label(const struct pec_encoder * const encoder,
 	       encode_u16lsb(0x00FF, encode_cb, arg); /* FIXME: Unknown data */
 }
 
-static bool encode_thumbnail_size(const struct pec_encoder * const encoder,
+static bool encode_thumbnail_size(
 	const pec_encode_callback encode_cb, void * const arg)
 {
 	return encode_u8(PEC_THUMBNAIL_WIDTH / 8, encode_cb, arg) &&
 	       encode_u8(PEC_THUMBNAIL_HEIGHT, encode_cb, arg);
 }
 
-static bool encode_size(const struct pec_encoder * const encoder,
+static int design_width(const struct stitch_bounds * const bounds)
+{
+	return !bounds->valid ? 0 : bounds->max_x - bounds->min_x;
+}
+
+static int design_height(const struct stitch_bounds * const bounds)
+{
+	return !bounds->valid ? 0 : bounds->max_y - bounds->min_y;
+}
+
+static bool encode_size(const struct stitch_bounds * const bounds,
 	const pec_encode_callback encode_cb, void * const arg)
 {
-	const int width  = !encoder->bounds.valid ? 0 :
-		pec_raw_coordinate(encoder->bounds.max_x) -
-		pec_raw_coordinate(encoder->bounds.min_x);
-	const int height = !encoder->bounds.valid ? 0 :
-		pec_raw_coordinate(encoder->bounds.max_y) -
-		pec_raw_coordinate(encoder->bounds.min_y);
+	const int width  = design_width(bounds);
+	const int height = design_height(bounds);
 
 	return encode_u16lsb( width, encode_cb, arg) &&
 	       encode_u16lsb(height, encode_cb, arg) &&
@@ -142,36 +108,83 @@ static bool encode_size(const struct pec_encoder * const encoder,
 	       encode_u16lsb(0x0000, encode_cb, arg);   /* FIXME: Unknown data */
 }
 
-static bool encode_stitch(const struct pec_encoder * const encoder,
-	const enum pec_stitch_type type, const int d,
+/* Stitch data is staged in chunks, to invoke the callback once per chunk. */
+struct stitch_chunk {
+	int size;
+	uint8_t data[256];
+};
+
+static bool flush_chunk(struct stitch_chunk * const chunk,
 	const pec_encode_callback encode_cb, void * const arg)
 {
-	if (d < -0x800 || 0x7FF < d)
-		return false;
+	const int size = chunk->size;
 
-	if (type == PEC_STITCH_NORMAL && -0x40 <= d && d <= 0x3F) {
-		if (!encode_u8(d & 0x7F, encode_cb, arg))
-			return false;
-	} else if (!encode_u8(((d >> 8) & 0xF) | 0x80 |
-			(type == PEC_STITCH_TRIM ? 0x20 :
-			 type == PEC_STITCH_JUMP ? 0x10 : 0x00),
-			encode_cb, arg) ||
-		   !encode_u8(d & 0xFF, encode_cb, arg))
+	chunk->size = 0;
+
+	return size == 0 || encode_cb(chunk->data, size, arg);
+}
+
+static bool reserve_chunk(struct stitch_chunk * const chunk, const int size,
+	const pec_encode_callback encode_cb, void * const arg)
+{
+	return chunk->size + size <= (int)sizeof(chunk->data) ||
+	       flush_chunk(chunk, encode_cb, arg);
+}
+
+static void encode_delta(struct stitch_chunk * const chunk,
+	const enum pec_stitch_type type, const int d, const int size)
+{
+	stitch_delta_encode(&chunk->data[chunk->size], type, d, size);
+	chunk->size += size;
+}
+
+static int stop_count(const struct pec_encoder * const encoder,
+	const int stitch_index)
+{
+	const struct stitch_list * const list = &encoder->stitch_list;
+
+	/* Stops follow stitches, so threads appended before them have none. */
+	if (stitch_index == 0)
+		return 0;
+
+	return (stitch_index < list->count ?
+		list->stitches[stitch_index].thread_index :
+		encoder->thread_count - 1) -
+		list->stitches[stitch_index - 1].thread_index;
+}
+
+static bool encode_stops(struct stitch_chunk * const chunk,
+	const int count, int * const stop,
+	const pec_encode_callback encode_cb, void * const arg)
+{
+	for (int i = 0; i < count; i++) {
+		if (!reserve_chunk(chunk, 3, encode_cb, arg))
 			return false;
+		stitch_stop_encode(&chunk->data[chunk->size], stop);
+		chunk->size += 3;
+	}
 
 	return true;
 }
 
 static bool encode_stitch_list(const struct pec_encoder * const encoder,
+	const struct pec_layout * const layout,
 	const pec_encode_callback encode_cb, void * const arg)
 {
-	int x = pec_raw_coordinate(encoder->bounds.min_x);
-	int y = pec_raw_coordinate(encoder->bounds.min_y);
-
-	for (int i = 0, stop = 2; i < encoder->stitch_count; i++) {
-		const enum pec_stitch_type type = encoder->stitch_list[i].type;
-		const int nx = pec_raw_coordinate(encoder->stitch_list[i].x);
-		const int ny = pec_raw_coordinate(encoder->stitch_list[i].y);
+	const struct stitch_list * const list = &encoder->stitch_list;
+	struct stitch_chunk chunk = { .size = 0 };
+	int x = layout->bounds.min_x;
+	int y = layout->bounds.min_y;
+	int stop = 2;
+
+	/* Delta sizes are cached, except for the first stitch. */
+	for (int i = 0; i < list->count; i++) {
+		const struct stitch * const stitch = &list->stitches[i];
+		const enum pec_stitch_type type = stitch->type;
+		const int sx = i == 0 ? stitch_delta_size(type, stitch->x - x) :
+			stitch->delta_size & 0x3;
+		const int sy = i == 0 ? stitch_delta_size(type, stitch->y - y) :
+			stitch->delta_size >> 2;
 
 		/*
 		 * FIXME: Move first (x,y) slightly if identical to (0,0)
@@ -179,244 +192,282 @@ static bool encode_stitch_list(const struct pec_encoder * const encoder,
 		 * This needs a corresponding fix in the transcoder.
 		 */
 
-		if (type == PEC_STITCH_STOP) {
-			if (!encode_u16lsb(0xB0FE, encode_cb, arg) ||
-			    !encode_u8(stop, encode_cb, arg))
-				return false;
-			stop = 3 - stop; /* FIXME: Why alternate between 2 and 1? */
-			continue;
-		}
-
-		if (!encode_stitch(encoder, type, nx - x, encode_cb, arg))
-			return false;
-		if (!encode_stitch(encoder, type, ny - y, encode_cb, arg))
+		if (sx == 0 || sy == 0 ||
+		    !encode_stops(&chunk, stop_count(encoder, i), &stop,
+				encode_cb, arg) ||
+		    !reserve_chunk(&chunk, sx + sy, encode_cb, arg))
 			return false;
 
-		x = nx;
-		y = ny;
+		encode_delta(&chunk, type, stitch->x - x, sx);
+		encode_delta(&chunk, type, stitch->y - y, sy);
+
+		x = stitch->x;
+		y = stitch->y;
 	}
 
-	/* End of stitch list. */
-	if (!encode_u8(0xFF, encode_cb, arg))
+	if (!encode_stops(&chunk, stop_count(encoder, list->count), &stop,
+		encode_cb, arg) || !reserve_chunk(&chunk, 1, encode_cb, arg))
 		return false;
 
-	return true;
+	/* End of stitch list. */
+	chunk.data[chunk.size++] = 0xFF;
+
+	return flush_chunk(&chunk, encode_cb, arg);
 }
 
-static bool encode_thumbnail_offset(const struct pec_encoder * const encoder,
+static bool encode_thumbnail_offset(const int stitch_size,
 	const pec_encode_callback encode_cb, void * const arg)
 {
-	int size = 20;
-
-	if (!encode_stitch_list(encoder, encoded_size, &size))
-		return 0;
-
-	return size <= 0xFFFF &&
+	return stitch_size <= PEC_STITCH_SIZE_MAX &&
 	       encode_u16lsb(0x0000, encode_cb, arg) &&
-	       encode_u16lsb(  size, encode_cb, arg) &&
-	       encode_u16lsb(0x3100, encode_cb, arg) &&
+	       encode_u24lsb(20 + stitch_size, encode_cb, arg) &&
+	       encode_u8(0x31, encode_cb, arg) &&
 	       encode_u16lsb(0xF0FF, encode_cb, arg);
 }
 
-static void thumbnail_plot(struct pec_thumbnail * const thumbnail,
-	const int c, const int r)
+static bool encode_thumbnail(struct pec_thumbnail * const thumbnail,
+	const struct thumbnail_transform * const t,
+	const struct stitch * const stitches, const int count,
+	const pec_encode_callback encode_cb, void * const arg)
 {
-	if (0 <= c && c < PEC_THUMBNAIL_WIDTH &&
-	    0 <= r && r < PEC_THUMBNAIL_HEIGHT)
-		thumbnail->image[r][c / 8] |= 1 << (c %8);
+	memset(thumbnail, 0, sizeof(*thumbnail));
+	thumbnail_stitch_list(thumbnail, t, stitches, count);
+	thumbnail_frame(thumbnail);
+
+	return encode_cb(thumbnail, sizeof(*thumbnail), arg);
 }
 
-static void thumbnail_framed_plot(struct pec_thumbnail * const thumbnail,
-	const float x, const float y, const struct pec_bounds * const bounds)
+static bool encode_thumbnail_list(const struct pec_encoder * const encoder,
+	const struct pec_layout * const layout,
+	const pec_encode_callback encode_cb, void * const arg)
 {
-	const int margin = 5;
-	const float w = bounds->max_x - bounds->min_x;
-	const float h = bounds->max_y - bounds->min_y;
-	const float cx = 0.5f * (bounds->min_x + bounds->max_x);
-	const float cy = 0.5f * (bounds->min_y + bounds->max_y);
-	const float tx = 0.5f * (PEC_THUMBNAIL_WIDTH  - 2 * margin);
-	const float ty = 0.5f * (PEC_THUMBNAIL_HEIGHT - 2 * margin);
+	const struct stitch_list * const list = &encoder->stitch_list;
+	const struct thumbnail_transform t = thumbnail_transform(&layout->bounds);
+	struct pec_thumbnail thumbnail;
 
-	if (0.0f < w || 0.0f < h) {
-		const float sw = 2.0f * tx / w;
-		const float sh = 2.0f * ty / h;
-		const float s = (sw < sh ? sw : sh);
-		const int c = margin + (int)roundf(tx + (x - cx) * s);
-		const int r = margin + (int)roundf(ty + (y - cy) * s);
+	/* The main thumbnail has all stitches. */
+	if (!encode_thumbnail(&thumbnail, &t, list->stitches, list->count,
+		encode_cb, arg))
+		return false;
 
-		thumbnail_plot(thumbnail, c, r);
-	}
-}
+	/*
+	 * Thread thumbnails follow in order of stops, beginning with the
+	 * thread of the first stitch. The stitches of each thread are
+	 * contiguous since thread indices are nondecreasing.
+	 */
+	int thread_index = list->count == 0 ? 0 : list->stitches[0].thread_index;
 
-static void thumbnail_framed_line(struct pec_thumbnail * const thumbnail,
-	const struct pec_stitch * const a, const struct pec_stitch * const b,
-	const struct pec_bounds * const bounds)
-{
-	if (a->type != PEC_STITCH_NORMAL ||
-	    b->type != PEC_STITCH_NORMAL)
-		return;
+	for (int i = 0, k = 0; i < encoder->thread_count; i++, thread_index++) {
+		const int first = k;
 
-	for (int i = 0; i <= 100; i++) {
-		const float t = i / 100.0f;
+		while (k < list->count &&
+		       list->stitches[k].thread_index == thread_index)
+			k++;
 
-		thumbnail_framed_plot(thumbnail,
-			(1.0f - t) * a->x + t * b->x,
-			(1.0f - t) * a->y + t * b->y, bounds);
+		if (!encode_thumbnail(&thumbnail, &t, &list->stitches[first],
+			k - first, encode_cb, arg))
+			return false;
 	}
+
+	return true;
 }
 
-static void thumbnail_frame(struct pec_thumbnail * const thumbnail)
+static struct stitch_bounds stitch_bounds(
+	const struct pec_encoder * const encoder)
 {
-	for (int c = 4; c < PEC_THUMBNAIL_WIDTH - 4; c++) {
-		thumbnail_plot(thumbnail, c, 1);
-		thumbnail_plot(thumbnail, c, PEC_THUMBNAIL_HEIGHT - 2);
-	}
+	const struct stitch_list * const list = &encoder->stitch_list;
+	struct stitch_bounds bounds = list->bounds;
 
-	for (int r = 4; r < PEC_THUMBNAIL_HEIGHT - 4; r++) {
-		thumbnail_plot(thumbnail, 1, r);
-		thumbnail_plot(thumbnail, PEC_THUMBNAIL_WIDTH - 2, r);
-	}
+	/* Stop stitches are at the origin, which is included in the bounds. */
+	if (0 < list->count &&
+	    list->stitches[0].thread_index < encoder->thread_count - 1)
+		stitch_bounds_update(&bounds, 0, 0);
 
-	thumbnail_plot(thumbnail, 3, 2);
-	thumbnail_plot(thumbnail, 2, 3);
-	thumbnail_plot(thumbnail, PEC_THUMBNAIL_WIDTH - 4, 2);
-	thumbnail_plot(thumbnail, PEC_THUMBNAIL_WIDTH - 3, 3);
-	thumbnail_plot(thumbnail, 2, PEC_THUMBNAIL_HEIGHT - 4);
-	thumbnail_plot(thumbnail, 3, PEC_THUMBNAIL_HEIGHT - 3);
-	thumbnail_plot(thumbnail, PEC_THUMBNAIL_WIDTH - 3, PEC_THUMBNAIL_HEIGHT - 4);
-	thumbnail_plot(thumbnail, PEC_THUMBNAIL_WIDTH - 4, PEC_THUMBNAIL_HEIGHT - 3);
+	return bounds;
 }
 
-static bool encode_thumbnail(const struct pec_encoder * const encoder,
-	struct pec_thumbnail * const thumbnail,
-	const pec_encode_callback encode_cb, void * const arg)
+static bool append_stitch(struct pec_encoder * const encoder,
+	const enum pec_stitch_type stitch_type, const float x, const float y)
 {
-	thumbnail_frame(thumbnail);
+	if (encoder->thread_count == 0)
+		return false;
 
-	for (int r = 0; r < PEC_THUMBNAIL_HEIGHT; r++)
-	for (int c = 0; c < PEC_THUMBNAIL_WIDTH / 8; c++)
-		if (!encode_u8(thumbnail->image[r][c], encode_cb, arg))
-			return false;
+	if (!stitch_list_append(&encoder->stitch_list,
+		encoder->thread_count - 1, stitch_type, x, y))
+		return false;
 
 	return true;
 }
 
-static bool encode_thumbnail_list(const struct pec_encoder * const encoder,
-	const pec_encode_callback encode_cb, void * const arg)
+static bool stitch_list_size(const struct pec_encoder * const encoder,
+	const struct stitch_bounds * const bounds, int * const size)
 {
-	struct pec_thumbnail thumbnail = { 0 };
-
-	for (int k = 1; k < encoder->stitch_count; k++)
-		thumbnail_framed_line(&thumbnail, &encoder->stitch_list[k - 1],
-			&encoder->stitch_list[k], &encoder->bounds);
+	const struct stitch_list * const list = &encoder->stitch_list;
 
-	if (!encode_thumbnail(encoder, &thumbnail, encode_cb, arg))
+	/* End of stitch list. */
+	*size = 1;
+
+	if (list->count == 0)
+		return true;
+
+	/*
+	 * Deltas following the first stitch are maintained as stitches are
+	 * appended. The first is relative to the bounds. Stops of 3 bytes
+	 * each follow every thread of the first stitch and onwards.
+	 */
+	const struct stitch * const first = &list->stitches[0];
+	const int sx = stitch_delta_size(first->type,
+		first->x - bounds->min_x);
+	const int sy = stitch_delta_size(first->type,
+		first->y - bounds->min_y);
+	const int stops = encoder->thread_count - 1 - first->thread_index;
+
+	if (sx == 0 || sy == 0 || list->delta_overflow)
 		return false;
 
-	for (int i = 0, k = 1; i < encoder->thread_count; i++, k++) {
-		memset(&thumbnail, 0, sizeof(thumbnail));
-
-		for (; k < encoder->stitch_count &&
-			encoder->stitch_list[k].type != PEC_STITCH_STOP; k++)
-			thumbnail_framed_line(&thumbnail, &encoder->stitch_list[k - 1],
-				&encoder->stitch_list[k], &encoder->bounds);
-
-		if (!encode_thumbnail(encoder, &thumbnail, encode_cb, arg))
-			return false;
-	}
+	*size += sx + sy + 3 * stops + list->delta_size;
 
 	return true;
 }
 
-static void update_bounds(struct pec_encoder * const encoder,
-	const float x, const float y)
+static bool valid_header(const int thread_count, const int * const palette,
+	const struct stitch_bounds * const bounds)
 {
-	if (!encoder->bounds.valid) {
-		encoder->bounds.min_x = x;
-		encoder->bounds.min_y = y;
-		encoder->bounds.max_x = x;
-		encoder->bounds.max_y = y;
-		encoder->bounds.valid = true;
-	} else {
-		if (x < encoder->bounds.min_x)
-			encoder->bounds.min_x = x;
-		if (y < encoder->bounds.min_y)
-			encoder->bounds.min_y = y;
-		if (x > encoder->bounds.max_x)
-			encoder->bounds.max_x = x;
-		if (y > encoder->bounds.max_y)
-			encoder->bounds.max_y = y;
-	}
+	if (thread_count < 1 || PEC_MAX_THREADS < thread_count)
+		return false;
+
+	for (int i = 0; i < thread_count; i++)
+		if (palette[i] < 0 || 0xFF < palette[i])
+			return false;
+
+	return design_width(bounds) <= 0xFFFF &&
+	       design_height(bounds) <= 0xFFFF;
 }
 
-static bool append_stitch(struct pec_encoder * const encoder,
-	const enum pec_stitch_type stitch_type, const float x, const float y)
+static struct pec_layout layout(const struct pec_encoder * const encoder)
 {
-	if (encoder->thread_count == 0)
-		return false;
-
-	if (encoder->stitch_capacity <= encoder->stitch_count) {
-		const int capacity = encoder->stitch_capacity +
-			(encoder->stitch_capacity == 0    ?   100 :
-			 10000 < encoder->stitch_capacity ? 10000 :
-			 encoder->stitch_capacity);
-
-		if (capacity < INT_MAX/2) {
-			struct pec_stitch * const stitch_list =
-				realloc(encoder->stitch_list,
-					(size_t)capacity * sizeof(*stitch_list));
-
-			if (stitch_list != NULL) {
-				encoder->stitch_list = stitch_list;
-				encoder->stitch_capacity = capacity;
-			}
-		}
-	}
+	/*
+	 * The layout is computed for each encode, in constant time apart from
+	 * checking the palette, since stitch bounds and delta sizes are
+	 * maintained as stitches are appended.
+	 */
+	struct pec_layout layout = {
+		.bounds = stitch_bounds(encoder),
+		.thumbnail_size = (encoder->thread_count + 1) *
+			PEC_THUMBNAIL_HEIGHT * (PEC_THUMBNAIL_WIDTH / 8)
+	};
 
-	if (encoder->stitch_capacity <= encoder->stitch_count)
-		return false;
+	if (valid_header(encoder->thread_count, encoder->palette,
+		&layout.bounds) &&
+	    stitch_list_size(encoder, &layout.bounds, &layout.stitch_size) &&
+	    layout.stitch_size <= PEC_STITCH_SIZE_MAX)
+		layout.size = 532 + layout.stitch_size + layout.thumbnail_size;
 
-	encoder->stitch_list[encoder->stitch_count] =
-		(struct pec_stitch){ .x = x, .y = y, .type = stitch_type };
-	update_bounds(encoder, x, y);
-	encoder->stitch_count++;
+	return layout;
+}
 
-	return true;
+static bool encode_sections(const struct pec_encoder * const encoder,
+	const struct pec_layout * const layout,
+	const pec_encode_callback encode_cb, void * const arg)
+{
+	return layout->size != 0 &&
+	       pec_encode_header(encoder->thread_count, encoder->palette,
+		       &layout->bounds, layout->stitch_size, encode_cb, arg) &&
+	       encode_stitch_list(encoder, layout, encode_cb, arg) &&
+	       encode_thumbnail_list(encoder, layout, encode_cb, arg);
 }
 
 struct pec_encoder *pec_encoder_init()
 {
-	return calloc(1, sizeof(struct pec_encoder));
+	return pec_encoder_init_with_allocator(allocator_global());
+}
+
+struct pec_encoder *pec_encoder_init_with_allocator(
+	const struct libpes_allocator * const allocator)
+{
+	if (allocator == NULL)
+		return pec_encoder_init_with_allocator(allocator_global());
+	if (!allocator_valid(allocator))
+		return NULL;
+
+	struct pec_encoder * const encoder =
+		allocate_zero(allocator, 1, sizeof(*encoder));
+
+	if (encoder != NULL) {
+		encoder->allocator = *allocator;
+		encoder->stitch_list.allocator = &encoder->allocator;
+		pec_encoder_buffer_size(encoder, ENCODE_BUFFER_SIZE);
+	}
+
+	return encoder;
 }
 
 void pec_encoder_free(struct pec_encoder * const encoder)
 {
 	if (encoder != NULL) {
-		free(encoder->stitch_list);
-		free(encoder);
+		stitch_list_free(&encoder->stitch_list);
+		deallocate(&encoder->allocator, encoder->buffer);
+		deallocate(&encoder->allocator, encoder);
 	}
 }
 
+void pec_encoder_reset(struct pec_encoder * const encoder)
+{
+	stitch_list_clear(&encoder->stitch_list);
+	encoder->thread_count = 0;
+}
+
 bool pec_encode(const struct pec_encoder * const encoder,
 	const pec_encode_callback encode_cb, void * const arg)
 {
-	return encode_label(encoder, encode_cb, arg) &&
-	       encode_thumbnail_size(encoder, encode_cb, arg) &&
-	       encode_threads(encoder, encode_cb, arg) &&
-	       encode_thumbnail_offset(encoder, encode_cb, arg) &&
-	       encode_size(encoder, encode_cb, arg) &&
-	       encode_stitch_list(encoder, encode_cb, arg) &&
-	       encode_thumbnail_list(encoder, encode_cb, arg);
+	const struct pec_layout pec_layout = layout(encoder);
+	struct encode_buffer buffer;
+
+	if (pec_layout.size == 0)
+		return false;
+
+	encode_buffer_init_staging(&buffer,
+		encoder->buffer, encoder->buffer_size, encode_cb, arg);
+
+	return encode_buffer_flush(&buffer, encode_sections(encoder,
+		&pec_layout, encode_buffer_write, &buffer));
 }
 
-size_t pec_encoded_size(const struct pec_encoder * const encoder)
+bool pec_encode_into(const struct pec_encoder * const encoder,
+	void * const dst, const size_t capacity, size_t * const written)
 {
-	int size = 0;
+	const struct pec_layout pec_layout = layout(encoder);
+	const size_t size = (size_t)pec_layout.size;
+	struct encode_buffer buffer;
 
-	if (!pec_encode(encoder, encoded_size, &size))
-		return 0;
+	if (written != NULL)
+		*written = size;
+	if (size == 0 || capacity < size)
+		return false;
+
+	encode_buffer_init_memory(&buffer, dst, capacity);
 
-	return (size_t)size;
+	return encode_sections(encoder, &pec_layout,
+		encode_buffer_write, &buffer);
+}
+
+void pec_encoder_buffer_size(struct pec_encoder * const encoder,
+	const size_t size)
+{
+	deallocate(&encoder->allocator, encoder->buffer);
+	encoder->buffer = size != 0 ? allocate(&encoder->allocator, size) : NULL;
+	encoder->buffer_size = encoder->buffer != NULL ? size : 0;
+}
+
+size_t pec_encoded_size(const struct pec_encoder * const encoder)
+{
+	return (size_t)layout(encoder).size;
+}
+
+bool pec_encoder_reserve(struct pec_encoder * const encoder,
+	const size_t stitch_count)
+{
+	return stitch_list_reserve(&encoder->stitch_list, stitch_count);
 }
 
 bool pec_append_stitch(struct pec_encoder * const encoder,
@@ -425,6 +476,17 @@ bool pec_append_stitch(struct pec_encoder * const encoder,
 	return append_stitch(encoder, PEC_STITCH_NORMAL, x, y);
 }
 
+bool pec_append_stitches(struct pec_encoder * const encoder,
+	const float * const xy, const size_t n)
+{
+	if (encoder->thread_count == 0 ||
+	    !stitch_list_append_xy(&encoder->stitch_list,
+		encoder->thread_count - 1, PEC_STITCH_NORMAL, xy, n))
+		return false;
+
+	return true;
+}
+
 bool pec_append_jump_stitch(struct pec_encoder * const encoder,
 	const float x, const float y)
 {
@@ -443,10 +505,47 @@ bool pec_append_thread(struct pec_encoder * const encoder,
 	if (PEC_MAX_THREADS <= encoder->thread_count)
 		return false;
 
+	/* Stop stitches are implied by thread index changes. */
 	encoder->palette[encoder->thread_count++] = palette_index;
 
-	return encoder->stitch_count == 0 ? true :
-		append_stitch(encoder, PEC_STITCH_STOP, 0.0f, 0.0f);
+	return true;
+}
+
+bool pec_encode_header(const int thread_count, const int * const palette,
+	const struct stitch_bounds * const bounds, const int stitch_size,
+	const pec_encode_callback encode_cb, void * const arg)
+{
+	return valid_header(thread_count, palette, bounds) &&
+	       encode_label(encode_cb, arg) &&
+	       encode_thumbnail_size(encode_cb, arg) &&
+	       encode_threads(thread_count, palette, encode_cb, arg) &&
+	       encode_thumbnail_offset(stitch_size, encode_cb, arg) &&
+	       encode_size(bounds, encode_cb, arg);
+}
+
+bool pec_encode_sections(const struct pec_encoder * const encoder,
+	const pec_encode_callback encode_cb, void * const arg)
+{
+	const struct pec_layout pec_layout = layout(encoder);
+
+	return encode_sections(encoder, &pec_layout, encode_cb, arg);
+}
+
+struct stitch_list *pec_encoder_stitch_list(struct pec_encoder * const encoder)
+{
+	return &encoder->stitch_list;
+}
+
+bool pec_encoder_append_raw(struct pec_encoder * const encoder,
+	const enum pec_stitch_type type, const int32_t * const xy,
+	const size_t n)
+{
+	if (encoder->thread_count == 0 ||
+	    !stitch_list_append_raw(&encoder->stitch_list,
+		encoder->thread_count - 1, type, xy, n))
+		return false;
+
+	return true;
 }
 
 int pec_raw_coordinate(const float c)
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+
+#include "pec-thumbnail.h"
+
+static void thumbnail_plot(struct pec_thumbnail * const thumbnail,
+	const int c, const int r)
+{
+	if (0 <= c && c < PEC_THUMBNAIL_WIDTH &&
+	    0 <= r && r < PEC_THUMBNAIL_HEIGHT)
+		thumbnail->image[r][c / 8] |= 1 << (c %8);
+}
+
+struct thumbnail_transform thumbnail_transform(
+	const struct stitch_bounds * const bounds)
+{
+	const int margin = 5;
+	const int tw = PEC_THUMBNAIL_WIDTH  - 2 * margin;
+	const int th = PEC_THUMBNAIL_HEIGHT - 2 * margin;
+	const int w = bounds->max_x - bounds->min_x;
+	const int h = bounds->max_y - bounds->min_y;
+
+	if (!bounds->valid || (w == 0 && h == 0))
+		return (struct thumbnail_transform){ .den = 0 };
+
+	/* The scale is the smallest of tw/w and th/h, keeping the aspect. */
+	const bool fit_width = h == 0 || (w != 0 && tw * h <= th * w);
+
+	return (struct thumbnail_transform){
+		.margin = margin,
+		.tw = tw,
+		.th = th,
+		.num = fit_width ? tw : th,
+		.den = fit_width ? w : h,
+		.cx = bounds->min_x + bounds->max_x,
+		.cy = bounds->min_y + bounds->max_y
+	};
+}
+
+static void thumbnail_pixel(const struct thumbnail_transform * const t,
+	const struct stitch * const stitch, int * const c, int * const r)
+{
+	/*
+	 * Centre of frame plus scaled offset from centre of bounds, rounded.
+	 * The numerators are nonnegative within the bounds.
+	 */
+	const int nc = t->tw * t->den + (2 * stitch->x - t->cx) * t->num;
+	const int nr = t->th * t->den + (2 * stitch->y - t->cy) * t->num;
+
+	*c = t->margin + (nc + t->den) / (2 * t->den);
+	*r = t->margin + (nr + t->den) / (2 * t->den);
+}
+
+static void thumbnail_line(struct pec_thumbnail * const thumbnail,
+	int c0, int r0, const int c1, const int r1)
+{
+	const int dc =  abs(c1 - c0);
+	const int dr = -abs(r1 - r0);
+	const int sc = c0 < c1 ? 1 : -1;
+	const int sr = r0 < r1 ? 1 : -1;
+
+	/* Eight-connected Bresenham line, plotting each pixel once. */
+	for (int e = dc + dr; ; ) {
+		const int e2 = 2 * e;
+
+		thumbnail_plot(thumbnail, c0, r0);
+
+		if (c0 == c1 && r0 == r1)
+			break;
+
+		if (e2 >= dr) {
+			e += dr;
+			c0 += sc;
+		}
+		if (e2 <= dc) {
+			e += dc;
+			r0 += sr;
+		}
+	}
+}
+
+void thumbnail_frame(struct pec_thumbnail * const thumbnail)
+{
+	for (int c = 4; c < PEC_THUMBNAIL_WIDTH - 4; c++) {
+		thumbnail_plot(thumbnail, c, 1);
+		thumbnail_plot(thumbnail, c, PEC_THUMBNAIL_HEIGHT - 2);
+	}
+
+	for (int r = 4; r < PEC_THUMBNAIL_HEIGHT - 4; r++) {
+		thumbnail_plot(thumbnail, 1, r);
+		thumbnail_plot(thumbnail, PEC_THUMBNAIL_WIDTH - 2, r);
+	}
+
+	thumbnail_plot(thumbnail, 3, 2);
+	thumbnail_plot(thumbnail, 2, 3);
+	thumbnail_plot(thumbnail, PEC_THUMBNAIL_WIDTH - 4, 2);
+	thumbnail_plot(thumbnail, PEC_THUMBNAIL_WIDTH - 3, 3);
+	thumbnail_plot(thumbnail, 2, PEC_THUMBNAIL_HEIGHT - 4);
+	thumbnail_plot(thumbnail, 3, PEC_THUMBNAIL_HEIGHT - 3);
+	thumbnail_plot(thumbnail, PEC_THUMBNAIL_WIDTH - 3, PEC_THUMBNAIL_HEIGHT - 4);
+	thumbnail_plot(thumbnail, PEC_THUMBNAIL_WIDTH - 4, PEC_THUMBNAIL_HEIGHT - 3);
+}
+
+void thumbnail_stitch_list(struct pec_thumbnail * const thumbnail,
+	const struct thumbnail_transform * const t,
+	const struct stitch * const stitches, const int count)
+{
+	int c0, r0;
+
+	if (t->den == 0 || count == 0)
+		return;
+
+	thumbnail_pixel(t, &stitches[0], &c0, &r0);
+
+	for (int k = 1; k < count; k++) {
+		const struct stitch * const a = &stitches[k - 1];
+		const struct stitch * const b = &stitches[k];
+		int c1, r1;
+
+		thumbnail_pixel(t, b, &c1, &r1);
+
+		/* Lines are not sewn across stops, jumps and trims. */
+		if (a->type == PEC_STITCH_NORMAL &&
+		    b->type == PEC_STITCH_NORMAL &&
+		    a->thread_index == b->thread_index)
+			thumbnail_line(thumbnail, c0, r0, c1, r1);
+
+		c0 = c1;
+		r0 = r1;
+	}
+}
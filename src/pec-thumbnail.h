@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PESLIB_PEC_THUMBNAIL_H
+#define PESLIB_PEC_THUMBNAIL_H
+
+#include <stdint.h>
+
+#include "stitch-list.h"
+
+#define PEC_THUMBNAIL_WIDTH  48
+#define PEC_THUMBNAIL_HEIGHT 38
+
+/** PEC thumbnail bitmap of 1 bit per pixel, least significant bit first. */
+struct pec_thumbnail {
+	uint8_t image[PEC_THUMBNAIL_HEIGHT][PEC_THUMBNAIL_WIDTH / 8];
+};
+
+/** Integer transform of raw PEC coordinates to thumbnail pixels. */
+struct thumbnail_transform {
+	int margin;  /* Margin of frame [pixel]. */
+	int tw;      /* Width of frame [pixel]. */
+	int th;      /* Height of frame [pixel]. */
+	int num;     /* Numerator of scale [pixel]. */
+	int den;     /* Denominator of scale [0.1 mm], or zero if empty. */
+	int cx;      /* Twice the X centre of bounds [0.1 mm]. */
+	int cy;      /* Twice the Y centre of bounds [0.1 mm]. */
+};
+
+/**
+ * Compute the transform that fits bounds into the frame of thumbnails,
+ * keeping the aspect ratio.
+ *
+ * @param bounds Bounds of stitches [0.1 mm].
+ * @return Thumbnail transform, with zero denominator if bounds are empty.
+ */
+struct thumbnail_transform thumbnail_transform(
+	const struct stitch_bounds * const bounds);
+
+/**
+ * Draw lines of sewn stitches into a thumbnail. Lines are not drawn across
+ * stops, jumps and trims.
+ *
+ * @param thumbnail Thumbnail to draw the lines into.
+ * @param t Thumbnail transform.
+ * @param stitches Stitches to draw.
+ * @param count Number of stitches.
+ */
+void thumbnail_stitch_list(struct pec_thumbnail * const thumbnail,
+	const struct thumbnail_transform * const t,
+	const struct stitch * const stitches, const int count);
+
+/**
+ * Draw the frame of a thumbnail.
+ *
+ * @param thumbnail Thumbnail to draw the frame into.
+ */
+void thumbnail_frame(struct pec_thumbnail * const thumbnail);
+
+#endif /* PESLIB_PEC_THUMBNAIL_H */
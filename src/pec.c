@@ -15,7 +15,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "pec.h"
 
@@ -109,18 +113,439 @@ struct pec_thread pec_palette_thread(const int palette_index)
 	       palette_thread_list[palette_index - 1] : pec_undefined_thread();
 }
 
-int pec_palette_index_by_rgb(const struct pec_rgb rgb)
+/*
+ * Nearest palette colors are looked up in a table of 32x32x32 cells of
+ * 8x8x8 RGB colors each. A cell holds the palette indices that can be
+ * nearest to any of its colors, such that a lookup compares at most four
+ * candidates exactly. A candidate can be nearest only if its minimum
+ * distance to the cell is at most the smallest maximum distance of all
+ * palette colors to the cell.
+ */
+#define PALETTE_CELL_BITS 3
+#define PALETTE_CELL_COUNT (256 >> PALETTE_CELL_BITS)
+#define PALETTE_CELL_CANDIDATES 4
+#define PALETTE_CELL_MANY 7
+
+/* Palette index 0 is the undefined thread. */
+static struct pec_rgb palette_rgb(const int palette_index)
 {
-	int palette_index = 0;
+	return palette_index == 0 ? pec_undefined_thread().rgb :
+		palette_thread_list[palette_index - 1].rgb;
+}
+
+static int axis_min2(const int lo, const int hi, const int c)
+{
+	const int d = c < lo ? lo - c : hi < c ? c - hi : 0;
+
+	return d * d;
+}
+
+static int axis_max2(const int lo, const int hi, const int c)
+{
+	const int d = c - lo > hi - c ? c - lo : hi - c;
+
+	return d * d;
+}
+
+static uint32_t palette_cell(const int r, const int g, const int b)
+{
+	const int size = 1 << PALETTE_CELL_BITS;
+	const struct pec_rgb lo = {
+		r << PALETTE_CELL_BITS,
+		g << PALETTE_CELL_BITS,
+		b << PALETTE_CELL_BITS
+	};
+	const struct pec_rgb hi = {
+		lo.r + size - 1,
+		lo.g + size - 1,
+		lo.b + size - 1
+	};
+	int min2[PEC_PALETTE_COUNT];
+	int bound = -1;
+	uint32_t cell = 0;
+	int count = 0;
+
+	for (int i = 0; i < PEC_PALETTE_COUNT; i++) {
+		const struct pec_rgb c = palette_rgb(i);
+		const int max2 = axis_max2(lo.r, hi.r, c.r) +
+		                 axis_max2(lo.g, hi.g, c.g) +
+		                 axis_max2(lo.b, hi.b, c.b);
 
+		min2[i] = axis_min2(lo.r, hi.r, c.r) +
+		          axis_min2(lo.g, hi.g, c.g) +
+		          axis_min2(lo.b, hi.b, c.b);
+
+		if (bound < 0 || max2 < bound)
+			bound = max2;
+	}
+
+	/* Candidates are kept in index order, to break ties as the scan. */
 	for (int i = 0; i < PEC_PALETTE_COUNT; i++)
-		if (rgb_norm2(rgb, pec_palette_thread(i).rgb) <
-		    rgb_norm2(rgb, pec_palette_thread(palette_index).rgb))
-		    palette_index = i;
+		if (min2[i] <= bound) {
+			if (count == PALETTE_CELL_CANDIDATES)
+				return PALETTE_CELL_MANY;
+			cell |= (uint32_t)i << (3 + 6 * count++);
+		}
+
+	return cell | count;
+}
+
+/*
+ * FIXME: Nearest colors are searched from index 0, the undefined thread,
+ * up to but excluding the palette size, so the last palette thread is
+ * never chosen.
+ */
+static int palette_index_by_scan(const struct pec_rgb rgb)
+{
+	int palette_index = 0;
+	int norm2 = rgb_norm2(rgb, palette_rgb(0));
+
+	for (int i = 1; i < PEC_PALETTE_COUNT; i++) {
+		const int d = rgb_norm2(rgb, palette_rgb(i));
+
+		if (d < norm2) {
+			palette_index = i;
+			norm2 = d;
+		}
+	}
 
 	return palette_index;
 }
 
+int pec_palette_index_by_rgb(const struct pec_rgb rgb)
+{
+	/*
+	 * Cells are computed on first use. A cell is self-contained and
+	 * racing threads store the same value, so relaxed atomics suffice.
+	 */
+	static _Atomic uint32_t cells[PALETTE_CELL_COUNT]
+		[PALETTE_CELL_COUNT][PALETTE_CELL_COUNT];
+
+	if (rgb.r < 0 || 255 < rgb.r ||
+	    rgb.g < 0 || 255 < rgb.g ||
+	    rgb.b < 0 || 255 < rgb.b)
+		return palette_index_by_scan(rgb);
+
+	_Atomic uint32_t * const c = &cells[rgb.r >> PALETTE_CELL_BITS]
+		[rgb.g >> PALETTE_CELL_BITS][rgb.b >> PALETTE_CELL_BITS];
+	uint32_t cell = atomic_load_explicit(c, memory_order_relaxed);
+
+	if (cell == 0) {
+		cell = palette_cell(rgb.r >> PALETTE_CELL_BITS,
+			rgb.g >> PALETTE_CELL_BITS, rgb.b >> PALETTE_CELL_BITS);
+		atomic_store_explicit(c, cell, memory_order_relaxed);
+	}
+
+	const int count = cell & 7;
+
+	if (count == PALETTE_CELL_MANY)
+		return palette_index_by_scan(rgb);
+
+	int palette_index = (cell >> 3) & 0x3F;
+	int norm2 = rgb_norm2(rgb, palette_rgb(palette_index));
+
+	for (int k = 1; k < count; k++) {
+		const int i = (cell >> (3 + 6 * k)) & 0x3F;
+		const int d = rgb_norm2(rgb, palette_rgb(i));
+
+		if (d < norm2) {
+			palette_index = i;
+			norm2 = d;
+		}
+	}
+
+	return palette_index;
+}
+
+void pec_palette_indices_by_rgb(const struct pec_rgb * const rgb,
+	int * const palette_index, const size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		palette_index[i] = pec_palette_index_by_rgb(rgb[i]);
+}
+
+/*
+ * Perceptual matching uses the CIEDE2000 color difference of CIELAB colors.
+ * Nearest palette threads are looked up in a table of 64x64x64 cells of
+ * 4x4x4 RGB colors each. A cell holds the palette indices whose difference
+ * to the centre of the cell is at most the smallest difference plus twice
+ * the radius of the cell, such that a lookup compares at most four
+ * candidates exactly. This relies on the triangle inequality, which
+ * CIEDE2000 does not satisfy strictly, but the lookup agrees with a full
+ * scan for all 24-bit RGB colors.
+ */
+#define PERCEPTUAL_CELL_BITS 2
+#define PERCEPTUAL_CELL_COUNT (256 >> PERCEPTUAL_CELL_BITS)
+#define PERCEPTUAL_CELL_CANDIDATES 4
+#define PERCEPTUAL_CELL_MANY 7
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+struct lab {
+	double l;
+	double a;
+	double b;
+};
+
+/* CIELAB colors of the palette threads, as computed by rgb_lab(). */
+static const struct lab palette_lab_list[] = {
+	{ 18.250611810287438, 50.095983939545619, -68.429816871975333 },
+	{ 51.883334405009492, 26.047939746934922, -75.507780230221869 },
+	{ 53.371184296681832, -50.026436820578475, 28.342110997899329 },
+	{ 78.455156319835751, 12.859021339096611, -32.326716587382734 },
+	{ 49.300224892378466, 75.534310209611931, 63.378589174122602 },
+	{ 69.48271150757698, 21.913888023701865, 44.060793292446341 },
+	{ 52.303709223644688, 62.498093506668575, -26.234605150579249 },
+	{ 85.638480343475536, 29.021793293617705, -18.729071587751058 },
+	{ 66.737189623770135, 44.535662714173085, -23.266036911976904 },
+	{ 77.008952494054355, -46.163714807960943, 27.110958152076847 },
+	{ 73.09108948052608, 12.102427980696939, 58.025015977163228 },
+	{ 80.768393086279843, 12.823324087669729, 67.917084069294248 },
+	{ 90.714671321280306, -9.43366393432804, 89.823506883397059 },
+	{ 77.76365175532051, -59.993290065979863, 75.982659293149084 },
+	{ 69.538494080679399, -3.1705756205896996, 54.947453077504186 },
+	{ 70.833576917905717, -0.88792013039612483, 12.340738778727477 },
+	{ 65.782880211442389, 3.1355551662494707, 35.936099850335125 },
+	{ 95.202686511893489, -10.705511713930083, 42.506797103768299 },
+	{ 53.585015771669404, -9.9978464396244249e-06, 3.9991385758497699e-06 },
+	{ 0, 0, 0 },
+	{ 29.803472000856914, 64.92037054911448, -93.857848137943776 },
+	{ 50.865553481176264, 83.599537493683044, -35.839925134751404 },
+	{ 41.554045224644327, -8.2692588332378136e-06, 3.3077035332951255e-06 },
+	{ 25.012354779114759, 28.654065450934489, 30.443131384971593 },
+	{ 54.145135720382328, 82.544183289821106, 22.333703244369829 },
+	{ 59.015365151095764, 15.077090038595198, 64.743774663178115 },
+	{ 69.941462036923781, 34.479911599854475, 29.13900039327002 },
+	{ 62.657786267738899, 54.154580071223421, 70.675726052090695 },
+	{ 94.796249522799911, -1.5919000284636553e-05, 6.3676001360590817e-06 },
+	{ 50.653113082311563, 74.394634591280152, -48.604043100883707 },
+	{ 75.362978189301586, -11.610072935038184, 16.466671673507214 },
+	{ 73.560355604414326, -14.530723814304814, -30.035866280648026 },
+	{ 79.83612565999691, 13.013576297991102, 81.813402139577903 },
+	{ 93.738843991859397, -10.74962433320742, 64.224710124640552 },
+	{ 83.636892916088371, 4.4724165384863461, 82.560653825395576 },
+	{ 65.563631393573587, 37.617188257958567, 72.108038639043301 },
+	{ 61.052363984674813, -55.665691763182259, 55.086121938933751 },
+	{ 28.283132732398748, -4.1790180902654681, -18.563245930324122 },
+	{ 67.687309162169186, -3.0698176823685253, 8.8110469411299963 },
+	{ 77.956195341280036, 1.2296530193305344, 14.533540562488945 },
+	{ 65.933671278062192, -24.624137706783177, 67.609359690945496 },
+	{ 91.809269763439531, 5.2212788025282064, 17.688651861288829 },
+	{ 75.42197360136781, 46.22429779088305, -15.242209266316964 },
+	{ 40.567219935639663, -46.797883913456602, 44.352714768988598 },
+	{ 86.084476919415735, 19.806300276640542, -18.727705121503703 },
+	{ 65.007462226556328, 34.894679470358234, -32.332878164861192 },
+	{ 86.953335955639673, -0.98728090396871249, 19.993137243415539 },
+	{ 51.110686673790653, 79.290125110166969, -5.5775709956846775 },
+	{ 55.410589269297034, 36.686477107026604, 51.67635139181904 },
+	{ 49.730016142536712, -41.333557675992147, 48.821062414769564 },
+	{ 49.388683431041272, 76.901975906531746, -18.663941763033677 },
+	{ 75.396323731176267, 22.922154815544548, 78.799248259941933 },
+	{ 95.601538654565871, -21.456414284500681, -6.9722221345756674 },
+	{ 49.949919010776483, -48.453228703126904, 42.371456415814556 },
+	{ 45.341524940956447, 78.007311110869608, -57.283960232924635 },
+	{ 60.558161922033392, -63.604453831422603, 61.387891567808254 },
+	{ 78.820496054002632, 38.437383766037229, -12.87706982352903 },
+	{ 86.355659850549941, -1.2042107846430006, 85.230200086638078 },
+	{ 59.395521240537576, -7.2896499984566603, -45.700283212370692 },
+	{ 97.812174635261925, -16.200570855056107, 58.213914776420125 },
+	{ 87.813596318066132, -24.692056743982338, 52.831849513562346 },
+	{ 83.701026041405285, 8.9508732026125077, 56.476782134798832 },
+	{ 85.373372276783101, 19.513993170307163, 7.5050084048180699 },
+	{ 85.373372276783101, 19.513993170307163, 7.5050084048180699 },
+};
+
+static double radians(const double degrees)
+{
+	return degrees * (M_PI / 180.0);
+}
+
+static double srgb_linear(const double c)
+{
+	const double v = c / 255.0;
+
+	return v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+}
+
+static double lab_f(const double t)
+{
+	return t > 216.0 / 24389.0 ? cbrt(t) :
+		(24389.0 / 27.0 * t + 16.0) / 116.0;
+}
+
+static struct lab rgb_lab(const double r, const double g, const double b)
+{
+	/* Linear sRGB to CIEXYZ, normalised to the D65 white point. */
+	const double lr = srgb_linear(r);
+	const double lg = srgb_linear(g);
+	const double lb = srgb_linear(b);
+	const double x = (0.4124564*lr + 0.3575761*lg + 0.1804375*lb) / 0.95047;
+	const double y = (0.2126729*lr + 0.7151522*lg + 0.0721750*lb);
+	const double z = (0.0193339*lr + 0.1191920*lg + 0.9503041*lb) / 1.08883;
+
+	return (struct lab) {
+		116.0 * lab_f(y) - 16.0,
+		500.0 * (lab_f(x) - lab_f(y)),
+		200.0 * (lab_f(y) - lab_f(z))
+	};
+}
+
+static double hue(const double b, const double a)
+{
+	const double h = a == 0.0 && b == 0.0 ? 0.0 :
+		atan2(b, a) * (180.0 / M_PI);
+
+	return h < 0.0 ? h + 360.0 : h;
+}
+
+static double delta_e2000(const struct lab u, const struct lab v)
+{
+	const double c7 = pow((hypot(u.a, u.b) + hypot(v.a, v.b)) / 2.0, 7.0);
+	const double g = 0.5 * (1.0 - sqrt(c7 / (c7 + pow(25.0, 7.0))));
+	const double ua = (1.0 + g) * u.a;
+	const double va = (1.0 + g) * v.a;
+	const double uc = hypot(ua, u.b);
+	const double vc = hypot(va, v.b);
+	const double uh = hue(u.b, ua);
+	const double vh = hue(v.b, va);
+	const bool chromatic = uc * vc != 0.0;
+
+	double dh = vh - uh;
+	if (!chromatic)
+		dh = 0.0;
+	else if (dh > 180.0)
+		dh -= 360.0;
+	else if (dh < -180.0)
+		dh += 360.0;
+
+	double hm = uh + vh;
+	if (chromatic) {
+		if (fabs(uh - vh) > 180.0)
+			hm += hm < 360.0 ? 360.0 : -360.0;
+		hm /= 2.0;
+	}
+
+	const double dl = v.l - u.l;
+	const double dc = vc - uc;
+	const double dhh = 2.0 * sqrt(uc * vc) * sin(radians(dh) / 2.0);
+	const double lm2 = pow((u.l + v.l) / 2.0 - 50.0, 2.0);
+	const double cm = (uc + vc) / 2.0;
+	const double cm7 = pow(cm, 7.0);
+	const double t = 1.0 -
+		0.17 * cos(radians(hm - 30.0)) +
+		0.24 * cos(radians(2.0 * hm)) +
+		0.32 * cos(radians(3.0 * hm + 6.0)) -
+		0.20 * cos(radians(4.0 * hm - 63.0));
+	const double theta = 30.0 * exp(-pow((hm - 275.0) / 25.0, 2.0));
+	const double rc = 2.0 * sqrt(cm7 / (cm7 + pow(25.0, 7.0)));
+	const double sl = 1.0 + 0.015 * lm2 / sqrt(20.0 + lm2);
+	const double sc = 1.0 + 0.045 * cm;
+	const double sh = 1.0 + 0.015 * cm * t;
+	const double rt = -sin(radians(2.0 * theta)) * rc;
+
+	return sqrt((dl / sl) * (dl / sl) +
+		(dc / sc) * (dc / sc) +
+		(dhh / sh) * (dhh / sh) +
+		rt * (dc / sc) * (dhh / sh));
+}
+
+static uint32_t perceptual_cell(const int r, const int g, const int b)
+{
+	const int size = 1 << PERCEPTUAL_CELL_BITS;
+	const double centre = (size - 1) / 2.0;
+	const struct lab u = rgb_lab(
+		(r << PERCEPTUAL_CELL_BITS) + centre,
+		(g << PERCEPTUAL_CELL_BITS) + centre,
+		(b << PERCEPTUAL_CELL_BITS) + centre);
+	double delta[COUNT_OF(palette_lab_list)];
+	double nearest = INFINITY;
+	double radius = 0.0;
+	uint32_t cell = 0;
+	int count = 0;
+
+	/* The radius is the largest difference to a corner of the cell. */
+	for (int k = 0; k < 8; k++) {
+		const double d = delta_e2000(u, rgb_lab(
+			(r << PERCEPTUAL_CELL_BITS) + (k & 1 ? size - 1 : 0),
+			(g << PERCEPTUAL_CELL_BITS) + (k & 2 ? size - 1 : 0),
+			(b << PERCEPTUAL_CELL_BITS) + (k & 4 ? size - 1 : 0)));
+
+		if (radius < d)
+			radius = d;
+	}
+
+	for (size_t i = 0; i < COUNT_OF(palette_lab_list); i++) {
+		delta[i] = delta_e2000(u, palette_lab_list[i]);
+
+		if (delta[i] < nearest)
+			nearest = delta[i];
+	}
+
+	/* Candidates are kept in index order, to break ties as the scan. */
+	for (size_t i = 0; i < COUNT_OF(palette_lab_list); i++)
+		if (delta[i] <= nearest + 2.0 * radius) {
+			if (count == PERCEPTUAL_CELL_CANDIDATES)
+				return PERCEPTUAL_CELL_MANY;
+			cell |= (uint32_t)i << (3 + 6 * count++);
+		}
+
+	return cell | count;
+}
+
+static int perceptual_component(const int c)
+{
+	return c < 0 ? 0 : 255 < c ? 255 : c;
+}
+
+int pec_palette_index_by_rgb_perceptual(const struct pec_rgb rgb)
+{
+	/*
+	 * Cells are computed on first use. A cell is self-contained and
+	 * racing threads store the same value, so relaxed atomics suffice.
+	 */
+	static _Atomic uint32_t cells[PERCEPTUAL_CELL_COUNT]
+		[PERCEPTUAL_CELL_COUNT][PERCEPTUAL_CELL_COUNT];
+	const int r = perceptual_component(rgb.r);
+	const int g = perceptual_component(rgb.g);
+	const int b = perceptual_component(rgb.b);
+	_Atomic uint32_t * const c = &cells[r >> PERCEPTUAL_CELL_BITS]
+		[g >> PERCEPTUAL_CELL_BITS][b >> PERCEPTUAL_CELL_BITS];
+	uint32_t cell = atomic_load_explicit(c, memory_order_relaxed);
+
+	if (cell == 0) {
+		cell = perceptual_cell(r >> PERCEPTUAL_CELL_BITS,
+			g >> PERCEPTUAL_CELL_BITS, b >> PERCEPTUAL_CELL_BITS);
+		atomic_store_explicit(c, cell, memory_order_relaxed);
+	}
+
+	/* Palette index 0 is the undefined thread, excluded from the table. */
+	const int count = cell & 7;
+
+	if (count == 1)
+		return 1 + ((cell >> 3) & 0x3F);
+
+	const struct lab u = rgb_lab(r, g, b);
+	const int n = count == PERCEPTUAL_CELL_MANY ?
+		(int)COUNT_OF(palette_lab_list) : count;
+	double delta = INFINITY;
+	int palette_index = 0;
+
+	for (int k = 0; k < n; k++) {
+		const int i = count == PERCEPTUAL_CELL_MANY ? k :
+			(cell >> (3 + 6 * k)) & 0x3F;
+		const double d = delta_e2000(u, palette_lab_list[i]);
+
+		if (d < delta) {
+			palette_index = i;
+			delta = d;
+		}
+	}
+
+	return 1 + palette_index;
+}
+
 const struct pec_thread pec_undefined_thread()
 {
 	return (struct pec_thread)
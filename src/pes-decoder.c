@@ -22,9 +22,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "allocate.h"
 #include "pec-decoder.h"
 #include "pes-decoder.h"
 #include "pes.h"
+#include "stitch-kernel.h"
 
 struct pes_string {
 	int length;
@@ -38,14 +40,18 @@ struct pes_thread {
 	struct pes_string id, code, name, type;
 };
 
-struct pes_change {
-	int block_index;  /* Block index of thread change. */
-	int thread_index; /* Thread index to change for. */
+struct pes_block {
+	int offset;       /* Offset of first stitch coordinate. */
+	int stitch_index; /* Index of first stitch among all stitches. */
+	int stitch_count; /* Number of stitches within the block. */
+	int stitch_type;  /* Type of stitch. */
+	int thread_index; /* Thread index, or -1 if undefined. */
 };
 
 struct pes_decoder {
+	struct libpes_allocator allocator;
 	int size;
-	uint8_t *data;
+	const uint8_t *data;
 
 	char version[5];
 
@@ -58,17 +64,23 @@ struct pes_decoder {
 
 	struct pes_string name;
 
+	bool pes_threads;
 	int thread_count;
 	struct pes_thread *thread_list;
 
-	int change_count;
-	struct pes_change *change_list;
+	int block_count;
+	int block_capacity;
+	struct pes_block *block_list;
+
+	struct {
+		int *thread_list;
+		int type_list[PEC_STITCH_STOP + 1];
+	} stitch_counts;
 
 	struct pec_decoder *pec;
-};
 
-typedef bool (*pes_thread_callback)(const int change_index,
-	const int block_index, const int index, void * const arg);
+	stitch_kernel kernel;
+};
 
 static bool decode_u8(const struct pes_decoder * const decoder,
 	const int offset, int * const value)
@@ -168,172 +180,252 @@ static bool string_equal(const struct pes_decoder * const decoder,
 	       strncmp((const char *)&decoder->data[offset + 2], s, length) == 0;
 }
 
-static bool thread_foreach(const struct pes_decoder * const decoder,
-	int offset, const pes_thread_callback thread_cb, void * const arg)
+static struct pec_thread block_thread(const struct pes_decoder * const decoder,
+	const struct pes_block * const block)
 {
-	int thread_count;
+	return block->thread_index < 0 ? pec_undefined_thread() :
+		decoder->thread_list[block->thread_index].thread;
+}
 
-	if (!decode_u16lsb(decoder, offset, &thread_count))
-		return false;
-	offset += 2;
+static int decode_block_stitches(const struct pes_decoder * const decoder,
+	const struct pes_block * const block, const int stitch_index,
+	const int count, float * const x, float * const y)
+{
+	const int n = block->stitch_count - stitch_index < count ?
+		block->stitch_count - stitch_index : count;
 
-	for (int i = 0; i < thread_count; i++) {
-		int block_index, index;
+	/* Stitches are validated to be within data by init_blocks(). */
+	stitch_kernel_decode(decoder->kernel,
+		&decoder->data[block->offset + 4 * stitch_index], n, x, y);
 
-		if (!decode_u16lsb(decoder, offset + 0, &block_index) ||
-		    !decode_u16lsb(decoder, offset + 2, &index))
-			return false;
-		offset += 4;
+	return n;
+}
 
-		if (!thread_cb(i, block_index, index, arg))
-			return false;
+static bool block_stitches(const struct pes_decoder * const decoder,
+	const struct pes_block * const block,
+	const pes_stitch_callback stitch_cb, void * const arg)
+{
+	float x[256], y[256];
+
+	for (int i = 0; i < block->stitch_count; ) {
+		const int n = decode_block_stitches(decoder, block, i, 256, x, y);
+
+		for (int k = 0; k < n; k++, i++)
+			if (!stitch_cb(i, x[k], y[k], arg))
+				return false;
 	}
 
-	return offset <= decoder->pec_offset;
+	return true;
 }
 
-static bool stitch_foreach(const struct pes_decoder * const decoder,
-	const pes_block_callback block_cb, const pes_stitch_callback stitch_cb,
-	const pes_thread_callback thread_cb, void * const arg)
+static bool block_stitches_raw(const struct pes_decoder * const decoder,
+	const struct pes_block * const block,
+	const pes_stitch_raw_callback stitch_cb, void * const arg)
 {
-	struct pec_thread thread = pec_undefined_thread();
-	int offset = decoder->csewseg_offset + 9;
-	int change_index = 0;
+	const uint8_t * const data = &decoder->data[block->offset];
 
-	for (int block_index = 0; offset < decoder->pec_offset; block_index++) {
-		int stitch_type, block_id, stitch_count;
+	/* Stitches are validated to be within data by init_blocks(). */
+	for (int i = 0; i < block->stitch_count; i++) {
+		const int16_t x = (int16_t)((data[4*i + 0] << 0) |
+		                            (data[4*i + 1] << 8));
+		const int16_t y = (int16_t)((data[4*i + 2] << 0) |
+		                            (data[4*i + 3] << 8));
 
-		if (!decode_u16lsb(decoder, offset + 0, &stitch_type) ||
-		    !decode_u16lsb(decoder, offset + 2, &block_id) ||
-		    !decode_u16lsb(decoder, offset + 4, &stitch_count))
+		if (!stitch_cb(i, x, y, arg))
 			return false;
-		offset += 6;
+	}
 
-		/* Update thread by block index if necessary. */
-		if (change_index < decoder->change_count && block_index ==
-			decoder->change_list[change_index].block_index)
-			thread = decoder->thread_list[decoder->
-				change_list[change_index++].thread_index].thread;
+	return true;
+}
+
+static bool stitch_foreach(const struct pes_decoder * const decoder,
+	const pes_block_callback block_cb, const pes_stitch_callback stitch_cb,
+	const pes_stitch_raw_callback stitch_raw_cb, void * const arg)
+{
+	for (int block_index = 0; block_index < decoder->block_count; block_index++) {
+		const struct pes_block * const block =
+			&decoder->block_list[block_index];
 
 		if (block_cb != NULL)
-			if (!block_cb(thread, stitch_count, stitch_type, arg))
+			if (!block_cb(block_thread(decoder, block),
+				block->stitch_count, block->stitch_type, arg))
 				return false;
 
-		for (int i = 0; i < stitch_count; i++) {
-			int x, y;
-
-			if (!decode_i16lsb(decoder, offset + 0, &x) ||
-			    !decode_i16lsb(decoder, offset + 2, &y))
+		if (stitch_cb != NULL)
+			if (!block_stitches(decoder, block, stitch_cb, arg))
 				return false;
-			offset += 4;
-
-			if (stitch_cb != NULL) {
-				if (!stitch_cb(i,
-					pec_physical_coordinate(x),
-				       	pec_physical_coordinate(y), arg))
-					return false;
-			}
-		}
 
-		int code;
-		if (!decode_u16lsb(decoder, offset, &code))
-			return false;
-		if (code != 0x8003)
-			break;
-		offset += 2;
+		if (stitch_raw_cb != NULL)
+			if (!block_stitches_raw(decoder,
+				block, stitch_raw_cb, arg))
+				return false;
 	}
 
-	return thread_cb == NULL ||
-		thread_foreach(decoder, offset, thread_cb, arg);
+	return true;
 }
 
-static bool stitch_count(const int stitch_index,
-	const float x, const float y, void * const arg)
+static bool count_stitches(struct pes_decoder * const decoder)
 {
-	int * const counter = (int *)arg;
+	decoder->stitch_counts.thread_list = allocate_zero(&decoder->allocator,
+		(size_t)(decoder->thread_count + 1), sizeof(int));
+	if (decoder->stitch_counts.thread_list == NULL)
+		return false;
 
-	(*counter)++;
+	for (int i = 0; i < decoder->block_count; i++) {
+		const struct pes_block * const block = &decoder->block_list[i];
+
+		if (0 <= block->thread_index)
+			decoder->stitch_counts.thread_list[block->thread_index] +=
+				block->stitch_count;
+		if (0 <= block->stitch_type && block->stitch_type <= PEC_STITCH_STOP)
+			decoder->stitch_counts.type_list[block->stitch_type] +=
+				block->stitch_count;
+	}
 
 	return true;
 }
 
-static bool change_count_cb(const int change_index, const int block_index,
-	const int palette_index, void * const arg)
+static bool append_block(struct pes_decoder * const decoder,
+	const struct pes_block block)
 {
-	int * const change_count = arg;
+	if (decoder->block_capacity <= decoder->block_count) {
+		const int capacity = decoder->block_capacity +
+			(decoder->block_capacity == 0 ? 100 :
+			 decoder->block_capacity);
 
-	(*change_count)++;
+		if (capacity < INT_MAX/2) {
+			struct pes_block * const block_list =
+				reallocate(&decoder->allocator, decoder->block_list,
+					(size_t)capacity * sizeof(*block_list));
 
-	return true;
-}
+			if (block_list != NULL) {
+				decoder->block_list = block_list;
+				decoder->block_capacity = capacity;
+			}
+		}
+	}
 
-static bool change_thread_cb(const int change_index, const int block_index,
-	const int thread_index, void * const arg)
-{
-	struct pes_decoder * const decoder = arg;
-	struct pes_change * const change = &decoder->change_list[change_index];
+	if (decoder->block_capacity <= decoder->block_count)
+		return false;
 
-	change->block_index = block_index;
-	change->thread_index = thread_index;
+	decoder->block_list[decoder->block_count++] = block;
 
-	return change->thread_index < decoder->thread_count;
+	return true;
 }
 
-static bool palette_thread_cb(const int change_index, const int block_index,
-	const int palette_index, void * const arg)
+static bool init_blocks(struct pes_decoder * const decoder, int * const offset)
 {
-	struct pes_decoder * const decoder = arg;
-	struct pes_thread * const thread = &decoder->thread_list[change_index];
+	int stitch_index = 0;
 
-	thread->thread = pec_palette_thread(palette_index);
-	thread->thread.index = change_index;
+	*offset = decoder->csewseg_offset + 9;
 
-	return change_thread_cb(change_index, block_index, change_index, arg);
-}
+	while (*offset < decoder->pec_offset) {
+		struct pes_block block = { .thread_index = -1 };
+		int block_id;
 
-static bool init_palette(struct pes_decoder * const decoder)
-{
-	int change_count = 0;
+		if (!decode_u16lsb(decoder, *offset + 0, &block.stitch_type) ||
+		    !decode_u16lsb(decoder, *offset + 2, &block_id) ||
+		    !decode_u16lsb(decoder, *offset + 4, &block.stitch_count))
+			return false;
+		*offset += 6;
 
-	if (!stitch_foreach(decoder, NULL, NULL, change_count_cb, &change_count))
-		return false;
+		/* All stitch coordinates of the block must be within data. */
+		block.offset = *offset;
+		*offset += 4 * block.stitch_count;
+		if (decoder->size < *offset)
+			return false;
 
-	decoder->thread_list =
-		calloc(1, (size_t)change_count * sizeof(*decoder->thread_list));
-	if (decoder->thread_list == NULL)
-		return false;
-	decoder->thread_count = change_count;
+		block.stitch_index = stitch_index;
+		stitch_index += block.stitch_count;
 
-	decoder->change_list =
-		calloc(1, (size_t)change_count * sizeof(*decoder->change_list));
-	if (decoder->change_list == NULL)
-		return false;
-	decoder->change_count = change_count;
+		if (!append_block(decoder, block))
+			return false;
 
-	if (!stitch_foreach(decoder, NULL, NULL, palette_thread_cb, decoder))
-		return false;
+		int code;
+		if (!decode_u16lsb(decoder, *offset, &code))
+			return false;
+		if (code != 0x8003)
+			break;
+		*offset += 2;
+	}
 
 	return true;
 }
 
-static bool init_change(struct pes_decoder * const decoder)
+static void assign_block_threads(struct pes_decoder * const decoder,
+	const int first_block_index, const int last_block_index,
+	const int thread_index)
 {
-	int change_count = 0;
+	for (int i = first_block_index; i < last_block_index &&
+		i < decoder->block_count; i++)
+		decoder->block_list[i].thread_index = thread_index;
+}
 
-	if (!stitch_foreach(decoder, NULL, NULL, change_count_cb, &change_count))
-		return false;
+static bool init_changes(struct pes_decoder * const decoder, int offset)
+{
+	int change_count;
 
-	decoder->change_list =
-		calloc(1, (size_t)change_count * sizeof(*decoder->change_list));
-	if (decoder->change_list == NULL)
+	if (!decode_u16lsb(decoder, offset, &change_count))
 		return false;
+	offset += 2;
 
-	if (!stitch_foreach(decoder, NULL, NULL, change_thread_cb, decoder))
-		return false;
+	/*
+	 * Without PES threads, each change refers to a PEC palette index
+	 * and implies a new thread.
+	 */
+	const bool palette = !decoder->pes_threads;
 
-	decoder->change_count = change_count;
+	if (palette) {
+		decoder->thread_list = allocate_zero(&decoder->allocator,
+			(size_t)change_count, sizeof(*decoder->thread_list));
+		if (decoder->thread_list == NULL && change_count != 0)
+			return false;
+		decoder->thread_count = change_count;
+	}
 
-	return true;
+	/*
+	 * Changes apply in order to blocks with strictly increasing indices.
+	 * A change for a block that has already been passed halts further
+	 * changes.
+	 */
+	int block_index = 0, thread_index = -1;
+	bool halted = false;
+
+	for (int i = 0; i < change_count; i++) {
+		int change_block_index, index;
+
+		if (!decode_u16lsb(decoder, offset + 0, &change_block_index) ||
+		    !decode_u16lsb(decoder, offset + 2, &index))
+			return false;
+		offset += 4;
+
+		if (palette) {
+			struct pes_thread * const thread =
+				&decoder->thread_list[i];
+
+			thread->thread = pec_palette_thread(index);
+			thread->thread.index = i;
+			index = i;
+		} else if (decoder->thread_count <= index)
+			return false;
+
+		if (halted || change_block_index < block_index ||
+		    decoder->block_count <= change_block_index) {
+			halted = true;
+			continue;
+		}
+
+		assign_block_threads(decoder, block_index,
+			change_block_index, thread_index);
+		decoder->block_list[change_block_index].thread_index = index;
+		block_index = change_block_index + 1;
+		thread_index = index;
+	}
+
+	assign_block_threads(decoder, block_index,
+		decoder->block_count, thread_index);
+
+	return offset <= decoder->pec_offset;
 }
 
 static bool init_threads(struct pes_decoder * const decoder, int * const offset)
@@ -342,10 +434,11 @@ static bool init_threads(struct pes_decoder * const decoder, int * const offset)
 		return false;
 	*offset += 2;
 
-	decoder->thread_list = calloc(1, (size_t)decoder->thread_count *
-		sizeof(*decoder->thread_list));
-	if (decoder->thread_list == NULL)
+	decoder->thread_list = allocate_zero(&decoder->allocator,
+		(size_t)decoder->thread_count, sizeof(*decoder->thread_list));
+	if (decoder->thread_list == NULL && decoder->thread_count != 0)
 		return false;
+	decoder->pes_threads = true;
 
 	for (int i = 0; i < decoder->thread_count; i++) {
 		static const char * const thread_type[] =
@@ -491,23 +584,38 @@ static bool init_pec(struct pes_decoder * const decoder)
 	    decoder->size < decoder->pec_offset)
 		return false;
 
-	decoder->pec = pec_decoder_init(&decoder->data[decoder->pec_offset],
-		decoder->size - decoder->pec_offset);
+	/* The PEC decoder borrows its section of the PES data. */
+	decoder->pec = pec_decoder_init_with_allocator(
+		&decoder->data[decoder->pec_offset],
+		decoder->size - decoder->pec_offset, true, &decoder->allocator);
 
 	return decoder->pec != NULL;
 }
 
-struct pes_decoder *pes_decoder_init(const void * const data, const size_t size)
+struct pes_decoder *pes_decoder_init_with_allocator(const void * const data,
+	const size_t size, const bool borrowed,
+	const struct libpes_allocator * const allocator)
 {
+	if (allocator == NULL)
+		return pes_decoder_init_with_allocator(data, size, borrowed,
+			allocator_global());
+	if (!allocator_valid(allocator))
+		return NULL;
+
 	if (INT_MAX/2 < size)
 		return NULL;
 
-	struct pes_decoder * const decoder = calloc(1, sizeof(*decoder) + size);
+	struct pes_decoder * const decoder = allocate_zero(allocator,
+		1, sizeof(*decoder) + (borrowed ? 0 : size));
 
 	if (decoder != NULL) {
-		decoder->data = (uint8_t *)&decoder[1];
+		decoder->allocator = *allocator;
+		decoder->kernel = stitch_kernel_select();
 		decoder->size = (int)size;
-		memcpy(decoder->data, data, size);
+		if (borrowed)
+			decoder->data = data;
+		else
+			decoder->data = memcpy(&decoder[1], data, size);
 
 		if (!init_pec(decoder)) {
 			pes_decoder_free(decoder);
@@ -536,23 +644,39 @@ struct pes_decoder *pes_decoder_init(const void * const data, const size_t size)
 			return false;
 		}
 
-		if (decoder->thread_list == NULL) {
-			if (!init_palette(decoder))
-				return false;
-		} else if (!init_change(decoder))
-			return false;
+		int offset;
+		if (!init_blocks(decoder, &offset) ||
+		    !init_changes(decoder, offset) ||
+		    !count_stitches(decoder)) {
+			pes_decoder_free(decoder);
+			return NULL;
+		}
 	}
 
 	return decoder;
 }
 
+struct pes_decoder *pes_decoder_init(const void * const data, const size_t size)
+{
+	return pes_decoder_init_with_allocator(data, size, false,
+		allocator_global());
+}
+
+struct pes_decoder *pes_decoder_init_borrowed(const void * const data,
+	const size_t size)
+{
+	return pes_decoder_init_with_allocator(data, size, true,
+		allocator_global());
+}
+
 void pes_decoder_free(struct pes_decoder * const decoder)
 {
 	if (decoder != NULL) {
 		pec_decoder_free(decoder->pec);
-		free(decoder->thread_list);
-		free(decoder->change_list);
-		free(decoder);
+		deallocate(&decoder->allocator, decoder->thread_list);
+		deallocate(&decoder->allocator, decoder->block_list);
+		deallocate(&decoder->allocator, decoder->stitch_counts.thread_list);
+		deallocate(&decoder->allocator, decoder);
 	}
 }
 
@@ -581,12 +705,27 @@ const struct pec_thread pes_thread(const struct pes_decoder * const decoder,
 
 int pes_stitch_count(const struct pes_decoder * const decoder)
 {
-	int counter = 0;
-
-	if (!stitch_foreach(decoder, NULL, stitch_count, NULL, &counter))
+	if (decoder->block_count == 0)
 		return 0;
 
-	return counter;
+	const struct pes_block * const last =
+		&decoder->block_list[decoder->block_count - 1];
+
+	return last->stitch_index + last->stitch_count;
+}
+
+int pes_thread_stitch_count(const struct pes_decoder * const decoder,
+	const int thread_index)
+{
+	return 0 <= thread_index && thread_index < decoder->thread_count ?
+		decoder->stitch_counts.thread_list[thread_index] : 0;
+}
+
+int pes_stitch_type_count(const struct pes_decoder * const decoder,
+	const enum pec_stitch_type stitch_type)
+{
+	return 0 <= stitch_type && stitch_type <= PEC_STITCH_STOP ?
+		decoder->stitch_counts.type_list[stitch_type] : 0;
 }
 
 void pes_bounds1(const struct pes_decoder * const decoder,
@@ -692,6 +831,33 @@ float pes_hoop_height(const struct pes_decoder * const decoder)
 	return (float)decoder->hoop_height;
 }
 
+size_t pes_decode_stitches(const struct pes_decoder * const decoder,
+	float * const x, float * const y, uint8_t * const type,
+	uint16_t * const thread, const size_t capacity)
+{
+	size_t n = 0;
+
+	for (int i = 0; i < decoder->block_count && n < capacity; i++) {
+		const struct pes_block * const block = &decoder->block_list[i];
+		const int thread_index = block_thread(decoder, block).index;
+		const uint16_t thread_value =
+			thread_index < 0 ? UINT16_MAX : (uint16_t)thread_index;
+		const size_t count = decode_block_stitches(decoder, block, 0,
+			capacity - n < INT_MAX ? (int)(capacity - n) : INT_MAX,
+			x != NULL ? &x[n] : NULL, y != NULL ? &y[n] : NULL);
+
+		if (type != NULL)
+			memset(&type[n], block->stitch_type, count);
+		if (thread != NULL)
+			for (size_t k = 0; k < count; k++)
+				thread[n + k] = thread_value;
+
+		n += count;
+	}
+
+	return n;
+}
+
 bool pes_stitch_foreach(const struct pes_decoder * const decoder,
 	const pes_block_callback block_cb, const pes_stitch_callback stitch_cb,
 	void * const arg)
@@ -699,6 +865,75 @@ bool pes_stitch_foreach(const struct pes_decoder * const decoder,
 	return stitch_foreach(decoder, block_cb, stitch_cb, NULL, arg);
 }
 
+bool pes_stitch_foreach_raw(const struct pes_decoder * const decoder,
+	const pes_block_callback block_cb,
+	const pes_stitch_raw_callback stitch_cb, void * const arg)
+{
+	return stitch_foreach(decoder, block_cb, NULL, stitch_cb, arg);
+}
+
+int pes_block_count(const struct pes_decoder * const decoder)
+{
+	return decoder->block_count;
+}
+
+struct pes_block_info pes_block_info(const struct pes_decoder * const decoder,
+	const int block_index)
+{
+	if (block_index < 0 || decoder->block_count <= block_index)
+		return (struct pes_block_info) {
+			.thread = pec_undefined_thread()
+		};
+
+	const struct pes_block * const block = &decoder->block_list[block_index];
+
+	return (struct pes_block_info) {
+		.thread = block_thread(decoder, block),
+		.stitch_index = block->stitch_index,
+		.stitch_count = block->stitch_count,
+		.stitch_type = block->stitch_type
+	};
+}
+
+int pes_stitch_block_index(const struct pes_decoder * const decoder,
+	const int stitch_index)
+{
+	int a = 0, b = decoder->block_count;
+
+	if (stitch_index < 0 || pes_stitch_count(decoder) <= stitch_index)
+		return -1;
+
+	/* Binary search for the last block starting at or before the stitch. */
+	while (b - a > 1) {
+		const int m = a + (b - a) / 2;
+
+		if (decoder->block_list[m].stitch_index <= stitch_index)
+			a = m;
+		else
+			b = m;
+	}
+
+	return a;
+}
+
+size_t pes_block_decode_stitches(const struct pes_decoder * const decoder,
+	const int block_index, float * const x, float * const y,
+	const size_t capacity)
+{
+	return 0 <= block_index && block_index < decoder->block_count ?
+		decode_block_stitches(decoder, &decoder->block_list[block_index],
+			0, capacity < INT_MAX ? (int)capacity : INT_MAX, x, y) : 0;
+}
+
+bool pes_block_stitches(const struct pes_decoder * const decoder,
+	const int block_index, const pes_stitch_callback stitch_cb,
+	void * const arg)
+{
+	return 0 <= block_index && block_index < decoder->block_count &&
+		block_stitches(decoder, &decoder->block_list[block_index],
+			stitch_cb, arg);
+}
+
 struct pec_decoder *pes_pec_decoder(const struct pes_decoder * const decoder)
 {
 	return decoder->pec;
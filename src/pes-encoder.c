@@ -20,27 +20,24 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "pec-decoder.h"
+#include "allocate.h"
+#include "encode-buffer.h"
+#include "encode-value.h"
 #include "pec-encoder.h"
+#include "pec-encoder-internal.h"
 #include "pes-encoder.h"
-
-struct pes_stitch {
-	int thread_index;
-	float x;
-	float y;
-	bool jump;
-};
-
-struct pes_bounds {
-	float min_x;
-	float min_y;
-	float max_x;
-	float max_y;
-	bool valid;
+#include "pes-section.h"
+#include "stitch-list.h"
+
+struct pes_layout {
+	int cembone_size;  /* Size of CEmbOne section. */
+	int csewseg_size;  /* Size of CSewSeg section. */
+	int pec_offset;    /* Offset of PEC data. */
+	int size;          /* Size of PES data, or zero on failure. */
 };
 
 struct pes_encoder {
-	struct pes_bounds bounds;
+	struct libpes_allocator allocator;
 	struct pes_transform affine_transform;
 	struct {
 		float x;
@@ -49,14 +46,25 @@ struct pes_encoder {
 
 	int thread_count;
 	struct pec_thread thread_list[PES_MAX_THREADS];
+	pec_palette_match palette_match;
 
-	int stitch_count;
-	int stitch_capacity;
-	struct pes_stitch *stitch_list;
+	/* PES thread index of each PEC thread, which change with stops. */
+	int change_count;
+	int change_list[PEC_MAX_THREADS];
 
+	/* Blocks and the largest number of stitches in a block. */
 	int block_count;
+	int block_stitch_count;
+	int block_stitch_max;
 
+	/* Thread changes between stitches, excluding stitches out of range. */
+	int stitch_change_count;
+
+	/* Stitches are stored once, in the PEC encoder stitch list. */
 	struct pec_encoder *pec_encoder;
+
+	size_t buffer_size;
+	uint8_t *buffer;
 };
 
 static bool encoded_size(const void * const data, const size_t size,
@@ -69,230 +77,84 @@ static bool encoded_size(const void * const data, const size_t size,
 	return *s >= 0;
 }
 
-static bool encode_u16lsb(const int value,
-	const pes_encode_callback encode_cb, void * const arg)
-{
-	const uint8_t data[] = {
-		(value >>  0) & 0xFF,
-		(value >>  8) & 0xFF
-	};
-
-	return 0 <= value && value <= 0xFFFF &&
-		encode_cb(data, sizeof(data), arg);
-}
-
-static bool encode_i16lsb(const int value,
-	const pes_encode_callback encode_cb, void * const arg)
-{
-	return -0x8000 <= value && value <= 0x7FFF &&
-		encode_u16lsb(value & 0xFFFF, encode_cb, arg);
-}
-
-static bool encode_i32lsb(const int value,
-	const pes_encode_callback encode_cb, void * const arg)
-{
-	const uint8_t data[] = {
-		(value >>  0) & 0xFF,
-		(value >>  8) & 0xFF,
-		(value >> 16) & 0xFF,
-		(value >> 24) & 0xFF
-	};
-
-	return encode_cb(data, sizeof(data), arg);
-}
-
-static bool encode_f32lsb(const float f,
-	const pes_encode_callback encode_cb, void * const arg)
+static const struct stitch_list *stitch_list(
+	const struct pes_encoder * const encoder)
 {
-	uint32_t raw;
-
-	if (sizeof(raw) != sizeof(f))
-		return false;
-	memcpy(&raw, &f, sizeof(raw));
-
-	const int value = (int)raw;
-	return encode_i32lsb(value, encode_cb, arg);
+	return pec_encoder_stitch_list(encoder->pec_encoder);
 }
 
-static bool encode_string(const char * const s,
-	const pes_encode_callback encode_cb, void * const arg)
+static int stitch_thread_index(const struct pes_encoder * const encoder,
+	const struct stitch * const stitch)
 {
-	const size_t size = strlen(s);
-
-	return size <= 0xFFFF &&
-	       encode_u16lsb((int)size, encode_cb, arg) &&
-	       encode_cb(s, (int)size, arg);
-}
-
-static void update_bounds(struct pes_bounds * const bounds,
-	const float x, const float y)
-{
-	if (!bounds->valid) {
-		bounds->min_x = x;
-		bounds->min_y = y;
-		bounds->max_x = x;
-		bounds->max_y = y;
-		bounds->valid = true;
-	} else {
-		if (x < bounds->min_x)
-			bounds->min_x = x;
-		if (y < bounds->min_y)
-			bounds->min_y = y;
-		if (x > bounds->max_x)
-			bounds->max_x = x;
-		if (y > bounds->max_y)
-			bounds->max_y = y;
-	}
+	return encoder->change_list[stitch->thread_index];
 }
 
-static bool encode_transform(const struct pes_encoder * const encoder,
-	const pes_encode_callback encode_cb, void * const arg)
+static bool thread_change(const struct stitch_list * const list,
+	const int stitch_index)
 {
-	struct pes_transform t = encoder->affine_transform;
-	const float physical_translation_scale = 1.0f /
-		pec_physical_coordinate(1);
-
-	t.matrix[2][0] *= physical_translation_scale;
-	t.matrix[2][1] *= physical_translation_scale;
-
-	return encode_f32lsb(t.matrix[0][0], encode_cb, arg) &&
-	       encode_f32lsb(t.matrix[0][1], encode_cb, arg) &&
-	       encode_f32lsb(t.matrix[1][0], encode_cb, arg) &&
-	       encode_f32lsb(t.matrix[1][1], encode_cb, arg) &&
-	       encode_f32lsb(t.matrix[2][0], encode_cb, arg) &&
-	       encode_f32lsb(t.matrix[2][1], encode_cb, arg);
+	return stitch_index == 0 ||
+	       list->stitches[stitch_index - 1].thread_index !=
+	       list->stitches[stitch_index - 0].thread_index;
 }
 
-static int is_block(const struct pes_stitch * const stitch_list,
-	const int stitch_count, const int stitch_index)
+static int is_block(const struct stitch_list * const list,
+	const int stitch_index)
 {
-	return stitch_list[stitch_index].jump || stitch_index == 0 ||
-	       stitch_list[stitch_index - 1].thread_index !=
-	       stitch_list[stitch_index - 0].thread_index;
+	/* Stitches are jump or trim stitches on jumps and thread changes. */
+	return list->stitches[stitch_index].type != PEC_STITCH_NORMAL ||
+	       thread_change(list, stitch_index);
 }
 
-static bool encode_cembone(const struct pes_encoder * const encoder,
+static bool encode_pes_cembone(const struct pes_encoder * const encoder,
 	const pes_encode_callback encode_cb, void * const arg)
 {
-	static const uint8_t footer[] = { 0, 0, 0, 0, 0, 0, 0, 0 };
-
-	/*
-	 * FIXME: Bounds cannot be stored and must be computed since
-	 * the affine transform affects them. Also apply rotational
-	 * part for a general matrix multiplication of all coordinates
-	 * to compute the bounds. Try WLD01.pes.
-	 */
-	const int t_x = pec_raw_coordinate(encoder->affine_transform.matrix[2][0]);
-	const int t_y = pec_raw_coordinate(encoder->affine_transform.matrix[2][1]);
-
-	const int min_x = pec_raw_coordinate(encoder->bounds.min_x) + t_x;
-	const int min_y = pec_raw_coordinate(encoder->bounds.min_y) + t_y;
-	const int max_x = pec_raw_coordinate(encoder->bounds.max_x) + t_x;
-	const int max_y = pec_raw_coordinate(encoder->bounds.max_y) + t_y;
-
-	const int width  = !encoder->bounds.valid ? 0 : max_x - min_x;
-	const int height = !encoder->bounds.valid ? 0 : max_y - min_y;
-
-	const int block_count = encoder->block_count;
-
-	return encode_string("CEmbOne", encode_cb, arg) &&
-	       encode_i16lsb(min_x, encode_cb, arg) &&
-	       encode_i16lsb(min_y, encode_cb, arg) &&
-	       encode_i16lsb(max_x, encode_cb, arg) &&
-	       encode_i16lsb(max_y, encode_cb, arg) &&
-	       encode_i16lsb(min_x, encode_cb, arg) &&
-	       encode_i16lsb(min_y, encode_cb, arg) &&
-	       encode_i16lsb(max_x, encode_cb, arg) &&
-	       encode_i16lsb(max_y, encode_cb, arg) &&
-	       encode_transform(encoder, encode_cb, arg) &&
-	       encode_u16lsb(1, encode_cb, arg) &&           /* FIXME: Unknown data */
-	       encode_i16lsb((int)roundf(encoder->translation.x), encode_cb, arg) &&
-	       encode_i16lsb((int)roundf(encoder->translation.y), encode_cb, arg) &&
-	       encode_u16lsb(width, encode_cb, arg) &&
-	       encode_u16lsb(height, encode_cb, arg) &&
-	       encode_cb(footer, sizeof(footer), arg) &&     /* FIXME: Unknown data */
-	       encode_u16lsb(block_count, encode_cb, arg) && /* FIXME: Unknown data */
-	       encode_u16lsb(0xFFFF, encode_cb, arg) &&      /* FIXME: Unknown data */
-	       encode_u16lsb(0x0000, encode_cb, arg);        /* FIXME: Unknown data */
-}
-
-static bool encode_block_header(const enum pec_stitch_type stitch_type,
-	const int thread_index, const int stitch_count,
-	const pes_encode_callback encode_cb, void * const arg)
-{
-	return encode_u16lsb(stitch_type, encode_cb, arg) &&
-	       encode_u16lsb(thread_index + 1, encode_cb, arg) &&
-	       encode_u16lsb(stitch_count, encode_cb, arg);
-}
-
-static bool encode_stitch(const float x, const float y,
-	const pes_encode_callback encode_cb, void * const arg)
-{
-	return encode_i16lsb(pec_raw_coordinate(x), encode_cb, arg) &&
-	       encode_i16lsb(pec_raw_coordinate(y), encode_cb, arg);
+	return encode_cembone(&stitch_list(encoder)->bounds,
+		&encoder->affine_transform,
+		(int)roundf(encoder->translation.x),
+		(int)roundf(encoder->translation.y),
+		encoder->block_count, encode_cb, arg);
 }
 
-static int block_stitch_count(const struct pes_stitch * const stitch_list,
-	const int stitch_count, const int stitch_index)
+static int block_stitch_count(const struct stitch_list * const list,
+	const int stitch_index)
 {
 	int count = 0;
 
-	while (stitch_index + count < stitch_count && (count == 0 ||
-		!is_block(stitch_list, stitch_count, stitch_index + count)))
+	while (stitch_index + count < list->count &&
+		(count == 0 || !is_block(list, stitch_index + count)))
 		count++;
 
 	return count;
 }
 
-static bool encode_jump_stitch(
-	const struct pes_stitch a, const struct pes_stitch b,
-	const pes_encode_callback encode_cb, void * const arg)
-{
-	return encode_block_header(PEC_STITCH_JUMP,
-		       b.thread_index, 2, encode_cb, arg) &&
-	       encode_stitch(a.x, a.y, encode_cb, arg) &&
-	       encode_stitch(b.x, b.y, encode_cb, arg);
-}
-
 static bool encode_stitch_list(const struct pes_encoder * const encoder,
 	const pes_encode_callback encode_cb, void * const arg)
 {
-	for (int i = 0; i < encoder->stitch_count; i++) {
-		const struct pes_stitch * const stitch = &encoder->stitch_list[i];
+	const struct stitch_list * const list = stitch_list(encoder);
+
+	for (int i = 0; i < list->count; i++) {
+		const struct stitch * const stitch = &list->stitches[i];
 
 		if (i == 0) {
 			if (!encode_block_header(PEC_STITCH_NORMAL,
-				stitch->thread_index,
-				block_stitch_count(encoder->stitch_list,
-					encoder->stitch_count, i),
+				stitch_thread_index(encoder, stitch),
+				block_stitch_count(list, i),
 				encode_cb, arg))
 				return false;
-		} else if (stitch->jump || stitch->thread_index !=
-			encoder->stitch_list[i].thread_index) {
-			/*
-			 * A stitch jump can either be explicitly given or
-			 * implicit on a thread index change.
-			 */
-			if (!encode_u16lsb(0x8003, encode_cb, arg)) /* FIXME: Unknown data */
-				return false;
-
-			if (!encode_jump_stitch(encoder->stitch_list[i - 1],
-				*stitch, encode_cb, arg))
-				return false;
-
-			if (!encode_u16lsb(0x8003, encode_cb, arg)) /* FIXME: Unknown data */
+		} else if (is_block(list, i)) {
+			if (!encode_jump_block(&list->stitches[i - 1], stitch,
+				stitch_thread_index(encoder, stitch),
+				encode_cb, arg))
 				return false;
 
-			const int stitch_count = block_stitch_count(
-				encoder->stitch_list, encoder->stitch_count, i);
-
 			if (!encode_block_header(PEC_STITCH_NORMAL,
-				stitch->thread_index, stitch_count,
+				stitch_thread_index(encoder, stitch),
+				block_stitch_count(list, i),
 				encode_cb, arg))
 				return false;
 		}
 
-		if (!encode_stitch(stitch->x, stitch->y, encode_cb, arg))
+		if (!encode_stitch(stitch, encode_cb, arg))
 			return false;
 	}
 
@@ -302,32 +164,27 @@ static bool encode_stitch_list(const struct pes_encoder * const encoder,
 static bool encode_thread_list14(const struct pes_encoder * const encoder,
 	const pes_encode_callback encode_cb, void * const arg)
 {
-	int change_count = 0;
+	const struct stitch_list * const list = stitch_list(encoder);
 
-	for (int i = 0; i < encoder->stitch_count; i++)
-		if (i == 0 || encoder->stitch_list[i - 1].thread_index !=
-			encoder->stitch_list[i].thread_index)
-			change_count++;
-
-	if (!encode_u16lsb(change_count, encode_cb, arg))
+	if (!encode_u16lsb(encoder->stitch_change_count, encode_cb, arg))
 		return false;
 
-	for (int i = 0, block_index = 0; i < encoder->stitch_count; i++) {
-		if (i == 0 || encoder->stitch_list[i - 1].thread_index !=
-			encoder->stitch_list[i].thread_index) {
+	for (int i = 0, block_index = 0; i < list->count; i++) {
+		if (thread_change(list, i)) {
 			if (!encode_u16lsb(block_index, encode_cb, arg))
 				return false;
 
-			const int thread_index = encoder->stitch_list[i].thread_index;
+			const int thread_index =
+				stitch_thread_index(encoder, &list->stitches[i]);
 			const struct pec_thread thread = encoder->thread_list[thread_index];
-			const int palette_index = pec_palette_index_by_rgb(thread.rgb);
+			const int palette_index = encoder->palette_match(thread.rgb);
 
 			if (!encode_u16lsb(palette_index, encode_cb, arg))
 				return false;
 		}
 
 		/* Jump stitches are encoded as two blocks. */
-		if (is_block(encoder->stitch_list, encoder->stitch_count, i))
+		if (is_block(list, i))
 			block_index += (i == 0 ? 1 : 2);
 	}
 
@@ -346,84 +203,194 @@ static bool encode_csewseg14(const struct pes_encoder * const encoder,
 static bool encode_sections14(const struct pes_encoder * const encoder,
 	const pes_encode_callback encode_cb, void * const arg)
 {
-	return encode_cembone(encoder, encode_cb, arg) &&
+	return encode_pes_cembone(encoder, encode_cb, arg) &&
 	       encode_csewseg14(encoder, encode_cb, arg);
 }
 
 static bool encode_pec(const struct pes_encoder * const encoder,
 	const pes_encode_callback encode_cb, void * const arg)
 {
-	return pec_encode(encoder->pec_encoder, encode_cb, arg);
+	return pec_encode_sections(encoder->pec_encoder, encode_cb, arg);
 }
 
-static bool encode_pec_offset1(const struct pes_encoder * const encoder,
-	const pes_encode_callback encode_cb, void * const arg)
+static bool valid_stitch_list(const struct pes_encoder * const encoder,
+	int * const break_count, int * const change_count)
 {
-	int pec_offset = 22; /* #PES0001 header size. */
+	/*
+	 * Coordinates are quantized to 16 bits, and blocks are counted, when
+	 * stitches are appended. Each break adds 2 blocks to the first.
+	 */
+	*break_count = encoder->block_count == 0 ? 0 :
+		(encoder->block_count - 1) / 2;
+	*change_count = encoder->stitch_change_count;
 
-	return encode_sections14(encoder, encoded_size, &pec_offset) &&
-	       encode_i32lsb(pec_offset, encode_cb, arg);
+	return encoder->block_stitch_max <= 0xFFFF &&
+	       *change_count <= 0xFFFF;
 }
 
-static bool append_stitch(struct pes_encoder * const encoder,
-	const int thread_index, const float x, const float y, const bool jump)
+static void count_block_stitches(struct pes_encoder * const encoder,
+	const int count)
 {
-	if (thread_index < 0 || encoder->thread_count <= thread_index)
-		return false;
+	encoder->block_stitch_count += count;
+	if (encoder->block_stitch_max < encoder->block_stitch_count)
+		encoder->block_stitch_max = encoder->block_stitch_count;
+}
 
-	if (encoder->stitch_capacity <= encoder->stitch_count) {
-		const int capacity = encoder->stitch_capacity +
-			(encoder->stitch_capacity == 0    ?   100 :
-			 10000 < encoder->stitch_capacity ? 10000 :
-			 encoder->stitch_capacity);
-
-		if (capacity < INT_MAX/2) {
-			struct pes_stitch * const stitch_list =
-				realloc(encoder->stitch_list,
-					(size_t)capacity * sizeof(*stitch_list));
-
-			if (stitch_list != NULL) {
-				encoder->stitch_list = stitch_list;
-				encoder->stitch_capacity = capacity;
-			}
-		}
+static void count_stitch(struct pes_encoder * const encoder,
+	const struct stitch_list * const list)
+{
+	const int stitch_index = list->count - 1;
+
+	/* Jump stitches are encoded as two blocks. */
+	if (is_block(list, stitch_index)) {
+		encoder->block_count += (stitch_index == 0 ? 1 : 2);
+		encoder->block_stitch_count = 0;
 	}
 
-	if (encoder->stitch_capacity <= encoder->stitch_count)
+	if (thread_change(list, stitch_index))
+		encoder->stitch_change_count++;
+
+	count_block_stitches(encoder, 1);
+}
+
+static struct pes_layout layout(const struct pes_encoder * const encoder)
+{
+	/*
+	 * The layout is computed for each encode. Blocks and thread changes
+	 * are counted as stitches are appended, so this is cheap.
+	 */
+	struct pes_layout layout = { .size = 0 };
+	int break_count, change_count;
+
+	const size_t pec_size = pec_encoded_size(encoder->pec_encoder);
+
+	/* CEmbOne is small and of fixed size, but its values are validated. */
+	if (pec_size == 0 || INT_MAX/2 < pec_size ||
+	    !encode_pes_cembone(encoder, encoded_size, &layout.cembone_size) ||
+	    !valid_stitch_list(encoder, &break_count, &change_count))
+		return (struct pes_layout) { .size = 0 };
+
+	/*
+	 * A block header is 6 bytes, and each stitch is 4 bytes. A block
+	 * break is a jump block of 2 stitches enclosed by 2-byte markers.
+	 */
+	const int stitch_count = stitch_list(encoder)->count;
+	const int64_t stitch_list_size = stitch_count == 0 ? 0 :
+		6 + 4 * (int64_t)stitch_count +
+		(2 + 6 + 2 * 4 + 2 + 6) * (int64_t)break_count;
+	const int64_t thread_list_size = 2 + 4 * (int64_t)change_count + 4;
+	const int64_t csewseg_size = 2 + 7 + stitch_list_size + thread_list_size;
+	const int64_t pec_offset = 22 + layout.cembone_size + csewseg_size;
+
+	if (INT_MAX/2 < pec_offset + (int64_t)pec_size)
+		return (struct pes_layout) { .size = 0 };
+
+	layout.csewseg_size = (int)csewseg_size;
+	layout.pec_offset = (int)pec_offset;
+	layout.size = (int)pec_offset + (int)pec_size;
+
+	return layout;
+}
+
+static bool encode_pec_offset1(const struct pes_layout * const layout,
+	const pes_encode_callback encode_cb, void * const arg)
+{
+	return encode_i32lsb(layout->pec_offset, encode_cb, arg);
+}
+
+static bool append_block_stitch(struct pes_encoder * const encoder,
+	const int thread_index, const bool jump,
+	enum pec_stitch_type * const stitch_type)
+{
+	struct stitch_list * const list =
+		pec_encoder_stitch_list(encoder->pec_encoder);
+
+	if (thread_index < 0 || encoder->thread_count <= thread_index)
+		return false;
+
+	if (!stitch_list_grow(list, 1))
 		return false;
 
 	/* FIXME: Is there a 1000 stitch limit per block? Many PES files indicate that. */
 
-	const bool thread_change = 0 < encoder->stitch_count && thread_index !=
-		encoder->stitch_list[encoder->stitch_count - 1].thread_index;
+	const bool thread_change = 0 < list->count && thread_index !=
+		stitch_thread_index(encoder, &list->stitches[list->count - 1]);
 
-	if (encoder->stitch_count == 0 || thread_change) {
-		const int palette_index = pec_palette_index_by_rgb(
+	if (list->count == 0 || thread_change) {
+		const int palette_index = encoder->palette_match(
 			encoder->thread_list[thread_index].rgb);
 		if (!pec_append_thread(encoder->pec_encoder, palette_index))
 			return false;
+		encoder->change_list[encoder->change_count++] = thread_index;
 	}
 
-	if (!(thread_change ? pec_append_jump_stitch :
-		       jump ? pec_append_trim_stitch :
-		              pec_append_stitch)
+	*stitch_type = thread_change ? PEC_STITCH_JUMP :
+	                        jump ? PEC_STITCH_TRIM :
+	                               PEC_STITCH_NORMAL;
+
+	return true;
+}
+
+static bool append_stitch(struct pes_encoder * const encoder,
+	const int thread_index, const float x, const float y, const bool jump)
+{
+	enum pec_stitch_type stitch_type;
+
+	if (!append_block_stitch(encoder, thread_index, jump, &stitch_type) ||
+	    !(stitch_type == PEC_STITCH_JUMP ? pec_append_jump_stitch :
+	      stitch_type == PEC_STITCH_TRIM ? pec_append_trim_stitch :
+	                                       pec_append_stitch)
 		(encoder->pec_encoder, x, y))
 		return false;
 
-	encoder->stitch_list[encoder->stitch_count] =
-		(struct pes_stitch){
-			.thread_index = thread_index,
-			.x = x,
-			.y = y,
-			.jump = jump
-		};
-	update_bounds(&encoder->bounds, x, y);
-	encoder->stitch_count++;
+	count_stitch(encoder, pec_encoder_stitch_list(encoder->pec_encoder));
 
-	/* Jump stitches are encoded as two blocks. */
-	if (is_block(encoder->stitch_list, encoder->stitch_count,
-		encoder->stitch_count - 1))
-		encoder->block_count += (encoder->stitch_count == 1 ? 1 : 2);
+	return true;
+}
+
+static bool append_stitches(struct pes_encoder * const encoder,
+	const int thread_index, const float * const xy, const size_t n,
+	const bool jump)
+{
+	if (n == 0)
+		return true;
+
+	/*
+	 * The first stitch may change thread or be a jump stitch. The
+	 * following stitches are regular stitches of the same block.
+	 */
+	if (!stitch_list_grow(pec_encoder_stitch_list(encoder->pec_encoder), n) ||
+	    !append_stitch(encoder, thread_index, xy[0], xy[1], jump) ||
+	    !pec_append_stitches(encoder->pec_encoder, &xy[2], n - 1))
+		return false;
+
+	count_block_stitches(encoder, (int)(n - 1));
+
+	return true;
+}
+
+static bool append_stitches_raw(struct pes_encoder * const encoder,
+	const int thread_index, const int32_t * const xy, const size_t n,
+	const bool jump)
+{
+	enum pec_stitch_type stitch_type;
+
+	if (n == 0)
+		return true;
+
+	/* Raw coordinates are stored as given, without conversions. */
+	if (!stitch_list_grow(pec_encoder_stitch_list(encoder->pec_encoder), n) ||
+	    !append_block_stitch(encoder, thread_index, jump, &stitch_type) ||
+	    !pec_encoder_append_raw(encoder->pec_encoder, stitch_type, xy, 1))
+		return false;
+
+	count_stitch(encoder, pec_encoder_stitch_list(encoder->pec_encoder));
+
+	if (!pec_encoder_append_raw(encoder->pec_encoder,
+		PEC_STITCH_NORMAL, &xy[2], n - 1))
+		return false;
+
+	count_block_stitches(encoder, (int)(n - 1));
 
 	return true;
 }
@@ -443,17 +410,35 @@ static size_t pes_encode_size(
 
 struct pes_encoder *pes_encoder_init()
 {
-	struct pes_encoder * const encoder = calloc(1, sizeof(*encoder));
+	return pes_encoder_init_with_allocator(allocator_global());
+}
+
+struct pes_encoder *pes_encoder_init_with_allocator(
+	const struct libpes_allocator * const allocator)
+{
+	if (allocator == NULL)
+		return pes_encoder_init_with_allocator(allocator_global());
+	if (!allocator_valid(allocator))
+		return NULL;
+
+	struct pes_encoder * const encoder =
+		allocate_zero(allocator, 1, sizeof(*encoder));
 
 	if (encoder != NULL) {
+		encoder->allocator = *allocator;
 		encoder->affine_transform.matrix[0][0] = 1.0f;
 		encoder->affine_transform.matrix[1][1] = 1.0f;
+		encoder->palette_match = pec_palette_index_by_rgb;
+		pes_encoder_buffer_size(encoder, ENCODE_BUFFER_SIZE);
 
-		encoder->pec_encoder = pec_encoder_init();
+		encoder->pec_encoder = pec_encoder_init_with_allocator(allocator);
 		if (encoder->pec_encoder == NULL) {
 			pes_encoder_free(encoder);
 			return NULL;
 		}
+
+		/* Embedded PEC data is staged in the buffer of the PES encoder. */
+		pec_encoder_buffer_size(encoder->pec_encoder, 0);
 	}
 
 	return encoder;
@@ -463,11 +448,28 @@ void pes_encoder_free(struct pes_encoder * const encoder)
 {
 	if (encoder != NULL) {
 		pec_encoder_free(encoder->pec_encoder);
-		free(encoder->stitch_list);
-		free(encoder);
+		deallocate(&encoder->allocator, encoder->buffer);
+		deallocate(&encoder->allocator, encoder);
 	}
 }
 
+void pes_encoder_reset(struct pes_encoder * const encoder)
+{
+	encoder->affine_transform = (struct pes_transform) {
+		.matrix = { { 1.0f, 0.0f }, { 0.0f, 1.0f }, { 0.0f, 0.0f } }
+	};
+	encoder->translation.x = 0.0f;
+	encoder->translation.y = 0.0f;
+	encoder->thread_count = 0;
+	encoder->change_count = 0;
+	encoder->block_count = 0;
+	encoder->block_stitch_count = 0;
+	encoder->block_stitch_max = 0;
+	encoder->stitch_change_count = 0;
+
+	pec_encoder_reset(encoder->pec_encoder);
+}
+
 bool pes_append_thread(struct pes_encoder * const encoder,
 	const struct pec_thread thread)
 {
@@ -491,6 +493,40 @@ bool pes_append_jump_stitch(struct pes_encoder * const encoder,
 	return append_stitch(encoder, thread_index, x, y, true);
 }
 
+bool pes_append_stitches(struct pes_encoder * const encoder,
+	const int thread_index, const float * const xy, const size_t n,
+	const int flags)
+{
+	return append_stitches(encoder, thread_index, xy, n,
+		(flags & PES_APPEND_JUMP) != 0);
+}
+
+bool pes_append_stitches_raw(struct pes_encoder * const encoder,
+	const int thread_index, const int32_t * const xy, const size_t n,
+	const int flags)
+{
+	return append_stitches_raw(encoder, thread_index, xy, n,
+		(flags & PES_APPEND_JUMP) != 0);
+}
+
+bool pes_encoder_reserve(struct pes_encoder * const encoder,
+	const size_t stitch_count)
+{
+	return stitch_list_reserve(
+		pec_encoder_stitch_list(encoder->pec_encoder), stitch_count);
+}
+
+bool pes_encoder_palette_match(struct pes_encoder * const encoder,
+	const pec_palette_match palette_match)
+{
+	if (encoder->thread_count != 0)
+		return false;
+
+	encoder->palette_match = palette_match;
+
+	return true;
+}
+
 void pes_encode_transform(struct pes_encoder * const encoder,
 	const struct pes_transform affine_transform)
 {
@@ -498,11 +534,20 @@ void pes_encode_transform(struct pes_encoder * const encoder,
 		sizeof(encoder->affine_transform));
 }
 
-bool pes_encode1(const struct pes_encoder * const encoder,
+void pes_encoder_buffer_size(struct pes_encoder * const encoder,
+	const size_t size)
+{
+	deallocate(&encoder->allocator, encoder->buffer);
+	encoder->buffer = size != 0 ? allocate(&encoder->allocator, size) : NULL;
+	encoder->buffer_size = encoder->buffer != NULL ? size : 0;
+}
+
+static bool encode_pes1(const struct pes_encoder * const encoder,
+	const struct pes_layout * const layout,
 	const pes_encode_callback encode_cb, void * const arg)
 {
 	return encode_cb("#PES0001", 8, arg) &&
-	       encode_pec_offset1(encoder, encode_cb, arg) &&
+	       encode_pec_offset1(layout, encode_cb, arg) &&
 	       encode_u16lsb(0x0000, encode_cb, arg) && /* FIXME: Unknown data */
 	       encode_u16lsb(0x0001, encode_cb, arg) && /* FIXME: Unknown data */
 	       encode_u16lsb(0x0001, encode_cb, arg) && /* FIXME: Unknown data */
@@ -512,6 +557,39 @@ bool pes_encode1(const struct pes_encoder * const encoder,
 	       encode_pec(encoder, encode_cb, arg);
 }
 
+bool pes_encode1(const struct pes_encoder * const encoder,
+	const pes_encode_callback encode_cb, void * const arg)
+{
+	const struct pes_layout pes_layout = layout(encoder);
+	struct encode_buffer buffer;
+
+	if (pes_layout.size == 0)
+		return false;
+
+	encode_buffer_init_staging(&buffer,
+		encoder->buffer, encoder->buffer_size, encode_cb, arg);
+
+	return encode_buffer_flush(&buffer, encode_pes1(encoder,
+		&pes_layout, encode_buffer_write, &buffer));
+}
+
+bool pes_encode1_into(const struct pes_encoder * const encoder,
+	void * const dst, const size_t capacity, size_t * const written)
+{
+	const struct pes_layout pes_layout = layout(encoder);
+	const size_t size = (size_t)pes_layout.size;
+	struct encode_buffer buffer;
+
+	if (written != NULL)
+		*written = size;
+	if (size == 0 || capacity < size)
+		return false;
+
+	encode_buffer_init_memory(&buffer, dst, capacity);
+
+	return encode_pes1(encoder, &pes_layout, encode_buffer_write, &buffer);
+}
+
 bool pes_encode4(const struct pes_encoder * const encoder,
 	const pes_encode_callback encode_cb, void * const arg)
 {
@@ -535,7 +613,7 @@ bool pes_encode6(const struct pes_encoder * const encoder,
 
 size_t pes_encode1_size(const struct pes_encoder * const encoder)
 {
-	return pes_encode_size(pes_encode1, encoder);
+	return (size_t)layout(encoder).size;
 }
 
 size_t pes_encode4_size(const struct pes_encoder * const encoder)
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "encode-value.h"
+#include "pec-decoder.h"
+#include "pec-encoder.h"
+#include "pes-section.h"
+
+static bool encode_transform(const struct pes_transform * const transform,
+	const encode_buffer_callback encode_cb, void * const arg)
+{
+	struct pes_transform t = *transform;
+	const float physical_translation_scale = 1.0f /
+		pec_physical_coordinate(1);
+
+	t.matrix[2][0] *= physical_translation_scale;
+	t.matrix[2][1] *= physical_translation_scale;
+
+	return encode_f32lsb(t.matrix[0][0], encode_cb, arg) &&
+	       encode_f32lsb(t.matrix[0][1], encode_cb, arg) &&
+	       encode_f32lsb(t.matrix[1][0], encode_cb, arg) &&
+	       encode_f32lsb(t.matrix[1][1], encode_cb, arg) &&
+	       encode_f32lsb(t.matrix[2][0], encode_cb, arg) &&
+	       encode_f32lsb(t.matrix[2][1], encode_cb, arg);
+}
+
+bool encode_cembone(const struct stitch_bounds * const bounds,
+	const struct pes_transform * const affine_transform,
+	const int translation_x, const int translation_y,
+	const int block_count,
+	const encode_buffer_callback encode_cb, void * const arg)
+{
+	static const uint8_t footer[] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+	/*
+	 * FIXME: Bounds cannot be stored and must be computed since
+	 * the affine transform affects them. Also apply rotational
+	 * part for a general matrix multiplication of all coordinates
+	 * to compute the bounds. Try WLD01.pes.
+	 */
+	const int t_x = pec_raw_coordinate(affine_transform->matrix[2][0]);
+	const int t_y = pec_raw_coordinate(affine_transform->matrix[2][1]);
+
+	const int min_x = bounds->min_x + t_x;
+	const int min_y = bounds->min_y + t_y;
+	const int max_x = bounds->max_x + t_x;
+	const int max_y = bounds->max_y + t_y;
+
+	const int width  = !bounds->valid ? 0 : max_x - min_x;
+	const int height = !bounds->valid ? 0 : max_y - min_y;
+
+	return encode_string("CEmbOne", encode_cb, arg) &&
+	       encode_i16lsb(min_x, encode_cb, arg) &&
+	       encode_i16lsb(min_y, encode_cb, arg) &&
+	       encode_i16lsb(max_x, encode_cb, arg) &&
+	       encode_i16lsb(max_y, encode_cb, arg) &&
+	       encode_i16lsb(min_x, encode_cb, arg) &&
+	       encode_i16lsb(min_y, encode_cb, arg) &&
+	       encode_i16lsb(max_x, encode_cb, arg) &&
+	       encode_i16lsb(max_y, encode_cb, arg) &&
+	       encode_transform(affine_transform, encode_cb, arg) &&
+	       encode_u16lsb(1, encode_cb, arg) &&           /* FIXME: Unknown data */
+	       encode_i16lsb(translation_x, encode_cb, arg) &&
+	       encode_i16lsb(translation_y, encode_cb, arg) &&
+	       encode_u16lsb(width, encode_cb, arg) &&
+	       encode_u16lsb(height, encode_cb, arg) &&
+	       encode_cb(footer, sizeof(footer), arg) &&     /* FIXME: Unknown data */
+	       encode_u16lsb(block_count, encode_cb, arg) && /* FIXME: Unknown data */
+	       encode_u16lsb(0xFFFF, encode_cb, arg) &&      /* FIXME: Unknown data */
+	       encode_u16lsb(0x0000, encode_cb, arg);        /* FIXME: Unknown data */
+}
+
+bool encode_block_header(const enum pec_stitch_type stitch_type,
+	const int thread_index, const int stitch_count,
+	const encode_buffer_callback encode_cb, void * const arg)
+{
+	return encode_u16lsb(stitch_type, encode_cb, arg) &&
+	       encode_u16lsb(thread_index + 1, encode_cb, arg) &&
+	       encode_u16lsb(stitch_count, encode_cb, arg);
+}
+
+bool encode_stitch(const struct stitch * const stitch,
+	const encode_buffer_callback encode_cb, void * const arg)
+{
+	return encode_i16lsb(stitch->x, encode_cb, arg) &&
+	       encode_i16lsb(stitch->y, encode_cb, arg);
+}
+
+bool encode_jump_block(const struct stitch * const a,
+	const struct stitch * const b, const int thread_index,
+	const encode_buffer_callback encode_cb, void * const arg)
+{
+	return encode_u16lsb(0x8003, encode_cb, arg) && /* FIXME: Unknown data */
+	       encode_block_header(PEC_STITCH_JUMP, thread_index, 2,
+		       encode_cb, arg) &&
+	       encode_stitch(a, encode_cb, arg) &&
+	       encode_stitch(b, encode_cb, arg) &&
+	       encode_u16lsb(0x8003, encode_cb, arg);  /* FIXME: Unknown data */
+}
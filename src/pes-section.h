@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PESLIB_PES_SECTION_H
+#define PESLIB_PES_SECTION_H
+
+#include <stdbool.h>
+
+#include "encode-buffer.h"
+#include "pes.h"
+#include "stitch-list.h"
+
+/*
+ * PES version 1 sections shared by the PES encoder and the PES stream
+ * encoder.
+ */
+
+/**
+ * Encode the CEmbOne section, which is of fixed size.
+ *
+ * @param bounds Bounds of stitches [0.1 mm].
+ * @param affine_transform Affine PES transform matrix.
+ * @param translation_x X translation [0.1 mm].
+ * @param translation_y Y translation [0.1 mm].
+ * @param block_count Number of CSewSeg blocks.
+ * @param encode_cb Callback with encoded data.
+ * @param arg Argument pointer supplied to callback.
+ * @return True if the section was successfully encoded, else false.
+ */
+bool encode_cembone(const struct stitch_bounds * const bounds,
+	const struct pes_transform * const affine_transform,
+	const int translation_x, const int translation_y,
+	const int block_count,
+	const encode_buffer_callback encode_cb, void * const arg);
+
+/**
+ * Encode the header of a CSewSeg block.
+ *
+ * @param stitch_type Type of stitches of block.
+ * @param thread_index PES thread index starting from zero.
+ * @param stitch_count Number of stitches of block.
+ * @param encode_cb Callback with encoded data.
+ * @param arg Argument pointer supplied to callback.
+ * @return True if the header was successfully encoded, else false.
+ */
+bool encode_block_header(const enum pec_stitch_type stitch_type,
+	const int thread_index, const int stitch_count,
+	const encode_buffer_callback encode_cb, void * const arg);
+
+/**
+ * Encode the coordinates of a CSewSeg stitch.
+ *
+ * @param stitch Stitch to encode.
+ * @param encode_cb Callback with encoded data.
+ * @param arg Argument pointer supplied to callback.
+ * @return True if the stitch was successfully encoded, else false.
+ */
+bool encode_stitch(const struct stitch * const stitch,
+	const encode_buffer_callback encode_cb, void * const arg);
+
+/**
+ * Encode the jump block between two CSewSeg blocks. A stitch jump can
+ * either be explicitly given or implicit on a thread index change. The
+ * block header of the following block is not included.
+ *
+ * @param a Last stitch of the preceding block.
+ * @param b First stitch of the following block.
+ * @param thread_index PES thread index of the following block.
+ * @param encode_cb Callback with encoded data.
+ * @param arg Argument pointer supplied to callback.
+ * @return True if the jump block was successfully encoded, else false.
+ */
+bool encode_jump_block(const struct stitch * const a,
+	const struct stitch * const b, const int thread_index,
+	const encode_buffer_callback encode_cb, void * const arg);
+
+#endif /* PESLIB_PES_SECTION_H */
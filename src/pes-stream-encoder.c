@@ -0,0 +1,719 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocate.h"
+#include "encode-buffer.h"
+#include "encode-value.h"
+#include "pec-encoder.h"
+#include "pec-encoder-internal.h"
+#include "pec-thumbnail.h"
+#include "pes-section.h"
+#include "pes-stream-encoder.h"
+#include "stitch-list.h"
+
+#define PES_HEADER_SIZE 22  /* Offset of CEmbOne. */
+#define PEC_OFFSET 8        /* Offset of PEC offset in PES header. */
+#define STITCH_CHUNK 256    /* Stitches appended at a time in bulk. */
+#define SPILL_CHUNK 4096    /* Size of spilled data read at a time. */
+
+struct pes_stream_encoder {
+	struct libpes_allocator allocator;
+	struct pes_stream_sink sink;
+	struct encode_buffer buffer;
+	size_t offset;           /* Size of written PES data. */
+	bool valid;              /* Stitches can be appended. */
+
+	struct pes_transform affine_transform;
+
+	int thread_count;
+	struct pec_thread thread_list[PES_MAX_THREADS];
+	pec_palette_match palette_match;
+
+	/* PES thread and block index of each PEC thread, which change with stops. */
+	int change_count;
+	int change_list[PEC_MAX_THREADS];
+	int change_block[PEC_MAX_THREADS];
+
+	int block_count;
+	size_t block_offset;     /* Offset of stitch count of current block. */
+	int block_stitch_count;
+
+	/*
+	 * PEC stitch data is relative to bounds that are known only when
+	 * finished, except for the deltas and stops that follow the first
+	 * stitch. Those are written to the spill as stitches are appended.
+	 */
+	struct pes_stream_spill spill;
+	struct encode_buffer spill_buffer;
+	int spill_size;          /* Size of spilled PEC stitch data. */
+	int stop;                /* Marker of next PEC stop stitch. */
+
+	int stitch_count;
+	struct stitch first;     /* First stitch, with PEC thread index. */
+	struct stitch last;      /* Last stitch, with PEC thread index. */
+	struct stitch_bounds bounds;
+};
+
+static bool encode_stream(const void * const data, const size_t size,
+	void * const arg)
+{
+	struct pes_stream_encoder * const encoder = arg;
+
+	if (!encode_buffer_write(data, size, &encoder->buffer))
+		return false;
+
+	encoder->offset += size;
+
+	return true;
+}
+
+static bool encode_spill(struct pes_stream_encoder * const encoder,
+	const void * const data, const int size)
+{
+	if (!encode_buffer_write(data, size, &encoder->spill_buffer))
+		return false;
+
+	encoder->spill_size += size;
+
+	return true;
+}
+
+static bool patch(struct pes_stream_encoder * const encoder,
+	const size_t offset, const void * const data, const size_t size)
+{
+	struct encode_buffer * const buffer = &encoder->buffer;
+	const size_t flushed = encoder->offset - buffer->size;
+	const size_t n = offset < flushed ?
+		(flushed - offset < size ? flushed - offset : size) : 0;
+
+	/* Data that remains in the buffer is patched in place. */
+	if (n != 0 && !encoder->sink.patch_cb(offset, data, n, encoder->sink.arg))
+		return false;
+
+	if (n < size)
+		memcpy(&buffer->data[offset + n - flushed],
+			(const uint8_t *)data + n, size - n);
+
+	return true;
+}
+
+static bool patch_u16lsb(struct pes_stream_encoder * const encoder,
+	const size_t offset, const int value)
+{
+	const uint8_t data[] = {
+		(value >>  0) & 0xFF,
+		(value >>  8) & 0xFF
+	};
+
+	return 0 <= value && value <= 0xFFFF &&
+		patch(encoder, offset, data, sizeof(data));
+}
+
+static bool encode_stream_cembone(
+	const struct pes_stream_encoder * const encoder,
+	const encode_buffer_callback encode_cb, void * const arg)
+{
+	/* FIXME: Bounds are not transformed, as with the PES encoder. */
+	return encode_cembone(&encoder->bounds,
+		&encoder->affine_transform, 0, 0, encoder->block_count,
+		encode_cb, arg);
+}
+static bool encode_header(struct pes_stream_encoder * const encoder)
+{
+	/* The PEC offset and CEmbOne are patched when finished. */
+	return encode_stream("#PES0001", 8, encoder) &&
+	       encode_i32lsb(0, encode_stream, encoder) &&
+	       encode_u16lsb(0x0000, encode_stream, encoder) && /* FIXME: Unknown data */
+	       encode_u16lsb(0x0001, encode_stream, encoder) && /* FIXME: Unknown data */
+	       encode_u16lsb(0x0001, encode_stream, encoder) && /* FIXME: Unknown data */
+	       encode_u16lsb(0xFFFF, encode_stream, encoder) && /* FIXME: Unknown data */
+	       encode_u16lsb(0x0000, encode_stream, encoder) && /* FIXME: Unknown data */
+	       encode_stream_cembone(encoder, encode_stream, encoder) &&
+	       encode_string("CSewSeg", encode_stream, encoder);
+}
+
+static bool patch_header(struct pes_stream_encoder * const encoder,
+	const int pec_offset)
+{
+	uint8_t data[128];
+	struct encode_buffer buffer;
+
+	encode_buffer_init_memory(&buffer, data, sizeof(data));
+	if (!encode_i32lsb(pec_offset, encode_buffer_write, &buffer) ||
+	    !patch(encoder, PEC_OFFSET, data, buffer.size))
+		return false;
+
+	/* CEmbOne is of fixed size, with bounds and block count. */
+	encode_buffer_init_memory(&buffer, data, sizeof(data));
+	return encode_stream_cembone(encoder, encode_buffer_write, &buffer) &&
+	       patch(encoder, PES_HEADER_SIZE, data, buffer.size);
+}
+
+static bool encode_block(struct pes_stream_encoder * const encoder,
+	const int thread_index)
+{
+	/* The stitch count is patched when the block is complete. */
+	if (!encode_block_header(PEC_STITCH_NORMAL, thread_index, 0,
+		encode_stream, encoder))
+		return false;
+
+	encoder->block_offset = encoder->offset - 2;
+	encoder->block_stitch_count = 0;
+
+	return true;
+}
+
+static bool encode_stream_jump_block(struct pes_stream_encoder * const encoder,
+	const struct stitch * const a, const struct stitch * const b,
+	const int thread_index)
+{
+	return patch_u16lsb(encoder, encoder->block_offset,
+		       encoder->block_stitch_count) &&
+	       encode_jump_block(a, b, thread_index,
+		       encode_stream, encoder) &&
+	       encode_block(encoder, thread_index);
+}
+
+static bool encode_thread_list14(struct pes_stream_encoder * const encoder)
+{
+	void * const arg = encoder;
+
+	if (!encode_u16lsb(encoder->change_count, encode_stream, arg))
+		return false;
+
+	for (int i = 0; i < encoder->change_count; i++) {
+		const struct pec_thread thread =
+			encoder->thread_list[encoder->change_list[i]];
+
+		if (!encode_u16lsb(encoder->change_block[i], encode_stream, arg) ||
+		    !encode_u16lsb(encoder->palette_match(thread.rgb),
+			encode_stream, arg))
+			return false;
+	}
+
+	return encode_u16lsb(0, encode_stream, arg) &&
+	       encode_u16lsb(0, encode_stream, arg);
+}
+
+static int pec_room(const struct pes_stream_encoder * const encoder)
+{
+	/*
+	 * The 24-bit thumbnail offset of the PEC header limits stitch data.
+	 * The first stitch is relative to the bounds and takes at most 4
+	 * bytes, and the end marker 1 byte.
+	 */
+	return PEC_STITCH_SIZE_MAX - (4 + 1 + encoder->spill_size);
+}
+
+static bool append_stitch(struct pes_stream_encoder * const encoder,
+	const int thread_index, const float x, const float y, const bool jump)
+{
+	struct stitch stitch = { .x = 0 };
+	uint8_t data[3 + 4];
+	int size = 0;
+
+	if (!encoder->valid ||
+	    thread_index < 0 || encoder->thread_count <= thread_index ||
+	    !stitch_quantize(x, &stitch.x) || !stitch_quantize(y, &stitch.y))
+		return false;
+
+	const bool first = encoder->stitch_count == 0;
+	const bool thread_change = !first &&
+		thread_index != encoder->change_list[encoder->change_count - 1];
+	const bool block = !first && (thread_change || jump);
+	const struct stitch last = first ? stitch : encoder->last;
+
+	if ((first || thread_change) && encoder->change_count == PEC_MAX_THREADS)
+		return false;
+	if (!block && encoder->block_stitch_count == 0xFFFF)
+		return false;
+
+	/* Thread changes are jump stitches and jumps are trim stitches in PEC. */
+	const enum pec_stitch_type type = thread_change ? PEC_STITCH_JUMP :
+		jump ? PEC_STITCH_TRIM : PEC_STITCH_NORMAL;
+
+	if (!first) {
+		const int sx = stitch_delta_size(type, stitch.x - last.x);
+		const int sy = stitch_delta_size(type, stitch.y - last.y);
+
+		if (sx == 0 || sy == 0 ||
+		    pec_room(encoder) < (thread_change ? 3 : 0) + sx + sy)
+			return false;
+
+		/* Stops precede the stitches of the next PEC thread. */
+		if (thread_change) {
+			stitch_stop_encode(&data[size], &encoder->stop);
+			size += 3;
+		}
+
+		stitch_delta_encode(&data[size], type, stitch.x - last.x, sx);
+		size += sx;
+		stitch_delta_encode(&data[size], type, stitch.y - last.y, sy);
+		size += sy;
+	}
+
+	/* The encoding cannot continue once the sink or the spill has failed. */
+	encoder->valid = false;
+
+	if (!encode_spill(encoder, data, size))
+		return false;
+	if (first && !encode_block(encoder, thread_index))
+		return false;
+	if (block && !encode_stream_jump_block(encoder, &last, &stitch,
+		thread_index))
+		return false;
+	if (!encode_stitch(&stitch, encode_stream, encoder))
+		return false;
+
+	encoder->valid = true;
+
+	if (first || thread_change) {
+		encoder->change_block[encoder->change_count] = encoder->block_count;
+		encoder->change_list[encoder->change_count++] = thread_index;
+	}
+
+	/* Jump stitches are encoded as two blocks. */
+	if (first || block)
+		encoder->block_count += (first ? 1 : 2);
+
+	encoder->block_stitch_count++;
+
+	stitch.thread_index = encoder->change_count - 1;
+	stitch.type = type;
+
+	if (first)
+		encoder->first = stitch;
+	encoder->last = stitch;
+	encoder->stitch_count++;
+	stitch_bounds_update(&encoder->bounds, stitch.x, stitch.y);
+
+	return true;
+}
+
+static size_t append_chunk(struct pes_stream_encoder * const encoder,
+	const float * const xy, const size_t n)
+{
+	const int room = pec_room(encoder);
+	struct stitch_bounds bounds = encoder->bounds;
+	struct stitch last = encoder->last;
+	uint8_t pec[4 * STITCH_CHUNK];
+	uint8_t data[4 * STITCH_CHUNK];
+	int pec_size = 0;
+	size_t k = 0;
+
+	/* Stitches are appended up to the first that is invalid. */
+	for (; k < n && encoder->block_stitch_count + (int)k < 0xFFFF; k++) {
+		int16_t x, y;
+
+		if (!stitch_quantize(xy[2*k + 0], &x) ||
+		    !stitch_quantize(xy[2*k + 1], &y))
+			break;
+
+		const int sx = stitch_delta_size(PEC_STITCH_NORMAL, x - last.x);
+		const int sy = stitch_delta_size(PEC_STITCH_NORMAL, y - last.y);
+
+		if (sx == 0 || sy == 0 || room < pec_size + sx + sy)
+			break;
+
+		stitch_delta_encode(&pec[pec_size], PEC_STITCH_NORMAL,
+			x - last.x, sx);
+		pec_size += sx;
+		stitch_delta_encode(&pec[pec_size], PEC_STITCH_NORMAL,
+			y - last.y, sy);
+		pec_size += sy;
+
+		data[4*k + 0] = x & 0xFF;
+		data[4*k + 1] = (x >> 8) & 0xFF;
+		data[4*k + 2] = y & 0xFF;
+		data[4*k + 3] = (y >> 8) & 0xFF;
+
+		stitch_bounds_update(&bounds, x, y);
+		last.x = x;
+		last.y = y;
+	}
+
+	if (k == 0)
+		return 0;
+
+	/* The encoding cannot continue once the sink or the spill has failed. */
+	encoder->valid = encode_spill(encoder, pec, pec_size) &&
+		encode_stream(data, 4 * k, encoder);
+	if (!encoder->valid)
+		return 0;
+
+	last.type = PEC_STITCH_NORMAL;
+	encoder->last = last;
+	encoder->bounds = bounds;
+	encoder->stitch_count += (int)k;
+	encoder->block_stitch_count += (int)k;
+
+	return k;
+}
+
+static bool append_stitches(struct pes_stream_encoder * const encoder,
+	const int thread_index, const float * const xy, const size_t n,
+	const bool jump)
+{
+	if (n == 0)
+		return true;
+
+	if (!append_stitch(encoder, thread_index, xy[0], xy[1], jump))
+		return false;
+
+	/*
+	 * The remaining stitches are sewn with the thread of the first, in
+	 * the same block, so they are appended in chunks.
+	 */
+	for (size_t i = 1; i < n; ) {
+		const size_t m = n - i < STITCH_CHUNK ? n - i : STITCH_CHUNK;
+		const size_t k = append_chunk(encoder, &xy[2 * i], m);
+
+		if (k < m)
+			return false;
+
+		i += k;
+	}
+
+	return true;
+}
+
+static struct stitch_bounds pec_bounds(
+	const struct pes_stream_encoder * const encoder)
+{
+	struct stitch_bounds bounds = encoder->bounds;
+
+	/* Stop stitches are at the origin, which is included in the bounds. */
+	if (1 < encoder->change_count)
+		stitch_bounds_update(&bounds, 0, 0);
+
+	return bounds;
+}
+
+static int decode_delta(const uint8_t * const data, const int size,
+	int * const d, enum pec_stitch_type * const type)
+{
+	if (size < 1)
+		return 0;
+
+	if ((data[0] & 0x80) == 0) {
+		*d = (data[0] & 0x40) != 0 ? data[0] - 0x80 : data[0];
+		return 1;
+	}
+
+	if (size < 2)
+		return 0;
+
+	if ((data[0] & 0x20) != 0)
+		*type = PEC_STITCH_TRIM;
+	else if ((data[0] & 0x10) != 0)
+		*type = PEC_STITCH_JUMP;
+
+	*d = ((data[0] & 0x0F) << 8) | data[1];
+	if ((*d & 0x800) != 0)
+		*d -= 0x1000;
+
+	return 2;
+}
+
+static void draw_thumbnails(struct pec_thumbnail * const thumbnails,
+	const struct thumbnail_transform * const t,
+	const struct stitch * const stitches, const int count)
+{
+	/* The main thumbnail has all stitches, followed by those of threads. */
+	thumbnail_stitch_list(&thumbnails[0], t, stitches, count);
+
+	for (int i = 0, k; i < count; i = k) {
+		for (k = i + 1; k < count &&
+		     stitches[k].thread_index == stitches[i].thread_index; k++)
+			;
+
+		thumbnail_stitch_list(&thumbnails[1 + stitches[i].thread_index],
+			t, &stitches[i], k - i);
+	}
+}
+
+static bool encode_spilled_stitches(struct pes_stream_encoder * const encoder,
+	struct pec_thumbnail * const thumbnails,
+	const struct thumbnail_transform * const t)
+{
+	const struct pes_stream_spill * const spill = &encoder->spill;
+	struct stitch stitches[STITCH_CHUNK];
+	struct stitch stitch = encoder->first;
+	uint8_t data[SPILL_CHUNK];
+	int stitch_count = 1;
+	int count = 0;
+	int size = 0;
+	int i = 0;
+
+	stitches[count++] = stitch;
+
+	/*
+	 * Spilled data is copied to the sink and parsed into stitches to draw
+	 * the thumbnails, a chunk at a time. The last stitch of each chunk is
+	 * carried over since lines are drawn between consecutive stitches.
+	 */
+	for (int offset = 0; i < size || offset < encoder->spill_size; ) {
+		/* Stops and stitches of up to 4 bytes may straddle chunks. */
+		if (size - i < 4 && offset < encoder->spill_size) {
+			const int remaining = encoder->spill_size - offset;
+			const int n = remaining < SPILL_CHUNK - (size - i) ?
+				remaining : SPILL_CHUNK - (size - i);
+
+			memmove(data, &data[i], size - i);
+			size -= i;
+			i = 0;
+
+			if (!spill->read_cb(offset, &data[size], n, spill->arg) ||
+			    !encode_stream(&data[size], n, encoder))
+				return false;
+
+			offset += n;
+			size += n;
+		}
+
+		if (data[i] == 0xFE) {
+			if (size - i < 3 ||
+			    encoder->change_count <= stitch.thread_index + 1)
+				return false;
+
+			stitch.thread_index++;
+			i += 3;
+			continue;
+		}
+
+		enum pec_stitch_type type = PEC_STITCH_NORMAL;
+		int dx, dy;
+		const int sx = decode_delta(&data[i], size - i, &dx, &type);
+		const int sy = sx == 0 ? 0 :
+			decode_delta(&data[i + sx], size - i - sx, &dy, &type);
+
+		if (sy == 0)
+			return false;
+
+		i += sx + sy;
+
+		if (count == STITCH_CHUNK) {
+			draw_thumbnails(thumbnails, t, stitches, count);
+			stitches[0] = stitches[count - 1];
+			count = 1;
+		}
+
+		stitch.x += dx;
+		stitch.y += dy;
+		stitch.type = type;
+		stitches[count++] = stitch;
+		stitch_count++;
+	}
+
+	draw_thumbnails(thumbnails, t, stitches, count);
+
+	/* The spill is expected to read back exactly as it was written. */
+	return stitch_count == encoder->stitch_count &&
+	       stitch.thread_index == encoder->change_count - 1;
+}
+
+static bool encode_pec(struct pes_stream_encoder * const encoder)
+{
+	const struct stitch_bounds bounds = pec_bounds(encoder);
+	const struct stitch * const first = &encoder->first;
+	const int sx = stitch_delta_size(first->type, first->x - bounds.min_x);
+	const int sy = stitch_delta_size(first->type, first->y - bounds.min_y);
+	int palette[PEC_MAX_THREADS];
+	uint8_t data[4];
+
+	if (sx == 0 || sy == 0)
+		return false;
+
+	for (int i = 0; i < encoder->change_count; i++)
+		palette[i] = encoder->palette_match(
+			encoder->thread_list[encoder->change_list[i]].rgb);
+
+	/* The first stitch is relative to the bounds, and the spill follows. */
+	stitch_delta_encode(&data[0], first->type, first->x - bounds.min_x, sx);
+	stitch_delta_encode(&data[sx], first->type, first->y - bounds.min_y, sy);
+
+	if (!pec_encode_header(encoder->change_count, palette, &bounds,
+		sx + sy + encoder->spill_size + 1, encode_stream, encoder) ||
+	    !encode_stream(data, sx + sy, encoder) ||
+	    !encode_buffer_flush(&encoder->spill_buffer, true))
+		return false;
+
+	/* Thumbnails follow the stitch data, so they are drawn as it is copied. */
+	const struct thumbnail_transform t = thumbnail_transform(&bounds);
+	struct pec_thumbnail * const thumbnails = allocate_zero(
+		&encoder->allocator, encoder->change_count + 1,
+		sizeof(*thumbnails));
+	bool valid = thumbnails != NULL &&
+		encode_spilled_stitches(encoder, thumbnails, &t) &&
+		encode_u8(0xFF, encode_stream, encoder);
+
+	for (int i = 0; valid && i <= encoder->change_count; i++) {
+		thumbnail_frame(&thumbnails[i]);
+		valid = encode_stream(&thumbnails[i], sizeof(thumbnails[i]),
+			encoder);
+	}
+
+	deallocate(&encoder->allocator, thumbnails);
+
+	return valid;
+}
+
+struct pes_stream_encoder *pes_stream_encoder_init(
+	const struct pes_stream_sink sink,
+	const struct pes_stream_spill spill)
+{
+	return pes_stream_encoder_init_with_allocator(sink, spill,
+		allocator_global());
+}
+
+struct pes_stream_encoder *pes_stream_encoder_init_with_allocator(
+	const struct pes_stream_sink sink,
+	const struct pes_stream_spill spill,
+	const struct libpes_allocator * const allocator)
+{
+	if (allocator == NULL)
+		return pes_stream_encoder_init_with_allocator(sink, spill,
+			allocator_global());
+	if (!allocator_valid(allocator))
+		return NULL;
+
+	if (sink.write_cb == NULL || sink.patch_cb == NULL ||
+	    spill.write_cb == NULL || spill.read_cb == NULL)
+		return NULL;
+
+	struct pes_stream_encoder * const encoder =
+		allocate_zero(allocator, 1, sizeof(*encoder));
+
+	if (encoder == NULL)
+		return NULL;
+
+	encoder->allocator = *allocator;
+	encoder->sink = sink;
+	encoder->spill = spill;
+	encoder->stop = 2;
+	encoder->affine_transform.matrix[0][0] = 1.0f;
+	encoder->affine_transform.matrix[1][1] = 1.0f;
+	encoder->palette_match = pec_palette_index_by_rgb;
+
+	encode_buffer_init(&encoder->buffer, &encoder->allocator,
+		ENCODE_BUFFER_SIZE, sink.write_cb, sink.arg);
+	encode_buffer_init(&encoder->spill_buffer, &encoder->allocator,
+		ENCODE_BUFFER_SIZE, spill.write_cb, spill.arg);
+
+	/* Patching data in place requires a buffer. */
+	if (encoder->buffer.capacity == 0 || !encode_header(encoder)) {
+		pes_stream_encoder_free(encoder);
+		return NULL;
+	}
+
+	encoder->valid = true;
+
+	return encoder;
+}
+
+void pes_stream_encoder_free(struct pes_stream_encoder * const encoder)
+{
+	if (encoder != NULL) {
+		encode_buffer_flush(&encoder->buffer, false);
+		encode_buffer_flush(&encoder->spill_buffer, false);
+		deallocate(&encoder->allocator, encoder);
+	}
+}
+bool pes_stream_append_thread(struct pes_stream_encoder * const encoder,
+	const struct pec_thread thread)
+{
+	if (PES_MAX_THREADS <= encoder->thread_count)
+		return false;
+
+	encoder->thread_list[encoder->thread_count++] = thread;
+
+	return true;
+}
+
+bool pes_stream_encoder_palette_match(
+	struct pes_stream_encoder * const encoder,
+	const pec_palette_match palette_match)
+{
+	if (encoder->thread_count != 0)
+		return false;
+
+	encoder->palette_match = palette_match;
+
+	return true;
+}
+
+bool pes_stream_append_stitch(struct pes_stream_encoder * const encoder,
+	const int thread_index, const float x, const float y)
+{
+	return append_stitch(encoder, thread_index, x, y, false);
+}
+
+bool pes_stream_append_jump_stitch(struct pes_stream_encoder * const encoder,
+	const int thread_index, const float x, const float y)
+{
+	return append_stitch(encoder, thread_index, x, y, true);
+}
+
+bool pes_stream_append_stitches(struct pes_stream_encoder * const encoder,
+	const int thread_index, const float * const xy, const size_t n,
+	const int flags)
+{
+	return append_stitches(encoder, thread_index, xy, n,
+		(flags & PES_APPEND_JUMP) != 0);
+}
+
+void pes_stream_encode_transform(struct pes_stream_encoder * const encoder,
+	const struct pes_transform affine_transform)
+{
+	memcpy(&encoder->affine_transform, &affine_transform,
+		sizeof(encoder->affine_transform));
+}
+
+
+bool pes_stream_encoder_finish(struct pes_stream_encoder * const encoder,
+	size_t * const size)
+{
+	const bool valid = encoder->valid && encoder->stitch_count != 0;
+
+	if (size != NULL)
+		*size = 0;
+
+	encoder->valid = false;
+
+	if (!valid ||
+	    !patch_u16lsb(encoder, encoder->block_offset,
+		encoder->block_stitch_count) ||
+	    !encode_thread_list14(encoder) ||
+	    INT_MAX/2 < encoder->offset)
+		return false;
+
+	const int pec_offset = (int)encoder->offset;
+
+	if (!encode_pec(encoder) ||
+	    !patch_header(encoder, pec_offset) ||
+	    !encode_buffer_flush(&encoder->buffer, true))
+		return false;
+
+	if (size != NULL)
+		*size = encoder->offset;
+
+	return true;
+}
@@ -95,7 +95,8 @@ bool pes_svg_emb_transcode(const void * const data, const size_t size,
 		.arg = arg
 	};
 
-	struct pes_decoder * const decoder = pes_decoder_init(data, size);
+	struct pes_decoder * const decoder =
+		pes_decoder_init_borrowed(data, size);
 
 	if (decoder == NULL || state.encoder == NULL ||
 	    !transcode_threads(decoder, &state) ||
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "pec-decoder.h"
+#include "stitch-kernel.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STITCH_KERNEL_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(STITCH_KERNEL_SSE2) && \
+	(defined(__GNUC__) || defined(__clang__)) && \
+	(defined(__x86_64__) || defined(__i386__))
+#define STITCH_KERNEL_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && defined(__BYTE_ORDER__) && \
+	__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define STITCH_KERNEL_NEON
+#include <arm_neon.h>
+#endif
+
+static void decode_scalar(const uint8_t * const data, const size_t count,
+	float * const x, float * const y)
+{
+	for (size_t i = 0; i < count; i++) {
+		const int16_t u = (int16_t)((data[4*i + 0] << 0) |
+		                            (data[4*i + 1] << 8));
+		const int16_t v = (int16_t)((data[4*i + 2] << 0) |
+		                            (data[4*i + 3] << 8));
+
+		x[i] = pec_physical_coordinate(u);
+		y[i] = pec_physical_coordinate(v);
+	}
+}
+
+/*
+ * The vector kernels convert as many stitches as their vector width allows
+ * and return the number of converted stitches. The remaining stitches are
+ * converted by the scalar kernel. On little-endian hosts each stitch is a
+ * 32-bit lane with the x coordinate in the low half and the y coordinate in
+ * the high half, so arithmetic shifts separate and sign-extend them.
+ */
+
+#if defined(STITCH_KERNEL_SSE2)
+static size_t decode_sse2(const uint8_t * const data, const size_t count,
+	float * const x, float * const y)
+{
+	const __m128 scale = _mm_set1_ps(0.1f);
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)&data[4*i]);
+		const __m128i u = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+		const __m128i w = _mm_srai_epi32(v, 16);
+
+		_mm_storeu_ps(&x[i], _mm_mul_ps(_mm_cvtepi32_ps(u), scale));
+		_mm_storeu_ps(&y[i], _mm_mul_ps(_mm_cvtepi32_ps(w), scale));
+	}
+
+	return i;
+}
+#endif
+
+#if defined(STITCH_KERNEL_AVX2)
+__attribute__((target("avx2")))
+static size_t decode_avx2(const uint8_t * const data, const size_t count,
+	float * const x, float * const y)
+{
+	const __m256 scale = _mm256_set1_ps(0.1f);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		const __m256i v = _mm256_loadu_si256((const __m256i *)&data[4*i]);
+		const __m256i u = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+		const __m256i w = _mm256_srai_epi32(v, 16);
+
+		_mm256_storeu_ps(&x[i], _mm256_mul_ps(_mm256_cvtepi32_ps(u), scale));
+		_mm256_storeu_ps(&y[i], _mm256_mul_ps(_mm256_cvtepi32_ps(w), scale));
+	}
+
+	/*
+	 * Unoptimised builds do not clear the upper halves of AVX registers,
+	 * which otherwise slows down subsequent SSE code considerably.
+	 */
+	_mm256_zeroupper();
+
+	return i;
+}
+#endif
+
+#if defined(STITCH_KERNEL_NEON)
+static size_t decode_neon(const uint8_t * const data, const size_t count,
+	float * const x, float * const y)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		const int16x8x2_t v = vld2q_s16((const int16_t *)&data[4*i]);
+
+		vst1q_f32(&x[i + 0], vmulq_n_f32(vcvtq_f32_s32(
+			vmovl_s16(vget_low_s16(v.val[0]))), 0.1f));
+		vst1q_f32(&x[i + 4], vmulq_n_f32(vcvtq_f32_s32(
+			vmovl_s16(vget_high_s16(v.val[0]))), 0.1f));
+		vst1q_f32(&y[i + 0], vmulq_n_f32(vcvtq_f32_s32(
+			vmovl_s16(vget_low_s16(v.val[1]))), 0.1f));
+		vst1q_f32(&y[i + 4], vmulq_n_f32(vcvtq_f32_s32(
+			vmovl_s16(vget_high_s16(v.val[1]))), 0.1f));
+	}
+
+	return i;
+}
+#endif
+
+#if !defined(STITCH_KERNEL_SSE2) && !defined(STITCH_KERNEL_NEON)
+static size_t decode_none(const uint8_t * const data, const size_t count,
+	float * const x, float * const y)
+{
+	return 0;
+}
+#endif
+
+stitch_kernel stitch_kernel_select()
+{
+#if defined(STITCH_KERNEL_AVX2)
+	if (__builtin_cpu_supports("avx2"))
+		return decode_avx2;
+#endif
+#if defined(STITCH_KERNEL_SSE2)
+	return decode_sse2;
+#elif defined(STITCH_KERNEL_NEON)
+	return decode_neon;
+#else
+	return decode_none;
+#endif
+}
+
+void stitch_kernel_decode(const stitch_kernel kernel,
+	const uint8_t * const data, const size_t count,
+	float * const x, float * const y)
+{
+	float u[64], v[64];
+	size_t i = 0;
+
+	if (x != NULL && y != NULL) {
+		i = kernel(data, count, x, y);
+		decode_scalar(&data[4*i], count - i, &x[i], &y[i]);
+		return;
+	}
+
+	/* Convert in chunks when only one of the coordinates is wanted. */
+	for (; i < count; i += 64) {
+		const size_t n = count - i < 64 ? count - i : 64;
+		const size_t k = kernel(&data[4*i], n, u, v);
+
+		decode_scalar(&data[4*(i + k)], n - k, &u[k], &v[k]);
+
+		for (size_t j = 0; j < n; j++) {
+			if (x != NULL)
+				x[i + j] = u[j];
+			if (y != NULL)
+				y[i + j] = v[j];
+		}
+	}
+}
+
+/*
+ * The SSE2 delta kernel sign-extends 16 bytes of 7-bit deltas at once, and
+ * widens them into 32-bit lanes of a 16-bit x and a 16-bit y delta each, so
+ * the prefix sums of both coordinates are computed together. Eight deltas
+ * cannot overflow the 16-bit prefix sums, which are separated by arithmetic
+ * shifts before adding the preceding coordinate.
+ */
+
+#if defined(STITCH_KERNEL_SSE2)
+static size_t delta_run_sse2(const uint8_t * const data, const size_t count,
+	int * const x, int * const y, const int x0, const int y0)
+{
+	const __m128i bias = _mm_set1_epi8(0x40);
+	__m128i cx = _mm_set1_epi32(x0), cy = _mm_set1_epi32(y0);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)&data[2*i]);
+		const int mask = _mm_movemask_epi8(v);
+		const __m128i d = _mm_sub_epi8(_mm_xor_si128(v, bias), bias);
+		__m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(d, d), 8);
+		__m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(d, d), 8);
+
+		lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 4));
+		hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 4));
+		lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 8));
+		hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 8));
+		hi = _mm_add_epi16(hi,
+			_mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 3, 3, 3)));
+
+		const __m128i hx = _mm_add_epi32(cx,
+			_mm_srai_epi32(_mm_slli_epi32(hi, 16), 16));
+		const __m128i hy = _mm_add_epi32(cy, _mm_srai_epi32(hi, 16));
+
+		_mm_storeu_si128((__m128i *)&x[i + 0], _mm_add_epi32(cx,
+			_mm_srai_epi32(_mm_slli_epi32(lo, 16), 16)));
+		_mm_storeu_si128((__m128i *)&x[i + 4], hx);
+		_mm_storeu_si128((__m128i *)&y[i + 0], _mm_add_epi32(cy,
+			_mm_srai_epi32(lo, 16)));
+		_mm_storeu_si128((__m128i *)&y[i + 4], hy);
+
+		/*
+		 * Stitches following a byte with the most significant bit set
+		 * are discarded, and the run ends with the preceding stitch.
+		 */
+		if (mask != 0) {
+			int k = 0;
+
+			while ((mask & (3 << 2*k)) == 0)
+				k++;
+			return i + k;
+		}
+
+		cx = _mm_shuffle_epi32(hx, _MM_SHUFFLE(3, 3, 3, 3));
+		cy = _mm_shuffle_epi32(hy, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+
+	return i;
+}
+#endif
+
+size_t stitch_kernel_delta_run(const uint8_t * const data, const size_t count,
+	int * const x, int * const y, const int x0, const int y0)
+{
+	size_t i = 0;
+	int u = x0, v = y0;
+
+#if defined(STITCH_KERNEL_SSE2)
+	i = delta_run_sse2(data, count, x, y, x0, y0);
+	if (i + 8 <= count)
+		return i; /* The run ended before the last eight stitches. */
+	if (i > 0) {
+		u = x[i - 1];
+		v = y[i - 1];
+	}
+#endif
+
+	for (; i < count && ((data[2*i] | data[2*i + 1]) & 0x80) == 0; i++) {
+		/* Sign extend 7-bit two's complement deltas. */
+		x[i] = u += (data[2*i + 0] ^ 0x40) - 0x40;
+		y[i] = v += (data[2*i + 1] ^ 0x40) - 0x40;
+	}
+
+	return i;
+}
+
+void stitch_kernel_physical(const int * const c, const size_t count,
+	float * const p)
+{
+	size_t i = 0;
+
+#if defined(STITCH_KERNEL_SSE2)
+	const __m128 scale = _mm_set1_ps(0.1f);
+
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(&p[i], _mm_mul_ps(_mm_cvtepi32_ps(
+			_mm_loadu_si128((const __m128i *)&c[i])), scale));
+#elif defined(STITCH_KERNEL_NEON)
+	for (; i + 4 <= count; i += 4)
+		vst1q_f32(&p[i], vmulq_n_f32(vcvtq_f32_s32(
+			vld1q_s32(&c[i])), 0.1f));
+#endif
+
+	for (; i < count; i++)
+		p[i] = pec_physical_coordinate(c[i]);
+}
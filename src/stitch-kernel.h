@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PESLIB_STITCH_KERNEL_H
+#define PESLIB_STITCH_KERNEL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Kernel converting a prefix of CSewSeg stitches into physical coordinates.
+ *
+ * @param data Stitch data of 4 bytes per stitch.
+ * @param count Number of stitches to convert.
+ * @param x X coordinates of stitches [millimeter].
+ * @param y Y coordinates of stitches [millimeter].
+ * @return Number of converted stitches, the remaining being left to the
+ * scalar fallback.
+ */
+typedef size_t (*stitch_kernel)(const uint8_t * const data,
+	const size_t count, float * const x, float * const y);
+
+/**
+ * Select the SSE2, AVX2 or NEON kernel depending on the CPU. Decoders
+ * select their kernel once when created, so no state is shared between
+ * threads.
+ *
+ * @return Stitch kernel for `stitch_kernel_decode()`.
+ */
+stitch_kernel stitch_kernel_select();
+
+/**
+ * Convert CSewSeg stitches, stored as little-endian signed 16-bit x and y
+ * pairs, into physical coordinates, using the given kernel with a scalar
+ * fallback. The results are identical to `pec_physical_coordinate()` for
+ * all kernels.
+ *
+ * @param kernel Kernel selected by `stitch_kernel_select()`.
+ * @param data Stitch data of 4 bytes per stitch. The caller is responsible
+ * for bounds checking.
+ * @param count Number of stitches to convert.
+ * @param x X coordinates of stitches [millimeter]. Ignored if NULL.
+ * @param y Y coordinates of stitches [millimeter]. Ignored if NULL.
+ */
+void stitch_kernel_decode(const stitch_kernel kernel,
+	const uint8_t * const data, const size_t count,
+	float * const x, float * const y);
+
+/**
+ * Decode a run of PEC stitches where both coordinates are 1-byte forms,
+ * that is 7-bit two's complement deltas with the most significant bit
+ * clear. The run ends before the first byte with the most significant bit
+ * set, or after the given number of stitches. The SSE2 kernel decodes eight
+ * stitches at a time, with a scalar fallback.
+ *
+ * @param data Stitch data of 2 bytes per stitch. The caller is responsible
+ * for bounds checking at least `2 * count` bytes.
+ * @param count Maximum number of stitches to decode.
+ * @param x Raw x coordinates of stitches. Entries beyond the returned
+ * number of stitches, but less than count, may be overwritten.
+ * @param y Raw y coordinates of stitches, likewise.
+ * @param x0 Raw x coordinate preceding the run.
+ * @param y0 Raw y coordinate preceding the run.
+ * @return Number of decoded stitches.
+ */
+size_t stitch_kernel_delta_run(const uint8_t * const data, const size_t count,
+	int * const x, int * const y, const int x0, const int y0);
+
+/**
+ * Convert raw PEC coordinates into physical coordinates. The SSE2 and NEON
+ * kernels convert four coordinates at a time, with a scalar fallback. The
+ * results are identical to `pec_physical_coordinate()`.
+ *
+ * @param c Raw coordinates.
+ * @param count Number of coordinates to convert.
+ * @param p Physical coordinates [millimeter].
+ */
+void stitch_kernel_physical(const int * const c, const size_t count,
+	float * const p);
+
+#endif /* PESLIB_STITCH_KERNEL_H */
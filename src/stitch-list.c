@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+
+#include "allocate.h"
+#include "pec-encoder.h"
+#include "stitch-list.h"
+
+void stitch_bounds_update(struct stitch_bounds * const bounds,
+	const int x, const int y)
+{
+	if (!bounds->valid) {
+		bounds->min_x = x;
+		bounds->min_y = y;
+		bounds->max_x = x;
+		bounds->max_y = y;
+		bounds->valid = true;
+	} else {
+		if (x < bounds->min_x)
+			bounds->min_x = x;
+		if (y < bounds->min_y)
+			bounds->min_y = y;
+		if (x > bounds->max_x)
+			bounds->max_x = x;
+		if (y > bounds->max_y)
+			bounds->max_y = y;
+	}
+}
+
+static void update_bounds_xy(struct stitch_bounds * const bounds,
+	const float * const xy, const size_t n)
+{
+	float min[4] = { xy[0], xy[1], xy[0], xy[1] };
+	float max[4] = { xy[0], xy[1], xy[0], xy[1] };
+	size_t i = 0;
+
+	/* Four independent lanes of x and y pairs vectorise well. */
+	for (; i + 4 <= 2 * n; i += 4)
+		for (int k = 0; k < 4; k++) {
+			min[k] = xy[i + k] < min[k] ? xy[i + k] : min[k];
+			max[k] = xy[i + k] > max[k] ? xy[i + k] : max[k];
+		}
+	for (; i < 2 * n; i += 2)
+		for (int k = 0; k < 2; k++) {
+			min[k] = xy[i + k] < min[k] ? xy[i + k] : min[k];
+			max[k] = xy[i + k] > max[k] ? xy[i + k] : max[k];
+		}
+
+	/* Quantization is monotonic so bounds can be quantized afterwards. */
+	for (int k = 0; k < 4; k += 2) {
+		stitch_bounds_update(bounds, pec_raw_coordinate(min[k + 0]),
+			pec_raw_coordinate(min[k + 1]));
+		stitch_bounds_update(bounds, pec_raw_coordinate(max[k + 0]),
+			pec_raw_coordinate(max[k + 1]));
+	}
+}
+
+int stitch_delta_size(const enum pec_stitch_type type, const int d)
+{
+	return d < -0x800 || 0x7FF < d ? 0 :
+		type == PEC_STITCH_NORMAL && -0x40 <= d && d <= 0x3F ? 1 : 2;
+}
+
+void stitch_delta_encode(uint8_t * const data,
+	const enum pec_stitch_type type, const int d, const int size)
+{
+	if (size == 1) {
+		data[0] = d & 0x7F;
+	} else {
+		data[0] = ((d >> 8) & 0xF) | 0x80 |
+			(type == PEC_STITCH_TRIM ? 0x20 :
+			 type == PEC_STITCH_JUMP ? 0x10 : 0x00);
+		data[1] = d & 0xFF;
+	}
+}
+
+void stitch_stop_encode(uint8_t * const data, int * const stop)
+{
+	data[0] = 0xFE;
+	data[1] = 0xB0;
+	data[2] = *stop;
+	*stop = 3 - *stop; /* FIXME: Why alternate between 2 and 1? */
+}
+
+static int cache_delta_size(struct stitch * const stitch,
+	const struct stitch * const previous)
+{
+	const int sx = stitch_delta_size(stitch->type, stitch->x - previous->x);
+	const int sy = stitch_delta_size(stitch->type, stitch->y - previous->y);
+
+	stitch->delta_size = (uint8_t)(sx | (sy << 2));
+
+	return sx == 0 || sy == 0 ? -1 : sx + sy;
+}
+
+static void update_delta_size(struct stitch_list * const list,
+	const int64_t size)
+{
+	if (size < 0 || INT_MAX/2 - list->delta_size < size)
+		list->delta_overflow = true;
+	else
+		list->delta_size += (int)size;
+}
+
+bool stitch_quantize(const float c, int16_t * const raw)
+{
+	/* Compare first since NaN and huge values cannot be converted. */
+	if (!(-4000.0f < c && c < 4000.0f))
+		return false;
+
+	const int r = pec_raw_coordinate(c);
+
+	if (r < -0x8000 || 0x7FFF < r)
+		return false;
+
+	*raw = (int16_t)r;
+
+	return true;
+}
+
+static bool raw_coordinate(const int32_t c, int16_t * const raw)
+{
+	if (c < -0x8000 || 0x7FFF < c)
+		return false;
+
+	*raw = (int16_t)c;
+
+	return true;
+}
+
+static bool resize(struct stitch_list * const list, const int capacity)
+{
+	struct stitch * const stitches = reallocate(list->allocator,
+		list->stitches, (size_t)capacity * sizeof(*stitches));
+
+	if (stitches == NULL)
+		return false;
+
+	list->stitches = stitches;
+	list->capacity = capacity;
+
+	return true;
+}
+
+bool stitch_list_reserve(struct stitch_list * const list,
+	const size_t capacity)
+{
+	if (capacity <= (size_t)list->capacity)
+		return true;
+
+	if (INT_MAX/2 <= capacity)
+		return false;
+
+	return resize(list, (int)capacity);
+}
+
+bool stitch_list_grow(struct stitch_list * const list, const size_t count)
+{
+	if (count <= (size_t)(list->capacity - list->count))
+		return true;
+
+	if ((size_t)(INT_MAX/2 - list->count) <= count)
+		return false;
+
+	/* Grow geometrically to append in amortised constant time. */
+	const int size = list->count + (int)count;
+	const int growth = list->capacity == 0 ? 100 : 2 * list->capacity;
+
+	return resize(list, size < growth && growth < INT_MAX/2 ? growth : size);
+}
+
+bool stitch_list_append(struct stitch_list * const list,
+	const int thread_index, const enum pec_stitch_type type,
+	const float x, const float y)
+{
+	struct stitch stitch = {
+		.thread_index = (uint8_t)thread_index,
+		.type = (uint8_t)type
+	};
+
+	if (!stitch_quantize(x, &stitch.x) || !stitch_quantize(y, &stitch.y) ||
+	    !stitch_list_grow(list, 1))
+		return false;
+
+	if (list->count != 0)
+		update_delta_size(list,
+			cache_delta_size(&stitch, &list->stitches[list->count - 1]));
+
+	list->stitches[list->count++] = stitch;
+	stitch_bounds_update(&list->bounds, stitch.x, stitch.y);
+
+	return true;
+}
+
+bool stitch_list_append_xy(struct stitch_list * const list,
+	const int thread_index, const enum pec_stitch_type type,
+	const float * const xy, const size_t n)
+{
+	if (!stitch_list_grow(list, n))
+		return false;
+
+	if (n == 0)
+		return true;
+
+	/* Stitches are quantized beyond the end until all of them are valid. */
+	struct stitch * const stitches = &list->stitches[list->count];
+	int64_t size = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		stitches[i] = (struct stitch){
+			.thread_index = (uint8_t)thread_index,
+			.type = (uint8_t)type
+		};
+
+		if (!stitch_quantize(xy[2*i + 0], &stitches[i].x) ||
+		    !stitch_quantize(xy[2*i + 1], &stitches[i].y))
+			return false;
+
+		if (i != 0 || list->count != 0) {
+			const int s = cache_delta_size(&stitches[i], &stitches[i - 1]);
+
+			size = s < 0 || size < 0 ? -1 : size + s;
+		}
+	}
+
+	update_delta_size(list, size);
+	update_bounds_xy(&list->bounds, xy, n);
+	list->count += (int)n;
+
+	return true;
+}
+
+bool stitch_list_append_raw(struct stitch_list * const list,
+	const int thread_index, const enum pec_stitch_type type,
+	const int32_t * const xy, const size_t n)
+{
+	if (!stitch_list_grow(list, n))
+		return false;
+
+	/* Stitches are stored beyond the end until all of them are valid. */
+	struct stitch * const stitches = &list->stitches[list->count];
+	int64_t size = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		stitches[i] = (struct stitch){
+			.thread_index = (uint8_t)thread_index,
+			.type = (uint8_t)type
+		};
+
+		if (!raw_coordinate(xy[2*i + 0], &stitches[i].x) ||
+		    !raw_coordinate(xy[2*i + 1], &stitches[i].y))
+			return false;
+
+		if (i != 0 || list->count != 0) {
+			const int s = cache_delta_size(&stitches[i], &stitches[i - 1]);
+
+			size = s < 0 || size < 0 ? -1 : size + s;
+		}
+	}
+
+	for (size_t i = 0; i < n; i++)
+		stitch_bounds_update(&list->bounds,
+			stitches[i].x, stitches[i].y);
+	update_delta_size(list, size);
+	list->count += (int)n;
+
+	return true;
+}
+
+void stitch_list_clear(struct stitch_list * const list)
+{
+	list->count = 0;
+	list->bounds.valid = false;
+	list->delta_size = 0;
+	list->delta_overflow = false;
+}
+
+void stitch_list_free(struct stitch_list * const list)
+{
+	deallocate(list->allocator, list->stitches);
+	list->stitches = NULL;
+	list->count = 0;
+	list->capacity = 0;
+	list->bounds.valid = false;
+	list->delta_size = 0;
+	list->delta_overflow = false;
+}
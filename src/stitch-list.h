@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PESLIB_STITCH_LIST_H
+#define PESLIB_STITCH_LIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "allocator.h"
+#include "pec.h"
+
+struct stitch_bounds {
+	int min_x;
+	int min_y;
+	int max_x;
+	int max_y;
+	bool valid;
+};
+
+/**
+ * Stitch shared by the PES and PEC encoders, quantized to raw PEC
+ * coordinates when appended. Stop stitches are not stored but implied by
+ * thread index changes between stitches, one stop for each index increment.
+ * The sizes of PEC deltas from the previous stitch are computed when
+ * appended as well, and are zero for the first stitch or if out of range.
+ * The type and the delta sizes share a byte, making a stitch 6 bytes.
+ */
+struct stitch {
+	int16_t x;              /* Raw X coordinate [0.1 mm]. */
+	int16_t y;              /* Raw Y coordinate [0.1 mm]. */
+	uint8_t thread_index;   /* PEC thread index. */
+	uint8_t type : 2;       /* Normal, jump or trim stitch. */
+	uint8_t delta_size : 4; /* PEC delta sizes, X in bits 0-1, Y in 2-3. */
+};
+
+struct stitch_list {
+	const struct libpes_allocator *allocator; /* Allocator of stitches. */
+	struct stitch_bounds bounds;
+
+	/*
+	 * Total size of PEC deltas of all stitches but the first, which is
+	 * relative to the bounds. Overflow is set if any delta is out of range
+	 * or if the total is too large.
+	 */
+	int delta_size;
+	bool delta_overflow;
+
+	int count;
+	int capacity;
+	struct stitch *stitches;
+};
+
+/**
+ * Return size of a PEC stitch delta.
+ *
+ * @param type Type of stitch.
+ * @param d Delta of raw coordinate [0.1 mm].
+ * @return Size of delta in bytes, 1 or 2, or zero if it is out of range.
+ */
+int stitch_delta_size(const enum pec_stitch_type type, const int d);
+
+/**
+ * Encode a PEC stitch delta.
+ *
+ * @param data Encoded delta of the given size.
+ * @param type Type of stitch, which is flagged in deltas of 2 bytes.
+ * @param d Delta of raw coordinate [0.1 mm].
+ * @param size Size of delta given by `stitch_delta_size()`, 1 or 2.
+ */
+void stitch_delta_encode(uint8_t * const data,
+	const enum pec_stitch_type type, const int d, const int size);
+
+/**
+ * Encode a PEC stop stitch of 3 bytes.
+ *
+ * @param data Encoded stop stitch.
+ * @param stop Marker of stop, 2 for the first, alternating with 1.
+ */
+void stitch_stop_encode(uint8_t * const data, int * const stop);
+
+/**
+ * Extend bounds to include a point.
+ *
+ * @param bounds Bounds to extend, or to set if not valid.
+ * @param x Raw X coordinate [0.1 mm].
+ * @param y Raw Y coordinate [0.1 mm].
+ */
+void stitch_bounds_update(struct stitch_bounds * const bounds,
+	const int x, const int y);
+
+/**
+ * Quantize a coordinate to a raw PEC coordinate.
+ *
+ * @param c Coordinate [millimeter].
+ * @param raw Raw coordinate [0.1 mm].
+ * @return True if the coordinate was successfully quantized, else false if
+ * it is out of range of raw PEC coordinates.
+ */
+bool stitch_quantize(const float c, int16_t * const raw);
+
+/**
+ * Reserve capacity for a total number of stitches, exactly.
+ *
+ * @param list Stitch list.
+ * @param capacity Total number of stitches.
+ * @return True if capacity was successfully reserved, else false.
+ */
+bool stitch_list_reserve(struct stitch_list * const list,
+	const size_t capacity);
+
+/**
+ * Grow capacity geometrically for additional stitches, as needed.
+ *
+ * @param list Stitch list.
+ * @param count Number of additional stitches.
+ * @return True if capacity was successfully grown, else false.
+ */
+bool stitch_list_grow(struct stitch_list * const list, const size_t count);
+
+/**
+ * Append a stitch.
+ *
+ * @param list Stitch list.
+ * @param thread_index PEC thread index of stitch.
+ * @param type Type of stitch.
+ * @param x X coordinate of stitch [millimeter].
+ * @param y Y coordinate of stitch [millimeter].
+ * @return True if stitch was successfully appended, else false if it is
+ * out of range of raw PEC coordinates.
+ */
+bool stitch_list_append(struct stitch_list * const list,
+	const int thread_index, const enum pec_stitch_type type,
+	const float x, const float y);
+
+/**
+ * Append stitches of the same thread index and type.
+ *
+ * @param list Stitch list.
+ * @param thread_index PEC thread index of stitches.
+ * @param type Type of stitches.
+ * @param xy Interleaved X and Y coordinates of stitches [millimeter].
+ * @param n Number of stitches.
+ * @return True if all stitches were successfully appended, else false in
+ * which case none of them were appended, for example if a stitch is out
+ * of range of raw PEC coordinates.
+ */
+bool stitch_list_append_xy(struct stitch_list * const list,
+	const int thread_index, const enum pec_stitch_type type,
+	const float * const xy, const size_t n);
+
+/**
+ * Append stitches of the same thread index and type using raw PEC
+ * coordinates, stored as given without conversion.
+ *
+ * @param list Stitch list.
+ * @param thread_index PEC thread index of stitches.
+ * @param type Type of stitches.
+ * @param xy Interleaved raw X and Y coordinates of stitches [0.1 mm].
+ * @param n Number of stitches.
+ * @return True if all stitches were successfully appended, else false in
+ * which case none of them were appended, for example if a stitch is out
+ * of range of raw PEC coordinates.
+ */
+bool stitch_list_append_raw(struct stitch_list * const list,
+	const int thread_index, const enum pec_stitch_type type,
+	const int32_t * const xy, const size_t n);
+
+/**
+ * Remove all stitches, keeping their capacity.
+ *
+ * @param list Stitch list.
+ */
+void stitch_list_clear(struct stitch_list * const list);
+
+/**
+ * Free stitches of list.
+ *
+ * @param list Stitch list. Its stitches are freed but not the list itself.
+ */
+void stitch_list_free(struct stitch_list * const list);
+
+#endif /* PESLIB_STITCH_LIST_H */
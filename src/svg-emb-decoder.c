@@ -22,17 +22,20 @@
 #include <string.h>
 #include <ctype.h>
 
+#include "allocate.h"
 #include "svg-emb-decoder.h"
 #include "pes.h"
 #include "sax.h"
 
 struct svg_emb_decoder {
+	struct libpes_allocator allocator;
 	const char *text;
 
 	struct pes_transform affine_transform;
 
 	int thread_count;
 	struct pec_thread thread_list[PES_MAX_THREADS];
+	pec_palette_match palette_match;
 };
 
 struct svg_emb_thread_state {
@@ -135,7 +138,7 @@ static bool parse_color(const struct sax_token color,
 	if (find_thread_index(state->decoder, rgb) == -1) {
 		/* FIXME: Can the thread assignment be improved? */
 
-		const int palette_index = pec_palette_index_by_rgb(rgb);
+		const int palette_index = state->decoder->palette_match(rgb);
 		const struct pec_thread p = pec_palette_thread(palette_index);
 		struct pec_thread * const c = &state->decoder->
 			thread_list[state->decoder->thread_count];
@@ -341,13 +344,38 @@ static bool init_threads(struct svg_emb_decoder * const decoder,
 struct svg_emb_decoder *svg_emb_decoder_init(const char * const text,
 	const sax_error_callback error_cb, void * const arg)
 {
+	return svg_emb_decoder_init_palette(text, pec_palette_index_by_rgb,
+		error_cb, arg);
+}
+
+struct svg_emb_decoder *svg_emb_decoder_init_palette(const char * const text,
+	const pec_palette_match palette_match,
+	const sax_error_callback error_cb, void * const arg)
+{
+	return svg_emb_decoder_init_with_allocator(text, palette_match,
+		allocator_global(), error_cb, arg);
+}
+
+struct svg_emb_decoder *svg_emb_decoder_init_with_allocator(
+	const char * const text, const pec_palette_match palette_match,
+	const struct libpes_allocator * const allocator,
+	const sax_error_callback error_cb, void * const arg)
+{
+	if (allocator == NULL)
+		return svg_emb_decoder_init_with_allocator(text, palette_match,
+			allocator_global(), error_cb, arg);
+	if (!allocator_valid(allocator))
+		return NULL;
+
 	const size_t length = strlen(text);
 	struct svg_emb_decoder * const decoder =
-		calloc(1, sizeof(*decoder) + length + 1);
+		allocate_zero(allocator, 1, sizeof(*decoder) + length + 1);
 
 	if (decoder != NULL) {
+		decoder->allocator = *allocator;
 		decoder->affine_transform.matrix[0][0] = 1.0f;
 		decoder->affine_transform.matrix[1][1] = 1.0f;
+		decoder->palette_match = palette_match;
 
 		decoder->text = (const char *)&decoder[1];
 		memcpy(&decoder[1], text, length + 1);
@@ -363,7 +391,8 @@ struct svg_emb_decoder *svg_emb_decoder_init(const char * const text,
 
 void svg_emb_decoder_free(struct svg_emb_decoder * const decoder)
 {
-	free(decoder);
+	if (decoder != NULL)
+		deallocate(&decoder->allocator, decoder);
 }
 
 struct pes_transform svg_emb_affine_transform(
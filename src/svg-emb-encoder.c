@@ -20,6 +20,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "allocate.h"
+#include "encode-buffer.h"
 #include "pes.h"
 #include "svg-emb-encoder.h"
 
@@ -41,6 +43,7 @@ struct svg_emb_bounds {
 };
 
 struct svg_emb_encoder {
+	struct libpes_allocator allocator;
 	struct svg_emb_bounds bounds;
 	struct pes_transform affine_transform;
 
@@ -50,6 +53,9 @@ struct svg_emb_encoder {
 	int stitch_count;
 	int stitch_capacity;
 	struct svg_emb_stitch *stitch_list;
+
+	size_t buffer_size;
+	uint8_t *buffer;
 };
 
 static bool encoded_size(const void * const data, const size_t size,
@@ -156,31 +162,34 @@ static bool encode_stitch_list(const struct svg_emb_encoder * const encoder,
 		encode_stitch_footer(encode_cb, arg);
 }
 
+static bool resize_stitch_list(struct svg_emb_encoder * const encoder,
+	const size_t capacity)
+{
+	if (INT_MAX/2 <= capacity)
+		return false;
+
+	struct svg_emb_stitch * const stitch_list = reallocate(&encoder->allocator,
+		encoder->stitch_list, capacity * sizeof(*stitch_list));
+
+	if (stitch_list == NULL)
+		return false;
+
+	encoder->stitch_list = stitch_list;
+	encoder->stitch_capacity = (int)capacity;
+
+	return true;
+}
+
 static bool append_stitch(struct svg_emb_encoder * const encoder,
 	const int thread_index, const float x, const float y, const bool jump)
 {
 	if (thread_index < 0 || encoder->thread_count <= thread_index)
 		return false;
 
-	if (encoder->stitch_capacity <= encoder->stitch_count) {
-		const int capacity = encoder->stitch_capacity +
-			(encoder->stitch_capacity == 0    ?   100 :
-			 10000 < encoder->stitch_capacity ? 10000 :
-			 encoder->stitch_capacity);
-
-		if (capacity < INT_MAX/2) {
-			struct svg_emb_stitch * const stitch_list =
-				realloc(encoder->stitch_list,
-					(size_t)capacity * sizeof(*stitch_list));
-
-			if (stitch_list != NULL) {
-				encoder->stitch_list = stitch_list;
-				encoder->stitch_capacity = capacity;
-			}
-		}
-	}
-
-	if (encoder->stitch_capacity <= encoder->stitch_count)
+	/* Grow geometrically to append in amortised constant time. */
+	if (encoder->stitch_capacity <= encoder->stitch_count &&
+	    !resize_stitch_list(encoder, encoder->stitch_capacity == 0 ? 100 :
+			2 * (size_t)encoder->stitch_capacity))
 		return false;
 
 	encoder->stitch_list[encoder->stitch_count] =
@@ -263,14 +272,37 @@ static bool encode_transform_footer(const struct svg_emb_encoder * const encoder
 	return encode_cb(footer, strlen(footer), arg);
 }
 
+static bool encode_sections(const struct svg_emb_encoder * const encoder,
+	const svg_emb_encode_callback encode_cb, void * const arg)
+{
+	return encode_header(encoder, encode_cb, arg) &&
+	       encode_transform_header(encoder, encode_cb, arg) &&
+	       encode_stitch_list(encoder, encode_cb, arg) &&
+	       encode_transform_footer(encoder, encode_cb, arg) &&
+	       encode_footer(encoder, encode_cb, arg);
+}
+
 struct svg_emb_encoder *svg_emb_encoder_init()
 {
+	return svg_emb_encoder_init_with_allocator(allocator_global());
+}
+
+struct svg_emb_encoder *svg_emb_encoder_init_with_allocator(
+	const struct libpes_allocator * const allocator)
+{
+	if (allocator == NULL)
+		return svg_emb_encoder_init_with_allocator(allocator_global());
+	if (!allocator_valid(allocator))
+		return NULL;
+
 	struct svg_emb_encoder * const encoder =
-		calloc(1, sizeof(struct svg_emb_encoder));
+		allocate_zero(allocator, 1, sizeof(struct svg_emb_encoder));
 
 	if (encoder != NULL) {
+		encoder->allocator = *allocator;
 		encoder->affine_transform.matrix[0][0] = 1.0f;
 		encoder->affine_transform.matrix[1][1] = 1.0f;
+		svg_emb_encoder_buffer_size(encoder, ENCODE_BUFFER_SIZE);
 	}
 
 	return encoder;
@@ -279,11 +311,22 @@ struct svg_emb_encoder *svg_emb_encoder_init()
 void svg_emb_encoder_free(struct svg_emb_encoder * const encoder)
 {
 	if (encoder != NULL) {
-		free(encoder->stitch_list);
-		free(encoder);
+		deallocate(&encoder->allocator, encoder->stitch_list);
+		deallocate(&encoder->allocator, encoder->buffer);
+		deallocate(&encoder->allocator, encoder);
 	}
 }
 
+void svg_emb_encoder_reset(struct svg_emb_encoder * const encoder)
+{
+	encoder->bounds.valid = false;
+	encoder->affine_transform = (struct pes_transform) {
+		.matrix = { { 1.0f, 0.0f }, { 0.0f, 1.0f }, { 0.0f, 0.0f } }
+	};
+	encoder->thread_count = 0;
+	encoder->stitch_count = 0;
+}
+
 bool svg_emb_append_thread(struct svg_emb_encoder * const encoder,
 	const struct pec_thread thread)
 {
@@ -295,6 +338,13 @@ bool svg_emb_append_thread(struct svg_emb_encoder * const encoder,
 	return true;
 }
 
+bool svg_emb_encoder_reserve(struct svg_emb_encoder * const encoder,
+	const size_t stitch_count)
+{
+	return stitch_count <= (size_t)encoder->stitch_capacity ||
+	       resize_stitch_list(encoder, stitch_count);
+}
+
 bool svg_emb_append_stitch(struct svg_emb_encoder * const encoder,
 	const int thread_index, const float x, const float y)
 {
@@ -314,21 +364,51 @@ void svg_emb_encode_transform(struct svg_emb_encoder * const encoder,
 		sizeof(encoder->affine_transform));
 }
 
+void svg_emb_encoder_buffer_size(struct svg_emb_encoder * const encoder,
+	const size_t size)
+{
+	deallocate(&encoder->allocator, encoder->buffer);
+	encoder->buffer = size != 0 ? allocate(&encoder->allocator, size) : NULL;
+	encoder->buffer_size = encoder->buffer != NULL ? size : 0;
+}
+
 bool svg_emb_encode(const struct svg_emb_encoder * const encoder,
 	const svg_emb_encode_callback encode_cb, void * const arg)
 {
-	return encode_header(encoder, encode_cb, arg) &&
-	       encode_transform_header(encoder, encode_cb, arg) &&
-	       encode_stitch_list(encoder, encode_cb, arg) &&
-	       encode_transform_footer(encoder, encode_cb, arg) &&
-	       encode_footer(encoder, encode_cb, arg);
+	struct encode_buffer buffer;
+
+	encode_buffer_init_staging(&buffer,
+		encoder->buffer, encoder->buffer_size, encode_cb, arg);
+
+	return encode_buffer_flush(&buffer,
+		encode_sections(encoder, encode_buffer_write, &buffer));
+}
+
+bool svg_emb_encode_into(const struct svg_emb_encoder * const encoder,
+	void * const dst, const size_t capacity, size_t * const written)
+{
+	struct encode_buffer buffer;
+
+	encode_buffer_init_memory(&buffer, dst, capacity);
+
+	if (encode_sections(encoder, encode_buffer_write, &buffer)) {
+		if (written != NULL)
+			*written = buffer.size;
+		return true;
+	}
+
+	/* The size is only counted when the capacity is insufficient. */
+	if (written != NULL)
+		*written = svg_emb_encode_size(encoder);
+
+	return false;
 }
 
 size_t svg_emb_encode_size(const struct svg_emb_encoder * const encoder)
 {
 	int size = 0;
 
-	if (!svg_emb_encode(encoder, encoded_size, &size))
+	if (!encode_sections(encoder, encoded_size, &size))
 		return 0;
 
 	return (size_t)size;
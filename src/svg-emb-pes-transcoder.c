@@ -94,6 +94,7 @@ static bool transcode_stitches(struct svg_emb_decoder * const decoder,
 static bool transcode(
 	bool (*pes_encode)(const struct pes_encoder * const encoder,
 		const pes_encode_callback encode_cb, void * const arg),
+	const pec_palette_match palette_match,
 	const char * const svg_emb_text,
 	const pes_encode_callback encode_cb,
 	const sax_error_callback error_cb, void * const arg)
@@ -104,8 +105,11 @@ static bool transcode(
 		.arg = arg
 	};
 
-	struct svg_emb_decoder * const decoder =
-		svg_emb_decoder_init(svg_emb_text, internal_error_cb, &state);
+	struct svg_emb_decoder * const decoder = svg_emb_decoder_init_palette(
+		svg_emb_text, palette_match, internal_error_cb, &state);
+
+	if (state.encoder != NULL)
+		pes_encoder_palette_match(state.encoder, palette_match);
 
 	if (decoder == NULL || state.encoder == NULL ||
 	    !transcode_threads(decoder, &state) ||
@@ -127,26 +131,39 @@ bool svg_emb_pes1_transcode(const char * const svg_emb_text,
 	const pes_encode_callback encode_cb,
 	const sax_error_callback error_cb, void * const arg)
 {
-	return transcode(pes_encode1, svg_emb_text, encode_cb, error_cb, arg);
+	return transcode(pes_encode1, pec_palette_index_by_rgb,
+		svg_emb_text, encode_cb, error_cb, arg);
+}
+
+bool svg_emb_pes1_transcode_palette(const char * const svg_emb_text,
+	const pec_palette_match palette_match,
+	const pes_encode_callback encode_cb,
+	const sax_error_callback error_cb, void * const arg)
+{
+	return transcode(pes_encode1, palette_match,
+		svg_emb_text, encode_cb, error_cb, arg);
 }
 
 bool svg_emb_pes4_transcode(const char * const svg_emb_text,
 	const pes_encode_callback encode_cb,
 	const sax_error_callback error_cb, void * const arg)
 {
-	return transcode(pes_encode4, svg_emb_text, encode_cb, error_cb, arg);
+	return transcode(pes_encode4, pec_palette_index_by_rgb,
+		svg_emb_text, encode_cb, error_cb, arg);
 }
 
 bool svg_emb_pes5_transcode(const char * const svg_emb_text,
 	const pes_encode_callback encode_cb,
 	const sax_error_callback error_cb, void * const arg)
 {
-	return transcode(pes_encode5, svg_emb_text, encode_cb, error_cb, arg);
+	return transcode(pes_encode5, pec_palette_index_by_rgb,
+		svg_emb_text, encode_cb, error_cb, arg);
 }
 
 bool svg_emb_pes6_transcode(const char * const svg_emb_text,
 	const pes_encode_callback encode_cb,
 	const sax_error_callback error_cb, void * const arg)
 {
-	return transcode(pes_encode6, svg_emb_text, encode_cb, error_cb, arg);
+	return transcode(pes_encode6, pec_palette_index_by_rgb,
+		svg_emb_text, encode_cb, error_cb, arg);
 }
@@ -0,0 +1,598 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "run-tests.h"
+
+#include "pec-decoder.h"
+#include "pec-encoder.h"
+#include "pes-decoder.h"
+#include "pes-encoder.h"
+
+#define STITCH_CAPACITY 1000
+
+struct buffer {
+	size_t size;
+	size_t capacity;
+	uint8_t *data;
+};
+
+struct stitch_list {
+	int count;
+	int block_count;
+	struct {
+		int block_index;
+		float x;
+		float y;
+		enum pec_stitch_type type;
+	} stitch[STITCH_CAPACITY];
+};
+
+static bool encode_buffer(const void * const data,
+	const size_t size, void * const arg)
+{
+	struct buffer * const buf = arg;
+
+	if (buf->capacity < buf->size + size)
+		return false;
+
+	memcpy(&buf->data[buf->size], data, size);
+	buf->size += size;
+
+	return true;
+}
+
+static struct pes_encoder *design_encoder()
+{
+	static const struct pec_thread threads[] = {
+		{ 0, "1", "000", "Prussian Blue", "A", {  26,  10, 148 } },
+		{ 1, "5", "000", "Red",           "A", { 236,   0,   0 } },
+		{ 2, "13", "000", "Yellow",       "A", { 255, 230,   0 } },
+	};
+	struct pes_encoder * const encoder = pes_encoder_init();
+
+	TEST_ASSERT(encoder != NULL);
+
+	for (int i = 0; i < 3; i++)
+		TEST_ASSERT(pes_append_thread(encoder, threads[i]));
+
+	for (int i = 0; i < 300; i++) {
+		const int thread_index = i / 100;
+		const float x = 0.1f * (float)((i * 37) % 400 - 200);
+		const float y = 0.1f * (float)((i * 53) % 300 - 150);
+
+		TEST_ASSERT((i % 50 == 0 && i != 0 ? pes_append_jump_stitch :
+			pes_append_stitch)(encoder, thread_index, x, y));
+	}
+
+	return encoder;
+}
+
+static struct buffer design_pes()
+{
+	struct pes_encoder * const encoder = design_encoder();
+	struct buffer pes = { .capacity = pes_encode1_size(encoder) };
+
+	pes.data = malloc(pes.capacity);
+	TEST_ASSERT(pes.data != NULL);
+	TEST_ASSERT(pes_encode1(encoder, encode_buffer, &pes));
+	TEST_ASSERT(pes.size == pes.capacity);
+
+	pes_encoder_free(encoder);
+
+	return pes;
+}
+
+static bool list_block(const struct pec_thread thread,
+	const int stitch_count, const enum pec_stitch_type stitch_type,
+	void * const arg)
+{
+	struct stitch_list * const list = arg;
+
+	list->block_count++;
+
+	return true;
+}
+
+static bool list_stitch(const int stitch_index,
+	const float x, const float y, void * const arg)
+{
+	struct stitch_list * const list = arg;
+
+	TEST_ASSERT(list->count < STITCH_CAPACITY);
+
+	list->stitch[list->count].block_index = list->block_count - 1;
+	list->stitch[list->count].x = x;
+	list->stitch[list->count].y = y;
+	list->count++;
+
+	return true;
+}
+
+static bool list_pec_stitch(const int stitch_index,
+	const float x, const float y, const enum pec_stitch_type stitch_type,
+	void * const arg)
+{
+	struct stitch_list * const list = arg;
+
+	TEST_ASSERT(list->count < STITCH_CAPACITY);
+
+	list->stitch[list->count].x = x;
+	list->stitch[list->count].y = y;
+	list->stitch[list->count].type = stitch_type;
+	list->count++;
+
+	return true;
+}
+
+static bool list_raw_stitch(const int stitch_index,
+	const int32_t x, const int32_t y, void * const arg)
+{
+	return list_stitch(stitch_index, (float)x, (float)y, arg);
+}
+
+static bool list_pec_raw_stitch(const int stitch_index,
+	const int32_t x, const int32_t y, const enum pec_stitch_type stitch_type,
+	void * const arg)
+{
+	return list_pec_stitch(stitch_index, (float)x, (float)y,
+		stitch_type, arg);
+}
+
+static bool list_pec_batch(const int stitch_index,
+	const float * const x, const float * const y,
+	const uint8_t * const stitch_type, const int count, void * const arg)
+{
+	struct stitch_list * const list = arg;
+
+	TEST_ASSERT(stitch_index == list->count);
+
+	for (int i = 0; i < count; i++)
+		if (!list_pec_stitch(stitch_index + i,
+				x[i], y[i], stitch_type[i], arg))
+			return false;
+
+	return true;
+}
+
+static bool test_block_info()
+{
+	struct buffer pes = design_pes();
+	struct pes_decoder * const decoder = pes_decoder_init(pes.data, pes.size);
+	struct stitch_list *list = calloc(1, sizeof(*list));
+
+	TEST_ASSERT(decoder != NULL);
+	TEST_ASSERT(list != NULL);
+	TEST_ASSERT(pes_stitch_foreach(decoder, list_block, list_stitch, list));
+	TEST_ASSERT(pes_block_count(decoder) == list->block_count);
+	TEST_ASSERT(pes_stitch_count(decoder) == list->count);
+
+	for (int i = 0, stitch_index = 0; i < pes_block_count(decoder); i++) {
+		const struct pes_block_info block = pes_block_info(decoder, i);
+
+		TEST_ASSERT(block.stitch_index == stitch_index);
+		stitch_index += block.stitch_count;
+	}
+
+	for (int i = 0; i < list->count; i++)
+		TEST_ASSERT(pes_stitch_block_index(decoder, i) ==
+			list->stitch[i].block_index);
+
+	TEST_ASSERT(pes_block_info(decoder, -1).stitch_count == 0);
+	TEST_ASSERT(pes_block_info(decoder, list->block_count).stitch_count == 0);
+	TEST_ASSERT(pes_stitch_block_index(decoder, -1) == -1);
+	TEST_ASSERT(pes_stitch_block_index(decoder, list->count) == -1);
+
+	free(list);
+	pes_decoder_free(decoder);
+	free(pes.data);
+
+	return true;
+}
+
+static bool test_block_stitches()
+{
+	struct buffer pes = design_pes();
+	struct pes_decoder * const decoder = pes_decoder_init(pes.data, pes.size);
+	struct stitch_list *list = calloc(1, sizeof(*list));
+	struct stitch_list *block = calloc(1, sizeof(*block));
+
+	TEST_ASSERT(decoder != NULL);
+	TEST_ASSERT(list != NULL && block != NULL);
+	TEST_ASSERT(pes_stitch_foreach(decoder, list_block, list_stitch, list));
+
+	/* Visit blocks backwards to exercise random access. */
+	for (int i = pes_block_count(decoder) - 1; i >= 0; i--) {
+		const struct pes_block_info info = pes_block_info(decoder, i);
+
+		block->count = 0;
+		block->block_count = i + 1;
+		TEST_ASSERT(pes_block_stitches(decoder, i, list_stitch, block));
+		TEST_ASSERT(block->count == info.stitch_count);
+
+		for (int k = 0; k < block->count; k++) {
+			const int stitch_index = info.stitch_index + k;
+
+			TEST_ASSERT(list->stitch[stitch_index].block_index == i);
+			TEST_ASSERT(list->stitch[stitch_index].x == block->stitch[k].x);
+			TEST_ASSERT(list->stitch[stitch_index].y == block->stitch[k].y);
+		}
+	}
+
+	TEST_ASSERT(!pes_block_stitches(decoder, -1, list_stitch, block));
+	TEST_ASSERT(!pes_block_stitches(decoder,
+		pes_block_count(decoder), list_stitch, block));
+
+	free(block);
+	free(list);
+	pes_decoder_free(decoder);
+	free(pes.data);
+
+	return true;
+}
+
+static bool test_block_decode_stitches()
+{
+	struct buffer pes = design_pes();
+	struct pes_decoder * const decoder = pes_decoder_init(pes.data, pes.size);
+	struct stitch_list *block = calloc(1, sizeof(*block));
+	float x[STITCH_CAPACITY], y[STITCH_CAPACITY];
+
+	TEST_ASSERT(decoder != NULL);
+	TEST_ASSERT(block != NULL);
+
+	for (int i = 0; i < pes_block_count(decoder); i++) {
+		const struct pes_block_info info = pes_block_info(decoder, i);
+
+		block->count = 0;
+		block->block_count = i + 1;
+		TEST_ASSERT(pes_block_stitches(decoder, i, list_stitch, block));
+		TEST_ASSERT(pes_block_decode_stitches(decoder, i,
+			x, y, STITCH_CAPACITY) == info.stitch_count);
+
+		for (int k = 0; k < block->count; k++) {
+			TEST_ASSERT(x[k] == block->stitch[k].x);
+			TEST_ASSERT(y[k] == block->stitch[k].y);
+		}
+
+		/* Odd capacities exercise the scalar tails of the kernels. */
+		memset(y, 0, sizeof(y));
+		TEST_ASSERT(pes_block_decode_stitches(decoder, i,
+			NULL, y, 7) == (info.stitch_count < 7 ? info.stitch_count : 7));
+		for (int k = 0; k < 7 && k < block->count; k++)
+			TEST_ASSERT(y[k] == block->stitch[k].y);
+	}
+
+	TEST_ASSERT(pes_block_decode_stitches(decoder, -1, x, y, 1) == 0);
+	TEST_ASSERT(pes_block_decode_stitches(decoder,
+		pes_block_count(decoder), x, y, 1) == 0);
+
+	free(block);
+	pes_decoder_free(decoder);
+	free(pes.data);
+
+	return true;
+}
+
+static bool test_stitch_counts()
+{
+	struct buffer pes = design_pes();
+	struct pes_decoder * const decoder = pes_decoder_init(pes.data, pes.size);
+
+	TEST_ASSERT(decoder != NULL);
+
+	struct pec_decoder * const pec = pes_pec_decoder(decoder);
+
+	TEST_ASSERT(pes_thread_count(decoder) == 3);
+	TEST_ASSERT(pes_stitch_type_count(decoder, PEC_STITCH_NORMAL) == 300);
+	TEST_ASSERT(pes_stitch_type_count(decoder, PEC_STITCH_JUMP) == 2 * 5);
+	TEST_ASSERT(pes_stitch_count(decoder) == 300 + 2 * 5);
+
+	for (int i = 0; i < 3; i++) {
+		TEST_ASSERT(pes_thread_stitch_count(decoder, i) > 100);
+		TEST_ASSERT(pec_thread_stitch_count(pec, i) == 100);
+	}
+	TEST_ASSERT(pes_thread_stitch_count(decoder, 3) == 0);
+	TEST_ASSERT(pes_thread_stitch_count(decoder, 0) +
+		    pes_thread_stitch_count(decoder, 1) +
+		    pes_thread_stitch_count(decoder, 2) ==
+		    pes_stitch_count(decoder));
+
+	TEST_ASSERT(pec_thread_count(pec) == 3);
+	TEST_ASSERT(pec_stitch_type_count(pec, PEC_STITCH_STOP) == 2);
+	TEST_ASSERT(pec_stitch_type_count(pec, PEC_STITCH_JUMP) == 2);
+	TEST_ASSERT(pec_stitch_type_count(pec, PEC_STITCH_TRIM) == 3);
+	TEST_ASSERT(pec_stitch_count(pec) == 300 + 2);
+	TEST_ASSERT(pec_stitch_count(pec) == 300 + 2); /* Cached */
+
+	pes_decoder_free(decoder);
+	free(pes.data);
+
+	return true;
+}
+
+static bool test_decode_stitches()
+{
+	struct buffer pes = design_pes();
+	struct pes_decoder * const decoder = pes_decoder_init(pes.data, pes.size);
+	struct stitch_list *list = calloc(1, sizeof(*list));
+	float x[STITCH_CAPACITY], y[STITCH_CAPACITY];
+	uint8_t type[STITCH_CAPACITY];
+	uint16_t thread[STITCH_CAPACITY];
+
+	TEST_ASSERT(decoder != NULL);
+	TEST_ASSERT(list != NULL);
+	TEST_ASSERT(pes_stitch_foreach(decoder, list_block, list_stitch, list));
+	TEST_ASSERT(pes_decode_stitches(decoder,
+		x, y, type, thread, STITCH_CAPACITY) == list->count);
+
+	for (int i = 0; i < list->count; i++) {
+		const struct pes_block_info block =
+			pes_block_info(decoder, list->stitch[i].block_index);
+
+		TEST_ASSERT(x[i] == list->stitch[i].x);
+		TEST_ASSERT(y[i] == list->stitch[i].y);
+		TEST_ASSERT(type[i] == block.stitch_type);
+		TEST_ASSERT(thread[i] == (block.thread.index < 0 ?
+			UINT16_MAX : block.thread.index));
+	}
+
+	/* Partial decoding into short buffers without types and threads. */
+	TEST_ASSERT(pes_decode_stitches(decoder, x, y, NULL, NULL, 75) == 75);
+	TEST_ASSERT(x[74] == list->stitch[74].x);
+
+	struct pec_decoder * const pec = pes_pec_decoder(decoder);
+
+	list->count = 0;
+	TEST_ASSERT(pec_stitch_foreach(pec, list_pec_stitch, list));
+	TEST_ASSERT(pec_decode_stitches(pec,
+		x, y, type, thread, STITCH_CAPACITY) == list->count);
+
+	for (int i = 0, thread_index = 0; i < list->count; i++) {
+		TEST_ASSERT(x[i] == list->stitch[i].x);
+		TEST_ASSERT(y[i] == list->stitch[i].y);
+		TEST_ASSERT(type[i] == list->stitch[i].type);
+		TEST_ASSERT(thread[i] == thread_index);
+
+		if (type[i] == PEC_STITCH_STOP)
+			thread_index++;
+	}
+
+	TEST_ASSERT(pec_decode_stitches(pec, NULL, y, NULL, NULL, 10) == 10);
+
+	free(list);
+	pes_decoder_free(decoder);
+	free(pes.data);
+
+	return true;
+}
+
+static bool test_foreach_raw()
+{
+	struct buffer pes = design_pes();
+	struct pes_decoder * const decoder = pes_decoder_init(pes.data, pes.size);
+	struct stitch_list *list = calloc(1, sizeof(*list));
+	struct stitch_list *raw = calloc(1, sizeof(*raw));
+
+	TEST_ASSERT(decoder != NULL);
+	TEST_ASSERT(list != NULL && raw != NULL);
+	TEST_ASSERT(pes_stitch_foreach(decoder, list_block, list_stitch, list));
+	TEST_ASSERT(pes_stitch_foreach_raw(decoder,
+		list_block, list_raw_stitch, raw));
+	TEST_ASSERT(raw->count == list->count);
+	TEST_ASSERT(raw->block_count == list->block_count);
+
+	for (int i = 0; i < list->count; i++) {
+		const int x = (int)raw->stitch[i].x, y = (int)raw->stitch[i].y;
+
+		TEST_ASSERT(raw->stitch[i].block_index ==
+			list->stitch[i].block_index);
+		TEST_ASSERT(pec_physical_coordinate(x) == list->stitch[i].x);
+		TEST_ASSERT(pec_physical_coordinate(y) == list->stitch[i].y);
+		TEST_ASSERT(pec_raw_coordinate(list->stitch[i].x) == x);
+		TEST_ASSERT(pec_raw_coordinate(list->stitch[i].y) == y);
+	}
+
+	struct pec_decoder * const pec = pes_pec_decoder(decoder);
+
+	list->count = raw->count = 0;
+	TEST_ASSERT(pec_stitch_foreach(pec, list_pec_stitch, list));
+	TEST_ASSERT(pec_stitch_foreach_raw(pec, list_pec_raw_stitch, raw));
+	TEST_ASSERT(raw->count == list->count);
+
+	for (int i = 0; i < list->count; i++) {
+		const int x = (int)raw->stitch[i].x, y = (int)raw->stitch[i].y;
+
+		TEST_ASSERT(raw->stitch[i].type == list->stitch[i].type);
+		TEST_ASSERT(pec_physical_coordinate(x) == list->stitch[i].x);
+		TEST_ASSERT(pec_physical_coordinate(y) == list->stitch[i].y);
+	}
+
+	/* Batches span the stitches of all threads. */
+	raw->count = 0;
+	TEST_ASSERT(pec_stitch_foreach_batch(pec, list_pec_batch, raw));
+	TEST_ASSERT(raw->count == list->count);
+
+	for (int i = 0; i < list->count; i++) {
+		TEST_ASSERT(raw->stitch[i].x == list->stitch[i].x);
+		TEST_ASSERT(raw->stitch[i].y == list->stitch[i].y);
+		TEST_ASSERT(raw->stitch[i].type == list->stitch[i].type);
+	}
+
+	free(raw);
+	free(list);
+	pes_decoder_free(decoder);
+	free(pes.data);
+
+	return true;
+}
+
+static bool test_thumbnail_bitmap()
+{
+	struct buffer pes = design_pes();
+	struct pes_decoder * const decoder = pes_decoder_init(pes.data, pes.size);
+
+	TEST_ASSERT(decoder != NULL);
+
+	struct pec_decoder * const pec = pes_pec_decoder(decoder);
+	const int w = pec_thumbnail_width(pec);
+	const int h = pec_thumbnail_height(pec);
+	const size_t stride = w + 3;
+	uint8_t * const bitmap1 = calloc(h, stride);
+	uint8_t * const bitmap8 = calloc(h, stride);
+
+	TEST_ASSERT(w > 0 && h > 0);
+	TEST_ASSERT(bitmap1 != NULL && bitmap8 != NULL);
+
+	for (int i = 0; i <= pec_thread_count(pec); i++) {
+		int set = 0;
+
+		TEST_ASSERT(pec_thumbnail_bitmap(pec, i,
+			bitmap1, stride, PEC_THUMBNAIL_1BPP));
+		TEST_ASSERT(pec_thumbnail_bitmap(pec, i,
+			bitmap8, stride, PEC_THUMBNAIL_8BPP));
+
+		for (int y = 0; y < h; y++)
+			for (int x = 0; x < w; x++) {
+				const bool pixel =
+					pec_thumbnail_pixel(pec, i, x, y);
+				const int bit = bitmap1[stride * y + x / 8] &
+					(1 << (x % 8));
+
+				TEST_ASSERT((bit != 0) == pixel);
+				TEST_ASSERT(bitmap8[stride * y + x] ==
+					(pixel ? 0xFF : 0));
+				set += pixel;
+			}
+
+		TEST_ASSERT(set > 0);
+	}
+
+	TEST_ASSERT(!pec_thumbnail_bitmap(pec, -1,
+		bitmap8, stride, PEC_THUMBNAIL_8BPP));
+	TEST_ASSERT(!pec_thumbnail_bitmap(pec, pec_thread_count(pec) + 1,
+		bitmap8, stride, PEC_THUMBNAIL_8BPP));
+	TEST_ASSERT(!pec_thumbnail_bitmap(pec, 1000,
+		bitmap8, stride, PEC_THUMBNAIL_8BPP));
+
+	free(bitmap8);
+	free(bitmap1);
+	pes_decoder_free(decoder);
+	free(pes.data);
+
+	return true;
+}
+
+static bool test_pec_truncated()
+{
+	struct buffer pes = design_pes();
+	const size_t pec_offset = pes.data[8] | (pes.data[9] << 8) |
+		(pes.data[10] << 16) | ((size_t)pes.data[11] << 24);
+	struct pec_decoder * const pec =
+		pec_decoder_init(&pes.data[pec_offset], pes.size - pec_offset);
+	struct stitch_list *list = calloc(1, sizeof(*list));
+	struct stitch_list *part = calloc(1, sizeof(*part));
+
+	TEST_ASSERT(pec != NULL);
+	TEST_ASSERT(list != NULL && part != NULL);
+	TEST_ASSERT(pec_stitch_foreach(pec, list_pec_stitch, list));
+
+	/*
+	 * Truncated stitch data must fail, after a prefix of the stitches
+	 * has been decoded, regardless of where the data is cut.
+	 */
+	for (size_t size = 534; ; size++) {
+		struct pec_decoder * const cut =
+			pec_decoder_init(&pes.data[pec_offset], size);
+		bool complete;
+
+		TEST_ASSERT(cut != NULL);
+		TEST_ASSERT(size < pes.size - pec_offset);
+		part->count = 0;
+		complete = pec_stitch_foreach(cut, list_pec_stitch, part);
+		TEST_ASSERT(pec_stitch_count(cut) == part->count);
+		TEST_ASSERT(part->count <= list->count);
+
+		for (int i = 0; i < part->count; i++) {
+			TEST_ASSERT(part->stitch[i].x == list->stitch[i].x);
+			TEST_ASSERT(part->stitch[i].y == list->stitch[i].y);
+			TEST_ASSERT(part->stitch[i].type == list->stitch[i].type);
+		}
+
+		pec_decoder_free(cut);
+
+		if (complete) {
+			TEST_ASSERT(part->count == list->count);
+			break;
+		}
+	}
+
+	free(part);
+	free(list);
+	pec_decoder_free(pec);
+	free(pes.data);
+
+	return true;
+}
+
+static bool test_borrowed()
+{
+	struct buffer pes = design_pes();
+	struct pes_decoder * const copied = pes_decoder_init(pes.data, pes.size);
+	struct pes_decoder * const borrowed =
+		pes_decoder_init_borrowed(pes.data, pes.size);
+
+	TEST_ASSERT(copied != NULL);
+	TEST_ASSERT(borrowed != NULL);
+	TEST_ASSERT(pes_stitch_count(copied) == pes_stitch_count(borrowed));
+	TEST_ASSERT(pes_block_count(copied) == pes_block_count(borrowed));
+	TEST_ASSERT(pec_stitch_count(pes_pec_decoder(copied)) ==
+		pec_stitch_count(pes_pec_decoder(borrowed)));
+	TEST_ASSERT(strcmp(pec_label(pes_pec_decoder(copied)),
+		pec_label(pes_pec_decoder(borrowed))) == 0);
+
+	pes_decoder_free(borrowed);
+
+	/* The copying decoder must not refer to the original data. */
+	memset(pes.data, 0, pes.size);
+	TEST_ASSERT(pes_stitch_count(copied) == 300 + 2 * 5);
+	TEST_ASSERT(pec_stitch_count(pes_pec_decoder(copied)) == 300 + 2);
+
+	pes_decoder_free(copied);
+	free(pes.data);
+
+	return true;
+}
+
+const struct test_entry test_suite_pes_decoder[] = {
+	TEST_ENTRY(test_block_info),
+	TEST_ENTRY(test_block_stitches),
+	TEST_ENTRY(test_block_decode_stitches),
+	TEST_ENTRY(test_stitch_counts),
+	TEST_ENTRY(test_decode_stitches),
+	TEST_ENTRY(test_foreach_raw),
+	TEST_ENTRY(test_thumbnail_bitmap),
+	TEST_ENTRY(test_pec_truncated),
+	TEST_ENTRY(test_borrowed),
+	TEST_ENTRY(NULL)
+};
@@ -0,0 +1,1281 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "run-tests.h"
+
+#include "allocator.h"
+#include "pec-decoder.h"
+#include "pec-encoder.h"
+#include "pes-decoder.h"
+#include "pes-encoder.h"
+#include "pes-stream-encoder.h"
+#include "svg-emb-encoder.h"
+
+struct buffer {
+	size_t size;
+	size_t capacity;
+	uint8_t *data;
+};
+
+static bool encode_buffer(const void * const data,
+	const size_t size, void * const arg)
+{
+	struct buffer * const buf = arg;
+
+	if (buf->capacity < buf->size + size)
+		return false;
+
+	memcpy(&buf->data[buf->size], data, size);
+	buf->size += size;
+
+	return true;
+}
+
+static void append_design(struct pes_encoder * const encoder,
+	const bool jumps)
+{
+	static const struct pec_thread threads[] = {
+		{ 0, "1", "000", "Prussian Blue", "A", {  26,  10, 148 } },
+		{ 1, "5", "000", "Red",           "A", { 236,   0,   0 } },
+		{ 2, "13", "000", "Yellow",       "A", { 255, 230,   0 } },
+	};
+
+	for (int i = 0; i < 3; i++)
+		TEST_ASSERT(pes_append_thread(encoder, threads[i]));
+
+	for (int i = 0; i < 300; i++) {
+		const int thread_index = i / 100;
+		const float x = 0.1f * (float)((i * 37) % 400 - 200);
+		const float y = 0.1f * (float)((i * 53) % 300 - 150);
+
+		TEST_ASSERT((jumps && i % 50 == 0 && i != 0 ?
+			pes_append_jump_stitch : pes_append_stitch)(
+				encoder, thread_index, x, y));
+	}
+}
+
+static struct pes_encoder *design_encoder(const bool jumps)
+{
+	struct pes_encoder * const encoder = pes_encoder_init();
+
+	TEST_ASSERT(encoder != NULL);
+	append_design(encoder, jumps);
+
+	return encoder;
+}
+
+static struct buffer encode_pes(const struct pes_encoder * const encoder)
+{
+	struct buffer pes = { .capacity = pes_encode1_size(encoder) };
+
+	TEST_ASSERT(pes.capacity > 0);
+	pes.data = malloc(pes.capacity);
+	TEST_ASSERT(pes.data != NULL);
+	TEST_ASSERT(pes_encode1(encoder, encode_buffer, &pes));
+	TEST_ASSERT(pes.size == pes.capacity);
+
+	return pes;
+}
+
+static bool test_encode_size()
+{
+	for (int jumps = 0; jumps <= 1; jumps++) {
+		struct pes_encoder * const encoder = design_encoder(jumps);
+		struct buffer pes = encode_pes(encoder);
+		struct pes_decoder * const decoder =
+			pes_decoder_init(pes.data, pes.size);
+
+		TEST_ASSERT(decoder != NULL);
+		TEST_ASSERT(pes_stitch_type_count(decoder,
+			PEC_STITCH_NORMAL) == 300);
+
+		/* Thread changes are encoded as jumps also without jumps. */
+		TEST_ASSERT(pes_stitch_type_count(decoder, PEC_STITCH_JUMP) ==
+			2 * (jumps ? 5 : 2));
+
+		for (int i = 0; i < 3; i++)
+			TEST_ASSERT(pec_thread_stitch_count(
+				pes_pec_decoder(decoder), i) == 100);
+
+		/* The size is updated when stitches are appended. */
+		TEST_ASSERT(pes_append_stitch(encoder, 2, 10.0f, 10.0f));
+		TEST_ASSERT(pes_encode1_size(encoder) > pes.size);
+
+		pes_decoder_free(decoder);
+		free(pes.data);
+		pes_encoder_free(encoder);
+	}
+
+	return true;
+}
+
+static bool test_pec_encode_size()
+{
+	struct pec_encoder * const pec = pec_encoder_init();
+	struct buffer buf = { 0 };
+
+	TEST_ASSERT(pec != NULL);
+	TEST_ASSERT(pec_encoded_size(pec) == 0); /* No threads. */
+	TEST_ASSERT(pec_append_thread(pec, 1));
+	TEST_ASSERT(pec_append_stitch(pec, 0.0f, 0.0f));
+	TEST_ASSERT(pec_append_stitch(pec, 10.0f, -10.0f));
+	TEST_ASSERT(pec_append_jump_stitch(pec, 100.0f, 0.0f));
+	TEST_ASSERT(pec_append_thread(pec, 2));
+	TEST_ASSERT(pec_append_trim_stitch(pec, 50.0f, 50.0f));
+
+	buf.capacity = pec_encoded_size(pec);
+	buf.data = malloc(buf.capacity);
+	TEST_ASSERT(buf.data != NULL);
+	TEST_ASSERT(pec_encode(pec, encode_buffer, &buf));
+	TEST_ASSERT(buf.size == buf.capacity);
+
+	struct pec_decoder * const decoder =
+		pec_decoder_init(buf.data, buf.size);
+
+	TEST_ASSERT(decoder != NULL);
+	TEST_ASSERT(pec_stitch_count(decoder) == 5);
+	TEST_ASSERT(pec_thread_count(decoder) == 2);
+
+	/* Deltas beyond 12 bits cannot be encoded. */
+	TEST_ASSERT(pec_append_stitch(pec, 300.0f, 0.0f));
+	TEST_ASSERT(pec_encoded_size(pec) == 0);
+	TEST_ASSERT(!pec_encode(pec, encode_buffer, &buf));
+
+	/* Delta sizes are maintained when appended, and cleared by resets. */
+	const float xy[] = { 0.0f, 0.0f, 204.7f, 204.7f, -1.0f, -1.0f };
+	pec_encoder_reset(pec);
+	TEST_ASSERT(pec_append_thread(pec, 1));
+	TEST_ASSERT(pec_append_stitches(pec, xy, 2));
+	TEST_ASSERT(pec_encoded_size(pec) > 0);
+	TEST_ASSERT(pec_append_stitches(pec, &xy[4], 1));
+	TEST_ASSERT(pec_encoded_size(pec) == 0);
+	pec_encoder_reset(pec);
+	TEST_ASSERT(pec_append_thread(pec, 1));
+	TEST_ASSERT(pec_append_stitches(pec, xy, 2));
+	TEST_ASSERT(pec_encoded_size(pec) > 0);
+
+	pec_decoder_free(decoder);
+	free(buf.data);
+	pec_encoder_free(pec);
+
+	return true;
+}
+
+struct counted_buffer {
+	struct buffer buffer;
+	int count;
+	size_t max_size;
+};
+
+static bool encode_counted(const void * const data,
+	const size_t size, void * const arg)
+{
+	struct counted_buffer * const counted = arg;
+
+	counted->count++;
+	if (counted->max_size < size)
+		counted->max_size = size;
+
+	return encode_buffer(data, size, &counted->buffer);
+}
+
+static bool test_encode_buffer()
+{
+	struct pes_encoder * const encoder = design_encoder(true);
+	struct buffer pes = encode_pes(encoder);
+	const size_t sizes[] = { 0, 1, 16, 1000 };
+
+	/* The default buffer is large enough for a single callback. */
+	for (int i = -1; i < (int)(sizeof(sizes) / sizeof(*sizes)); i++) {
+		struct counted_buffer counted = {
+			.buffer = { .capacity = pes.size }
+		};
+
+		if (0 <= i)
+			pes_encoder_buffer_size(encoder, sizes[i]);
+
+		counted.buffer.data = malloc(pes.size);
+		TEST_ASSERT(counted.buffer.data != NULL);
+		TEST_ASSERT(pes_encode1(encoder, encode_counted, &counted));
+		TEST_ASSERT(counted.buffer.size == pes.size);
+		TEST_ASSERT(memcmp(counted.buffer.data, pes.data, pes.size) == 0);
+
+		if (i < 0)
+			TEST_ASSERT(counted.count == 1);
+		else if (sizes[i] == 1000)
+			TEST_ASSERT(counted.count <= (int)(pes.size / 1000 + 1) &&
+				counted.max_size <= 1000);
+		else if (sizes[i] == 0)
+			TEST_ASSERT(counted.count > (int)(pes.size / 4));
+
+		free(counted.buffer.data);
+	}
+
+	/* Callback failures are reported also when buffered. */
+	pes_encoder_buffer_size(encoder, 64);
+	struct buffer small = { .capacity = pes.size / 2 };
+	small.data = malloc(small.capacity);
+	TEST_ASSERT(small.data != NULL);
+	TEST_ASSERT(!pes_encode1(encoder, encode_buffer, &small));
+
+	free(small.data);
+	free(pes.data);
+	pes_encoder_free(encoder);
+
+	return true;
+}
+
+static bool test_encode_into()
+{
+	struct pes_encoder * const encoder = design_encoder(true);
+	struct svg_emb_encoder * const svg = svg_emb_encoder_init();
+	struct buffer pes = encode_pes(encoder);
+	uint8_t * const dst = malloc(pes.size);
+	size_t written = 0;
+
+	TEST_ASSERT(dst != NULL);
+	TEST_ASSERT(pes_encode1_into(encoder, dst, pes.size, &written));
+	TEST_ASSERT(written == pes.size);
+	TEST_ASSERT(memcmp(dst, pes.data, pes.size) == 0);
+
+	/* The required size is given when the capacity is insufficient. */
+	TEST_ASSERT(!pes_encode1_into(encoder, dst, pes.size - 1, &written));
+	TEST_ASSERT(written == pes.size);
+
+	struct pec_encoder * const pec = pec_encoder_init();
+	TEST_ASSERT(pec != NULL);
+	TEST_ASSERT(!pec_encode_into(pec, dst, pes.size, &written));
+	TEST_ASSERT(written == 0); /* No threads. */
+	TEST_ASSERT(pec_append_thread(pec, 1));
+	TEST_ASSERT(pec_append_stitch(pec, 10.0f, -10.0f));
+	TEST_ASSERT(!pec_encode_into(pec, dst, 10, &written));
+	TEST_ASSERT(written == pec_encoded_size(pec));
+	TEST_ASSERT(pec_encode_into(pec, dst, pes.size, &written));
+	TEST_ASSERT(written == pec_encoded_size(pec));
+
+	struct pec_decoder * const decoder = pec_decoder_init(dst, written);
+	TEST_ASSERT(decoder != NULL);
+	TEST_ASSERT(pec_stitch_count(decoder) == 1);
+
+	TEST_ASSERT(svg != NULL);
+	TEST_ASSERT(svg_emb_append_thread(svg, pec_palette_thread(1)));
+	TEST_ASSERT(svg_emb_append_stitch(svg, 0, 1.0f, 2.0f));
+	TEST_ASSERT(!svg_emb_encode_into(svg, dst, 10, &written));
+	TEST_ASSERT(written == svg_emb_encode_size(svg));
+	TEST_ASSERT(svg_emb_encode_into(svg, dst, pes.size, &written));
+	TEST_ASSERT(written == svg_emb_encode_size(svg));
+
+	pec_decoder_free(decoder);
+	pec_encoder_free(pec);
+	svg_emb_encoder_free(svg);
+	free(dst);
+	free(pes.data);
+	pes_encoder_free(encoder);
+
+	return true;
+}
+
+static bool test_append_stitches()
+{
+	struct pes_encoder * const single = design_encoder(false);
+	struct pes_encoder * const batch = design_encoder(false);
+	struct pes_encoder * const raw = design_encoder(false);
+	float xy[2 * 700];
+	int32_t rxy[2 * 700];
+
+	for (int i = 0; i < 700; i++) {
+		rxy[2*i + 0] = (i * 37) % 500 - 250;
+		rxy[2*i + 1] = (i * 53) % 300 - 150;
+		xy[2*i + 0] = pec_physical_coordinate(rxy[2*i + 0]);
+		xy[2*i + 1] = pec_physical_coordinate(rxy[2*i + 1]);
+	}
+
+	/* Batches changing thread, beginning with a jump, and plain. */
+	for (int b = 0; b < 3; b++) {
+		const int thread_index = b == 0 ? 0 : 1;
+		const int flags = b == 1 ? PES_APPEND_JUMP : 0;
+		const int offset = 100 * b;
+		const int n = b == 2 ? 500 : 100;
+
+		for (int i = 0; i < n; i++)
+			TEST_ASSERT((i == 0 && flags ? pes_append_jump_stitch :
+				pes_append_stitch)(single, thread_index,
+					xy[2 * (offset + i) + 0],
+					xy[2 * (offset + i) + 1]));
+		TEST_ASSERT(pes_append_stitches(batch, thread_index,
+			&xy[2 * offset], n, flags));
+		TEST_ASSERT(pes_append_stitches_raw(raw, thread_index,
+			&rxy[2 * offset], n, flags));
+	}
+
+	TEST_ASSERT(pes_append_stitches(batch, 0, xy, 0, 0));
+	TEST_ASSERT(!pes_append_stitches(batch, 3, xy, 1, 0));
+	TEST_ASSERT(!pes_append_stitches_raw(raw, 3, rxy, 1, 0));
+
+	struct buffer a = encode_pes(single);
+	struct buffer b = encode_pes(batch);
+	struct buffer c = encode_pes(raw);
+
+	TEST_ASSERT(a.size == b.size && memcmp(a.data, b.data, a.size) == 0);
+	TEST_ASSERT(a.size == c.size && memcmp(a.data, c.data, a.size) == 0);
+
+	free(a.data);
+	free(b.data);
+	free(c.data);
+	pes_encoder_free(single);
+	pes_encoder_free(batch);
+	pes_encoder_free(raw);
+
+	return true;
+}
+
+static bool test_encoder_reserve()
+{
+	struct pes_encoder * const reserved = pes_encoder_init();
+	struct pes_encoder * const encoder = design_encoder(false);
+	struct svg_emb_encoder * const svg = svg_emb_encoder_init();
+	struct pec_encoder * const pec = pec_encoder_init();
+
+	TEST_ASSERT(reserved != NULL && svg != NULL && pec != NULL);
+	TEST_ASSERT(pes_encoder_reserve(reserved, 300));
+	TEST_ASSERT(pec_encoder_reserve(pec, 300));
+	TEST_ASSERT(svg_emb_encoder_reserve(svg, 300));
+
+	/* Impossible reservations fail without affecting the encoders. */
+	TEST_ASSERT(!pes_encoder_reserve(reserved, SIZE_MAX));
+	TEST_ASSERT(!pec_encoder_reserve(pec, SIZE_MAX));
+	TEST_ASSERT(!svg_emb_encoder_reserve(svg, SIZE_MAX));
+
+	/* Reserving gives the same design as growing on demand. */
+	pes_encoder_free(reserved);
+	struct pes_encoder * const design = design_encoder(false);
+	TEST_ASSERT(pes_encoder_reserve(design, 100000));
+	struct buffer a = encode_pes(encoder);
+	struct buffer b = encode_pes(design);
+	TEST_ASSERT(a.size == b.size && memcmp(a.data, b.data, a.size) == 0);
+
+	for (int i = 0; i < 10000; i++)
+		TEST_ASSERT(pes_append_stitch(design, 0, 0.1f * (i % 100), 0.0f));
+	TEST_ASSERT(pes_encode1_size(design) > b.size);
+
+	free(a.data);
+	free(b.data);
+	pes_encoder_free(design);
+	pes_encoder_free(encoder);
+	svg_emb_encoder_free(svg);
+	pec_encoder_free(pec);
+
+	return true;
+}
+
+static bool test_quantized_append()
+{
+	struct pes_encoder * const encoder = design_encoder(false);
+	struct pec_encoder * const pec = pec_encoder_init();
+	const float xy[] = { 1.0f, 2.0f, 4000.0f, 0.0f };
+
+	TEST_ASSERT(pec != NULL);
+	TEST_ASSERT(pec_append_thread(pec, 1));
+
+	/* Stitches beyond 16-bit raw coordinates are rejected. */
+	TEST_ASSERT(pec_append_stitch(pec, 3276.7f, -3276.8f));
+	TEST_ASSERT(!pec_append_stitch(pec, 3276.8f, 0.0f));
+	TEST_ASSERT(!pec_append_stitch(pec, 0.0f, -3300.0f));
+	TEST_ASSERT(!pes_append_stitch(encoder, 0, 0.0f, 1e30f));
+	TEST_ASSERT(!pes_append_stitches(encoder, 0, xy, 2, 0));
+
+	/* Stitches are quantized to 0.1 mm when appended. */
+	TEST_ASSERT(pes_append_stitch(encoder, 2, 12.34f, -5.67f));
+
+	struct buffer pes = encode_pes(encoder);
+	struct pes_decoder * const decoder =
+		pes_decoder_init(pes.data, pes.size);
+	TEST_ASSERT(decoder != NULL);
+	const size_t n = (size_t)pes_stitch_count(decoder);
+	float * const x = malloc(n * sizeof(*x));
+	float * const y = malloc(n * sizeof(*y));
+
+	TEST_ASSERT(x != NULL && y != NULL);
+	TEST_ASSERT(pes_decode_stitches(decoder, x, y, NULL, NULL, n) == n);
+	TEST_ASSERT(x[n - 1] == pec_physical_coordinate(123));
+	TEST_ASSERT(y[n - 1] == pec_physical_coordinate(-57));
+
+	free(x);
+	free(y);
+
+	pes_decoder_free(decoder);
+	free(pes.data);
+	pec_encoder_free(pec);
+	pes_encoder_free(encoder);
+
+	return true;
+}
+
+/*
+ * Baseline thumbnail rendering, which sampled each line at 101 points in
+ * floating point, for a design consisting of a single line.
+ */
+static void sampled_line(bool pixels[38][48],
+	const float ax, const float ay, const float bx, const float by)
+{
+	const int margin = 5;
+	const float w = fabsf(bx - ax);
+	const float h = fabsf(by - ay);
+	const float cx = 0.5f * (ax + bx);
+	const float cy = 0.5f * (ay + by);
+	const float tx = 0.5f * (48 - 2 * margin);
+	const float ty = 0.5f * (38 - 2 * margin);
+	const float sw = 2.0f * tx / w;
+	const float sh = 2.0f * ty / h;
+	const float s = (sw < sh ? sw : sh);
+
+	for (int i = 0; i <= 100; i++) {
+		const float t = i / 100.0f;
+		const float x = (1.0f - t) * ax + t * bx;
+		const float y = (1.0f - t) * ay + t * by;
+		const int c = margin + (int)roundf(tx + (x - cx) * s);
+		const int r = margin + (int)roundf(ty + (y - cy) * s);
+
+		pixels[r][c] = true;
+	}
+}
+
+static bool test_thumbnail_line()
+{
+	/* Diagonal lines that do not cross columns or rows at half pixels. */
+	const float lines[][4] = {
+		{ 0.0f, 0.0f, 10.0f, 10.0f },
+		{ 0.0f, 10.0f, 10.0f, 0.0f },
+		{ 0.0f, 0.0f, 12.0f, 3.0f },
+		{ 0.0f, 0.0f, 3.0f, 11.0f },
+		{ 0.0f, 0.0f, 10.0f, 7.5f },
+	};
+
+	for (size_t i = 0; i < sizeof(lines) / sizeof(*lines); i++) {
+		struct pec_encoder * const encoder = pec_encoder_init();
+		bool sampled[38][48] = { { false } };
+		int min_c = INT16_MAX, max_c = -1;
+		int min_r = INT16_MAX, max_r = -1;
+		int count = 0;
+
+		TEST_ASSERT(encoder != NULL);
+		TEST_ASSERT(pec_append_thread(encoder, 1));
+		TEST_ASSERT(pec_append_stitch(encoder, lines[i][0], lines[i][1]));
+		TEST_ASSERT(pec_append_stitch(encoder, lines[i][2], lines[i][3]));
+
+		struct buffer pec = { .capacity = pec_encoded_size(encoder) };
+		pec.data = malloc(pec.capacity);
+		TEST_ASSERT(pec.data != NULL);
+		TEST_ASSERT(pec_encode(encoder, encode_buffer, &pec));
+
+		struct pec_decoder * const decoder =
+			pec_decoder_init(pec.data, pec.size);
+		TEST_ASSERT(decoder != NULL);
+		TEST_ASSERT(pec_thumbnail_width(decoder) == 48);
+		TEST_ASSERT(pec_thumbnail_height(decoder) == 38);
+
+		sampled_line(sampled, lines[i][0], lines[i][1],
+			lines[i][2], lines[i][3]);
+
+		/*
+		 * The line is drawn inside the frame, which is at most 4 pixels
+		 * wide. Every pixel is also drawn by the sampled rendering.
+		 */
+		for (int r = 5; r < 38 - 4; r++)
+		for (int c = 5; c < 48 - 4; c++) {
+			const bool p = pec_thumbnail_pixel(decoder, 0, c, r);
+
+			TEST_ASSERT(p == pec_thumbnail_pixel(decoder, 1, c, r));
+			if (!p)
+				continue;
+
+			TEST_ASSERT(sampled[r][c]);
+
+			min_c = c < min_c ? c : min_c;
+			max_c = c > max_c ? c : max_c;
+			min_r = r < min_r ? r : min_r;
+			max_r = r > max_r ? r : max_r;
+			count++;
+		}
+
+		/* Eight-connected lines have one pixel per major axis step. */
+		const int dc = max_c - min_c;
+		const int dr = max_r - min_r;
+		TEST_ASSERT(count == (dc > dr ? dc : dr) + 1);
+
+		pec_decoder_free(decoder);
+		free(pec.data);
+		pec_encoder_free(encoder);
+	}
+
+	return true;
+}
+
+static bool test_thumbnail_append()
+{
+	struct pec_encoder * const appended = pec_encoder_init();
+	struct pec_encoder * const encoder = pec_encoder_init();
+	const float xy[] = { 0.0f, 0.0f, 10.0f, 7.5f, -3.0f, 4.0f };
+
+	TEST_ASSERT(appended != NULL && encoder != NULL);
+	TEST_ASSERT(pec_append_thread(appended, 1));
+	TEST_ASSERT(pec_append_stitches(appended, xy, 2));
+
+	struct buffer a = { .capacity = pec_encoded_size(appended) };
+	a.data = malloc(a.capacity);
+	TEST_ASSERT(a.data != NULL);
+	TEST_ASSERT(pec_encode(appended, encode_buffer, &a));
+
+	/* Thumbnails encoded after appending include the appended stitches. */
+	TEST_ASSERT(pec_append_thread(appended, 5));
+	TEST_ASSERT(pec_append_stitches(appended, &xy[2], 2));
+	TEST_ASSERT(pec_append_thread(encoder, 1));
+	TEST_ASSERT(pec_append_stitches(encoder, xy, 2));
+	TEST_ASSERT(pec_append_thread(encoder, 5));
+	TEST_ASSERT(pec_append_stitches(encoder, &xy[2], 2));
+
+	struct buffer b = { .capacity = pec_encoded_size(encoder) };
+	b.data = malloc(b.capacity);
+	free(a.data);
+	a = (struct buffer){ .capacity = b.capacity, .data = malloc(b.capacity) };
+	TEST_ASSERT(a.data != NULL && b.data != NULL);
+	TEST_ASSERT(pec_encode(appended, encode_buffer, &a));
+	TEST_ASSERT(pec_encode(encoder, encode_buffer, &b));
+	TEST_ASSERT(a.size == b.size);
+	TEST_ASSERT(memcmp(a.data, b.data, a.size) == 0);
+
+	/* Repeated encodes give the same data. */
+	a.size = 0;
+	TEST_ASSERT(pec_encode(appended, encode_buffer, &a));
+	TEST_ASSERT(memcmp(a.data, b.data, a.size) == 0);
+
+	free(a.data);
+	free(b.data);
+	pec_encoder_free(encoder);
+	pec_encoder_free(appended);
+
+	return true;
+}
+
+static bool patch_buffer(const size_t offset, const void * const data,
+	const size_t size, void * const arg)
+{
+	struct buffer * const buf = arg;
+
+	if (buf->size < offset + size)
+		return false;
+
+	memcpy(&buf->data[offset], data, size);
+
+	return true;
+}
+
+static bool read_buffer(const size_t offset, void * const data,
+	const size_t size, void * const arg)
+{
+	const struct buffer * const buf = arg;
+
+	if (buf->size < offset + size)
+		return false;
+
+	memcpy(data, &buf->data[offset], size);
+
+	return true;
+}
+
+static bool test_stream_encoder()
+{
+	static const struct pec_thread threads[] = {
+		{ 0, "1", "000", "Prussian Blue", "A", {  26,  10, 148 } },
+		{ 1, "5", "000", "Red",           "A", { 236,   0,   0 } },
+	};
+	const int count = 30000; /* Beyond the size of stream buffers. */
+
+	for (int jumps = 0; jumps <= 1; jumps++) {
+		struct pes_encoder * const encoder = pes_encoder_init();
+		struct buffer stream = { .capacity = 256 * 1024 };
+		struct buffer spill = { .capacity = 256 * 1024 };
+		struct pes_stream_encoder * const streamer =
+			pes_stream_encoder_init((struct pes_stream_sink) {
+				encode_buffer, patch_buffer, &stream },
+				(struct pes_stream_spill) {
+				encode_buffer, read_buffer, &spill });
+		size_t size;
+
+		stream.data = malloc(stream.capacity);
+		spill.data = malloc(spill.capacity);
+		TEST_ASSERT(encoder != NULL && streamer != NULL);
+		TEST_ASSERT(stream.data != NULL && spill.data != NULL);
+
+		/* Palette matching is the same as for the PES encoder. */
+		if (jumps) {
+			TEST_ASSERT(pes_encoder_palette_match(encoder,
+				pec_palette_index_by_rgb_perceptual));
+			TEST_ASSERT(pes_stream_encoder_palette_match(streamer,
+				pec_palette_index_by_rgb_perceptual));
+		}
+
+		for (int i = 0; i < 2; i++) {
+			TEST_ASSERT(pes_append_thread(encoder, threads[i]));
+			TEST_ASSERT(pes_stream_append_thread(streamer, threads[i]));
+		}
+		TEST_ASSERT(!pes_stream_encoder_palette_match(streamer,
+			pec_palette_index_by_rgb));
+
+		for (int i = 0; i < count; i++) {
+			const int thread_index = (i / 1000) % 2;
+			const float x = 0.1f * (float)((i * 7) % 40 - 20);
+			const float y = 0.1f * (float)((i * 11) % 30 - 15 + i / 1000);
+			const bool jump = jumps && i % 50 == 0 && i != 0;
+
+			TEST_ASSERT((jump ? pes_append_jump_stitch :
+				pes_append_stitch)(encoder, thread_index, x, y));
+			TEST_ASSERT((jump ? pes_stream_append_jump_stitch :
+				pes_stream_append_stitch)(streamer, thread_index, x, y));
+		}
+
+		/* Invalid stitches are rejected without ending the stream. */
+		TEST_ASSERT(!pes_stream_append_stitch(streamer, 2, 0.0f, 0.0f));
+		TEST_ASSERT(!pes_stream_append_stitch(streamer, 0, 1e30f, 0.0f));
+
+		TEST_ASSERT(pes_stream_encoder_finish(streamer, &size));
+		TEST_ASSERT(!pes_stream_append_stitch(streamer, 0, 0.0f, 0.0f));
+
+		struct buffer pes = encode_pes(encoder);
+		TEST_ASSERT(size == stream.size);
+		TEST_ASSERT(pes.size == stream.size);
+		TEST_ASSERT(memcmp(pes.data, stream.data, pes.size) == 0);
+
+		free(pes.data);
+		free(spill.data);
+		free(stream.data);
+		pes_stream_encoder_free(streamer);
+		pes_encoder_free(encoder);
+	}
+
+	return true;
+}
+
+static bool test_stream_append_stitches()
+{
+	struct pes_encoder * const encoder = pes_encoder_init();
+	struct buffer stream = { .capacity = 256 * 1024 };
+	struct buffer spill = { .capacity = 256 * 1024 };
+	struct pes_stream_encoder * const streamer =
+		pes_stream_encoder_init((struct pes_stream_sink) {
+			encode_buffer, patch_buffer, &stream },
+			(struct pes_stream_spill) {
+			encode_buffer, read_buffer, &spill });
+	const size_t n = 1000; /* Spanning several chunks. */
+	float * const xy = malloc(2 * n * sizeof(*xy));
+	size_t size;
+
+	stream.data = malloc(stream.capacity);
+	spill.data = malloc(spill.capacity);
+	TEST_ASSERT(encoder != NULL && streamer != NULL);
+	TEST_ASSERT(stream.data != NULL && spill.data != NULL && xy != NULL);
+
+	for (int i = 0; i < 2; i++) {
+		TEST_ASSERT(pes_append_thread(encoder, pec_palette_thread(i + 1)));
+		TEST_ASSERT(pes_stream_append_thread(streamer,
+			pec_palette_thread(i + 1)));
+	}
+
+	for (int k = 0; k < 12; k++) {
+		const int flags = k % 3 == 2 ? PES_APPEND_JUMP : 0;
+
+		for (int i = 0; i < (int)n; i++) {
+			xy[2*i + 0] = 0.1f * (float)((i * 7 + k) % 40 - 20);
+			xy[2*i + 1] = 0.1f * (float)((i * 11) % 30 - 15 + k);
+		}
+
+		TEST_ASSERT(pes_append_stitches(encoder, k % 2, xy, n, flags));
+		TEST_ASSERT(pes_stream_append_stitches(streamer, k % 2, xy, n,
+			flags));
+	}
+
+	/* Stitches before an invalid one are appended. */
+	xy[2*300 + 0] = 1e30f;
+	TEST_ASSERT(!pes_stream_append_stitches(streamer, 1, xy, n, 0));
+	TEST_ASSERT(pes_append_stitches(encoder, 1, xy, 300, 0));
+
+	TEST_ASSERT(pes_stream_encoder_finish(streamer, &size));
+
+	struct buffer pes = encode_pes(encoder);
+	TEST_ASSERT(pes.size == stream.size);
+	TEST_ASSERT(memcmp(pes.data, stream.data, pes.size) == 0);
+
+	free(pes.data);
+	free(xy);
+	free(spill.data);
+	free(stream.data);
+	pes_stream_encoder_free(streamer);
+	pes_encoder_free(encoder);
+
+	return true;
+}
+
+static bool test_stream_encoder_large()
+{
+	struct pes_encoder * const encoder = pes_encoder_init();
+	struct buffer stream = { .capacity = 1024 * 1024 };
+	struct buffer spill = { .capacity = 1024 * 1024 };
+	struct pes_stream_encoder * const streamer =
+		pes_stream_encoder_init((struct pes_stream_sink) {
+			encode_buffer, patch_buffer, &stream },
+			(struct pes_stream_spill) {
+			encode_buffer, read_buffer, &spill });
+	const int count = 40000;
+	size_t size;
+
+	/* Both callbacks of the sink and the spill are required. */
+	TEST_ASSERT(pes_stream_encoder_init((struct pes_stream_sink) {
+		encode_buffer, NULL, &stream }, (struct pes_stream_spill) {
+		encode_buffer, read_buffer, &spill }) == NULL);
+	TEST_ASSERT(pes_stream_encoder_init((struct pes_stream_sink) {
+		encode_buffer, patch_buffer, &stream }, (struct pes_stream_spill) {
+		encode_buffer, NULL, &spill }) == NULL);
+
+	stream.data = malloc(stream.capacity);
+	spill.data = malloc(spill.capacity);
+	TEST_ASSERT(encoder != NULL && streamer != NULL);
+	TEST_ASSERT(stream.data != NULL && spill.data != NULL);
+
+	for (int i = 0; i < 2; i++) {
+		TEST_ASSERT(pes_append_thread(encoder, pec_palette_thread(i + 1)));
+		TEST_ASSERT(pes_stream_append_thread(streamer,
+			pec_palette_thread(i + 1)));
+	}
+
+	/* PEC stitch data of 4 bytes per stitch is well beyond 64 KiB. */
+	for (int i = 0; i < count; i++) {
+		const int thread_index = (i / 10000) % 2;
+		const float c = 10.0f * (i % 2) + 0.1f * (i / 1000);
+		const bool jump = i % 5000 == 0 && i != 0;
+
+		TEST_ASSERT((jump ? pes_append_jump_stitch :
+			pes_append_stitch)(encoder, thread_index, c, c));
+		TEST_ASSERT((jump ? pes_stream_append_jump_stitch :
+			pes_stream_append_stitch)(streamer, thread_index, c, c));
+	}
+
+	TEST_ASSERT(pes_stream_encoder_finish(streamer, &size));
+	TEST_ASSERT(4 * count < (int)spill.size);
+
+	struct buffer pes = encode_pes(encoder);
+	TEST_ASSERT(size == stream.size);
+	TEST_ASSERT(pes.size == stream.size);
+	TEST_ASSERT(memcmp(pes.data, stream.data, pes.size) == 0);
+
+	/*
+	 * The 24-bit thumbnail offset is decoded. PES jump blocks have two
+	 * stitches each, and PEC has three stops.
+	 */
+	struct pes_decoder * const decoder =
+		pes_decoder_init(stream.data, stream.size);
+	TEST_ASSERT(decoder != NULL);
+	TEST_ASSERT(pes_stitch_count(decoder) == count + 2 * 7);
+	TEST_ASSERT(pec_stitch_count(pes_pec_decoder(decoder)) == count + 3);
+	pes_decoder_free(decoder);
+	pes_stream_encoder_free(streamer);
+
+	/* The stream ends once the spill has failed. */
+	struct pes_stream_encoder * const failing =
+		pes_stream_encoder_init((struct pes_stream_sink) {
+			encode_buffer, patch_buffer, &stream },
+			(struct pes_stream_spill) {
+			encode_buffer, read_buffer, &spill });
+	int appended = 0;
+
+	stream.size = 0;
+	spill.size = 0;
+	spill.capacity = 100 * 1024;
+	TEST_ASSERT(failing != NULL);
+	TEST_ASSERT(pes_stream_append_thread(failing, pec_palette_thread(1)));
+	while (appended < 100000 && pes_stream_append_stitch(failing, 0,
+		10.0f * (appended % 2), 0.0f))
+		appended++;
+	TEST_ASSERT(appended < 100000);
+	TEST_ASSERT(!pes_stream_append_stitch(failing, 0, 0.0f, 0.0f));
+	TEST_ASSERT(!pes_stream_encoder_finish(failing, &size));
+	TEST_ASSERT(size == 0);
+	pes_stream_encoder_free(failing);
+
+	free(pes.data);
+	free(spill.data);
+	free(stream.data);
+	pes_encoder_free(encoder);
+
+	return true;
+}
+
+struct allocations {
+	int count;       /* Number of allocations and reallocations. */
+	int outstanding; /* Number of allocations not yet freed. */
+};
+
+static void *counted_alloc(const size_t size, void * const arg)
+{
+	struct allocations * const allocations = arg;
+
+	TEST_ASSERT(size != 0); /* Zero sizes are never allocated. */
+
+	void * const ptr = malloc(size);
+
+	if (ptr != NULL) {
+		allocations->count++;
+		allocations->outstanding++;
+	}
+
+	return ptr;
+}
+
+static void *counted_realloc(void * const ptr, const size_t size,
+	void * const arg)
+{
+	struct allocations * const allocations = arg;
+
+	TEST_ASSERT(size != 0);
+
+	void * const p = realloc(ptr, size);
+
+	if (p != NULL)
+		allocations->count++;
+	if (p != NULL && ptr == NULL)
+		allocations->outstanding++;
+
+	return p;
+}
+
+static void counted_free(void * const ptr, void * const arg)
+{
+	struct allocations * const allocations = arg;
+
+	allocations->outstanding--;
+	free(ptr);
+}
+
+static bool discard_buffer(const void * const data,
+	const size_t size, void * const arg)
+{
+	return true;
+}
+
+static bool discard_patch(const size_t offset, const void * const data,
+	const size_t size, void * const arg)
+{
+	return true;
+}
+
+static bool test_stream_encoder_limit()
+{
+	struct allocations allocations = { 0 };
+	const struct libpes_allocator allocator = {
+		.alloc_cb = counted_alloc,
+		.realloc_cb = counted_realloc,
+		.free_cb = counted_free,
+		.arg = &allocations
+	};
+	struct pes_stream_encoder * const streamer =
+		pes_stream_encoder_init_with_allocator((struct pes_stream_sink) {
+			discard_buffer, discard_patch, NULL },
+			(struct pes_stream_spill) {
+			discard_buffer, read_buffer, NULL }, &allocator);
+	int count = 0;
+
+	TEST_ASSERT(streamer != NULL);
+	TEST_ASSERT(pes_stream_append_thread(streamer, pec_palette_thread(1)));
+
+	/*
+	 * Stitches are appended without allocations, up to the limit of the
+	 * 24-bit thumbnail offset. Deltas and jumps are 4 bytes each.
+	 */
+	const int allocated = allocations.count;
+
+	while (count < 5000000 && (count % 60000 == 0 && count != 0 ?
+		pes_stream_append_jump_stitch : pes_stream_append_stitch)(
+			streamer, 0, 10.0f * (count % 2), 10.0f * (count % 2)))
+		count++;
+
+	TEST_ASSERT(count == 1 + (0xFFFFFF - 20 - 4 - 1) / 4);
+	TEST_ASSERT(allocations.count == allocated);
+
+	pes_stream_encoder_free(streamer);
+	TEST_ASSERT(allocations.outstanding == 0);
+
+	return true;
+}
+
+static bool test_encoder_reset()
+{
+	static const struct pes_transform transform = {
+		.matrix = { { 2.0f, 0.0f }, { 0.0f, 2.0f }, { 5.0f, 5.0f } }
+	};
+	struct allocations allocations = { 0 };
+	const struct libpes_allocator allocator = {
+		.alloc_cb = counted_alloc,
+		.realloc_cb = counted_realloc,
+		.free_cb = counted_free,
+		.arg = &allocations
+	};
+	struct pes_encoder * const encoder =
+		pes_encoder_init_with_allocator(&allocator);
+	TEST_ASSERT(encoder != NULL);
+	append_design(encoder, true);
+	struct buffer pes = encode_pes(encoder);
+
+	/* Encode another design in between, with a transform and a thread. */
+	pes_encoder_reset(encoder);
+	TEST_ASSERT(pes_encode1_size(encoder) == 0); /* No threads. */
+	pes_encode_transform(encoder, transform);
+	TEST_ASSERT(pes_append_thread(encoder, pec_palette_thread(3)));
+	TEST_ASSERT(pes_append_stitch(encoder, 0, 1.0f, 1.0f));
+	TEST_ASSERT(pes_encode1_size(encoder) > 0);
+
+	pes_encoder_reset(encoder);
+	append_design(encoder, true);
+	struct buffer reset = encode_pes(encoder);
+	TEST_ASSERT(reset.size == pes.size);
+	TEST_ASSERT(memcmp(reset.data, pes.data, pes.size) == 0);
+	free(reset.data);
+
+	/* Once grown, a reset, append and encode cycle does not allocate. */
+	int count = allocations.count;
+	pes_encoder_reset(encoder);
+	append_design(encoder, true);
+	reset = encode_pes(encoder);
+	TEST_ASSERT(allocations.count == count);
+	TEST_ASSERT(reset.size == pes.size);
+	TEST_ASSERT(memcmp(reset.data, pes.data, pes.size) == 0);
+
+	struct pec_encoder * const pec =
+		pec_encoder_init_with_allocator(&allocator);
+	size_t size;
+	TEST_ASSERT(pec != NULL);
+	TEST_ASSERT(pec_append_thread(pec, 1));
+	TEST_ASSERT(pec_append_stitch(pec, 10.0f, -10.0f));
+	size = pec_encoded_size(pec);
+	TEST_ASSERT(size > 0);
+	struct buffer data = { .capacity = size };
+	data.data = malloc(data.capacity);
+	TEST_ASSERT(data.data != NULL);
+	TEST_ASSERT(pec_encode(pec, encode_buffer, &data));
+	pec_encoder_reset(pec);
+	TEST_ASSERT(pec_encoded_size(pec) == 0); /* No threads. */
+	count = allocations.count;
+	TEST_ASSERT(pec_append_thread(pec, 1));
+	TEST_ASSERT(pec_append_stitch(pec, 10.0f, -10.0f));
+	TEST_ASSERT(pec_encoded_size(pec) == size);
+	data.size = 0;
+	TEST_ASSERT(pec_encode(pec, encode_buffer, &data));
+	TEST_ASSERT(allocations.count == count);
+	free(data.data);
+
+	struct svg_emb_encoder * const svg =
+		svg_emb_encoder_init_with_allocator(&allocator);
+	TEST_ASSERT(svg != NULL);
+	size = svg_emb_encode_size(svg);
+	svg_emb_encode_transform(svg, transform);
+	TEST_ASSERT(svg_emb_append_thread(svg, pec_palette_thread(1)));
+	TEST_ASSERT(svg_emb_append_stitch(svg, 0, 1.0f, 2.0f));
+	TEST_ASSERT(svg_emb_encode_size(svg) > size);
+	svg_emb_encoder_reset(svg);
+	TEST_ASSERT(svg_emb_encode_size(svg) == size);
+	count = allocations.count;
+	TEST_ASSERT(svg_emb_append_thread(svg, pec_palette_thread(1)));
+	TEST_ASSERT(svg_emb_append_stitch(svg, 0, 1.0f, 2.0f));
+	data = (struct buffer) { .capacity = svg_emb_encode_size(svg) };
+	TEST_ASSERT(data.capacity > size);
+	data.data = malloc(data.capacity);
+	TEST_ASSERT(data.data != NULL);
+	TEST_ASSERT(svg_emb_encode(svg, encode_buffer, &data));
+	TEST_ASSERT(allocations.count == count);
+	free(data.data);
+
+	svg_emb_encoder_free(svg);
+	pec_encoder_free(pec);
+	free(reset.data);
+	free(pes.data);
+	pes_encoder_free(encoder);
+	TEST_ASSERT(allocations.outstanding == 0);
+
+	return true;
+}
+
+static bool test_allocator()
+{
+	struct allocations allocations = { 0 };
+	const struct libpes_allocator allocator = {
+		.alloc_cb = counted_alloc,
+		.realloc_cb = counted_realloc,
+		.free_cb = counted_free,
+		.arg = &allocations
+	};
+
+	/* Encoders and decoders with the given allocator. */
+	struct pes_encoder * const encoder =
+		pes_encoder_init_with_allocator(&allocator);
+	TEST_ASSERT(encoder != NULL);
+	append_design(encoder, true);
+	struct buffer pes = encode_pes(encoder);
+	const int count = allocations.count;
+	TEST_ASSERT(count > 0);
+
+	struct pes_decoder * const decoder = pes_decoder_init_with_allocator(
+		pes.data, pes.size, true, &allocator);
+	TEST_ASSERT(decoder != NULL);
+	TEST_ASSERT(pes_stitch_count(decoder) > 0);
+	TEST_ASSERT(allocations.count > count);
+
+	pes_decoder_free(decoder);
+	pes_encoder_free(encoder);
+	TEST_ASSERT(allocations.outstanding == 0);
+
+	/* Objects keep the global allocator they were created with. */
+	libpes_allocator_set(&allocator);
+	struct svg_emb_encoder * const svg = svg_emb_encoder_init();
+	libpes_allocator_set(NULL);
+	TEST_ASSERT(svg != NULL);
+	TEST_ASSERT(svg_emb_append_thread(svg, pec_palette_thread(1)));
+	TEST_ASSERT(svg_emb_append_stitch(svg, 0, 1.0f, 2.0f));
+	TEST_ASSERT(svg_emb_encode_size(svg) > 0);
+	TEST_ASSERT(allocations.outstanding > 0);
+	svg_emb_encoder_free(svg);
+	TEST_ASSERT(allocations.outstanding == 0);
+
+	/* NULL is the global allocator. */
+	libpes_allocator_set(&allocator);
+	struct pec_encoder * const pec = pec_encoder_init_with_allocator(NULL);
+	libpes_allocator_set(NULL);
+	TEST_ASSERT(pec != NULL);
+	TEST_ASSERT(allocations.outstanding > 0);
+	pec_encoder_free(pec);
+	TEST_ASSERT(allocations.outstanding == 0);
+
+	/* Allocators with a NULL callback are rejected. */
+	struct libpes_allocator partial = allocator;
+	partial.free_cb = NULL;
+	const int partial_count = allocations.count;
+	TEST_ASSERT(pes_encoder_init_with_allocator(&partial) == NULL);
+	TEST_ASSERT(pec_encoder_init_with_allocator(&partial) == NULL);
+	TEST_ASSERT(svg_emb_encoder_init_with_allocator(&partial) == NULL);
+	TEST_ASSERT(pes_decoder_init_with_allocator(
+		pes.data, pes.size, true, &partial) == NULL);
+	TEST_ASSERT(allocations.count == partial_count);
+
+	/* The global allocator falls back to the default. */
+	libpes_allocator_set(&partial);
+	struct pes_encoder * const fallback = pes_encoder_init();
+	libpes_allocator_set(NULL);
+	TEST_ASSERT(fallback != NULL);
+	TEST_ASSERT(allocations.count == partial_count);
+	pes_encoder_free(fallback);
+
+	free(pes.data);
+
+	return true;
+}
+
+static bool test_allocator_empty_threads()
+{
+	struct allocations allocations = { 0 };
+	const struct libpes_allocator allocator = {
+		.alloc_cb = counted_alloc,
+		.realloc_cb = counted_realloc,
+		.free_cb = counted_free,
+		.arg = &allocations
+	};
+	struct pes_encoder * const encoder = pes_encoder_init();
+	TEST_ASSERT(encoder != NULL);
+	TEST_ASSERT(pes_append_thread(encoder, pec_palette_thread(1)));
+	TEST_ASSERT(pes_append_stitch(encoder, 0, 1.0f, 2.0f));
+	struct buffer pes = encode_pes(encoder);
+	pes_encoder_free(encoder);
+
+	/*
+	 * Clear the single thread change of the PES version 1 thread list,
+	 * which precedes two zero words and the PEC section.
+	 */
+	const size_t pec_offset = pes.data[8] | (pes.data[9] << 8) |
+		(pes.data[10] << 16) | ((size_t)pes.data[11] << 24);
+	uint8_t * const change_count = &pes.data[pec_offset - 4 - 4 - 2];
+	TEST_ASSERT(change_count[0] == 1 && change_count[1] == 0);
+	change_count[0] = 0;
+
+	/* An empty thread table is valid and allocates nothing. */
+	struct pes_decoder * const decoder = pes_decoder_init_with_allocator(
+		pes.data, pes.size, true, &allocator);
+	TEST_ASSERT(decoder != NULL);
+	TEST_ASSERT(pes_thread_count(decoder) == 0);
+	TEST_ASSERT(pes_stitch_count(decoder) == 1);
+	TEST_ASSERT(pes_thread_stitch_count(decoder, 0) == 0);
+	pes_decoder_free(decoder);
+	TEST_ASSERT(allocations.outstanding == 0);
+
+	free(pes.data);
+
+	return true;
+}
+
+static int palette_index_by_scan(const struct pec_rgb rgb)
+{
+	int palette_index = 0, norm2 = INT32_MAX;
+
+	for (int i = 0; i < 64; i++) {
+		const struct pec_rgb c = pec_palette_thread(i).rgb;
+		const int d = (c.r - rgb.r) * (c.r - rgb.r) +
+		              (c.g - rgb.g) * (c.g - rgb.g) +
+		              (c.b - rgb.b) * (c.b - rgb.b);
+
+		if (d < norm2) {
+			palette_index = i;
+			norm2 = d;
+		}
+	}
+
+	return palette_index;
+}
+
+static bool test_palette_index()
+{
+	static const struct pec_rgb outside[] = {
+		{ -1, 0, 0 }, { 256, 128, 0 }, { 0, 1000, -1000 }
+	};
+	struct pec_rgb rgb[256];
+	int palette_index[256];
+
+	for (int r = 0; r < 256; r += 15)
+	for (int g = 0; g < 256; g += 15) {
+		for (int b = 0; b < 256; b++)
+			rgb[b] = (struct pec_rgb){ r, g, b };
+
+		pec_palette_indices_by_rgb(rgb, palette_index, 256);
+
+		for (int b = 0; b < 256; b++)
+			TEST_ASSERT(palette_index[b] ==
+				palette_index_by_scan(rgb[b]));
+	}
+
+	for (size_t i = 0; i < sizeof(outside) / sizeof(*outside); i++)
+		TEST_ASSERT(pec_palette_index_by_rgb(outside[i]) ==
+			palette_index_by_scan(outside[i]));
+
+	return true;
+}
+
+static bool test_palette_perceptual()
+{
+	for (int i = 1; i <= 64; i++) {
+		const struct pec_thread thread = pec_palette_thread(i);
+		const struct pec_thread match = pec_palette_thread(
+			pec_palette_index_by_rgb_perceptual(thread.rgb));
+
+		TEST_ASSERT(match.rgb.r == thread.rgb.r &&
+			match.rgb.g == thread.rgb.g &&
+			match.rgb.b == thread.rgb.b);
+	}
+
+	for (int r = -8; r < 264; r += 17)
+	for (int g = -8; g < 264; g += 17)
+	for (int b = -8; b < 264; b += 17) {
+		const int palette_index = pec_palette_index_by_rgb_perceptual(
+			(struct pec_rgb){ r, g, b });
+
+		TEST_ASSERT(1 <= palette_index &&
+			palette_index <= 64);
+	}
+
+	/* Colors whose nearest thread differs from that of their cell centre. */
+	static const struct {
+		struct pec_rgb rgb;
+		int palette_index;
+	} nearest[] = {
+		{ { 134,  67,  84 }, 48 },
+		{ { 201, 111, 147 },  9 },
+		{ {  74, 126,  59 }, 54 },
+		{ {  59, 144,  64 }, 54 },
+		{ { 227,   1, 210 }, 22 },
+		{ { 236, 165,  34 }, 11 },
+		{ {  40,  42,  57 }, 38 },
+		{ {  65,  59, 144 }, 38 },
+	};
+
+	for (size_t i = 0; i < sizeof(nearest) / sizeof(*nearest); i++)
+		TEST_ASSERT(pec_palette_index_by_rgb_perceptual(nearest[i].rgb) ==
+			nearest[i].palette_index);
+
+	return true;
+}
+
+static bool test_palette_match()
+{
+	struct pes_encoder * const encoder = pes_encoder_init();
+	const struct pec_thread thread = {
+		.rgb = { .r = 250, .g = 10, .b = 10 }
+	};
+
+	TEST_ASSERT(encoder != NULL);
+	TEST_ASSERT(pes_encoder_palette_match(encoder,
+		pec_palette_index_by_rgb_perceptual));
+	TEST_ASSERT(pes_append_thread(encoder, thread));
+
+	/* The match cannot change once threads have been appended. */
+	TEST_ASSERT(!pes_encoder_palette_match(encoder,
+		pec_palette_index_by_rgb));
+	TEST_ASSERT(pes_append_stitch(encoder, 0, 0.0f, 0.0f));
+	TEST_ASSERT(!pes_encoder_palette_match(encoder,
+		pec_palette_index_by_rgb));
+
+	pes_encoder_reset(encoder);
+	TEST_ASSERT(pes_encoder_palette_match(encoder,
+		pec_palette_index_by_rgb));
+
+	pes_encoder_free(encoder);
+
+	return true;
+}
+
+const struct test_entry test_suite_pes_encoder[] = {
+	TEST_ENTRY(test_encode_size),
+	TEST_ENTRY(test_pec_encode_size),
+	TEST_ENTRY(test_encode_buffer),
+	TEST_ENTRY(test_encode_into),
+	TEST_ENTRY(test_append_stitches),
+	TEST_ENTRY(test_encoder_reserve),
+	TEST_ENTRY(test_quantized_append),
+	TEST_ENTRY(test_thumbnail_line),
+	TEST_ENTRY(test_thumbnail_append),
+	TEST_ENTRY(test_stream_encoder),
+	TEST_ENTRY(test_stream_append_stitches),
+	TEST_ENTRY(test_stream_encoder_large),
+	TEST_ENTRY(test_stream_encoder_limit),
+	TEST_ENTRY(test_encoder_reset),
+	TEST_ENTRY(test_allocator),
+	TEST_ENTRY(test_allocator_empty_threads),
+	TEST_ENTRY(test_palette_index),
+	TEST_ENTRY(test_palette_perceptual),
+	TEST_ENTRY(test_palette_match),
+	TEST_ENTRY(NULL)
+};
@@ -40,6 +40,8 @@ int main(const int argc, const char **argv)
 		const char * const name;
 	} test_suites[] = {
 		{ test_suite_sax,            "SAX"            },
+		{ test_suite_pes_decoder,    "PES decoder"    },
+		{ test_suite_pes_encoder,    "PES encoder"    },
 		{ test_suite_svg_transcoder, "SVG transcoder" },
 		{ NULL, NULL }
 	};
@@ -36,6 +36,8 @@ struct test_entry {
 };
 
 extern const struct test_entry test_suite_sax[];
+extern const struct test_entry test_suite_pes_decoder[];
+extern const struct test_entry test_suite_pes_encoder[];
 extern const struct test_entry test_suite_svg_transcoder[];
 
 #endif /* PESLIB_RUN_TESTS_H */
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2017 Fredrik Noring. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "file.h"
+#include "pec-decoder.h"
+
+#define RUN_COUNT 15
+
+struct benchmark {
+	const struct pec_decoder *decoder;
+	int stitch_count;
+	float *x;
+	float *y;
+	uint8_t *type;
+	double sum;
+};
+
+typedef bool (*benchmark_run)(struct benchmark * const benchmark);
+
+static bool sum_stitch(const int stitch_index, const float x, const float y,
+	const enum pec_stitch_type stitch_type, void * const arg)
+{
+	struct benchmark * const benchmark = arg;
+
+	benchmark->sum += x + y + stitch_type;
+
+	return true;
+}
+
+static bool sum_stitch_raw(const int stitch_index, const int x, const int y,
+	const enum pec_stitch_type stitch_type, void * const arg)
+{
+	struct benchmark * const benchmark = arg;
+
+	benchmark->sum += x + y + stitch_type;
+
+	return true;
+}
+
+static bool sum_batch(const int stitch_index,
+	const float * const x, const float * const y,
+	const uint8_t * const stitch_type, const int count, void * const arg)
+{
+	struct benchmark * const benchmark = arg;
+	float sum[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	int type_sum = 0;
+	int i = 0;
+
+	/* Independent partial sums let the compiler vectorise the batch. */
+	for (; i + 8 <= count; i += 8)
+		for (int k = 0; k < 8; k++)
+			sum[k] += x[i + k] + y[i + k];
+	for (; i < count; i++)
+		sum[0] += x[i] + y[i];
+	for (i = 0; i < count; i++)
+		type_sum += stitch_type[i];
+
+	for (int k = 0; k < 8; k++)
+		benchmark->sum += sum[k];
+	benchmark->sum += type_sum;
+
+	return true;
+}
+
+static bool run_foreach(struct benchmark * const benchmark)
+{
+	return pec_stitch_foreach(benchmark->decoder, sum_stitch, benchmark);
+}
+
+static bool run_foreach_batch(struct benchmark * const benchmark)
+{
+	return pec_stitch_foreach_batch(benchmark->decoder,
+		sum_batch, benchmark);
+}
+
+static bool run_foreach_raw(struct benchmark * const benchmark)
+{
+	return pec_stitch_foreach_raw(benchmark->decoder,
+		sum_stitch_raw, benchmark);
+}
+
+static bool run_decode_stitches(struct benchmark * const benchmark)
+{
+	return pec_decode_stitches(benchmark->decoder, benchmark->x,
+		benchmark->y, benchmark->type, NULL, benchmark->stitch_count) ==
+		(size_t)benchmark->stitch_count;
+}
+
+static bool print_run(const char * const name,
+	struct benchmark * const benchmark, const benchmark_run run)
+{
+	double best = -1;
+
+	for (int i = 0; i < RUN_COUNT; i++) {
+		const clock_t start = clock();
+
+		if (!run(benchmark))
+			return false;
+
+		const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+		if (best < 0 || seconds < best)
+			best = seconds;
+	}
+
+	printf("%-24s %8.1f million stitches/s\n", name,
+		best > 0 ? benchmark->stitch_count / best / 1e6 : 0.0);
+
+	return true;
+}
+
+/*
+ * Scale the PEC section of a PES file by repeating its stitch data. The
+ * stitches of the PEC section run from offset 532 to the end marker just
+ * before the thumbnails.
+ */
+static uint8_t *scale_pec(const struct file_buffer * const buf,
+	const int repeat_count, size_t * const size)
+{
+	if (buf->size < 12)
+		return NULL;
+
+	const size_t pec_offset = ((size_t)buf->data[8] << 0) |
+	                          ((size_t)buf->data[9] << 8) |
+	                          ((size_t)buf->data[10] << 16) |
+	                          ((size_t)buf->data[11] << 24);
+	if (buf->size < pec_offset + 532)
+		return NULL;
+
+	const uint8_t * const pec = &buf->data[pec_offset];
+	const size_t thumbnail_offset = 512 + (((size_t)pec[514] << 0) |
+	                                       ((size_t)pec[515] << 8) |
+	                                       ((size_t)pec[516] << 16));
+	if (thumbnail_offset <= 532 || buf->size - pec_offset < thumbnail_offset)
+		return NULL;
+
+	const size_t stitch_size = thumbnail_offset - 532 - 1;
+	uint8_t * const data = malloc(532 + stitch_size * repeat_count + 1);
+	if (data == NULL)
+		return NULL;
+
+	memcpy(data, pec, 532);
+	for (int i = 0; i < repeat_count; i++)
+		memcpy(&data[532 + stitch_size * i], &pec[532], stitch_size);
+	data[532 + stitch_size * repeat_count] = 0xFF;
+
+	*size = 532 + stitch_size * repeat_count + 1;
+
+	return data;
+}
+
+static bool benchmark_file(const struct file_buffer * const buf,
+	const int repeat_count)
+{
+	size_t size;
+	uint8_t * const data = scale_pec(buf, repeat_count, &size);
+
+	if (data == NULL) {
+		fprintf(stderr, "%s: File format error\n", buf->name);
+		return false;
+	}
+
+	const clock_t start = clock();
+	struct benchmark benchmark = {
+		.decoder = pec_decoder_init_borrowed(data, size)
+	};
+	const double init_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	bool valid = benchmark.decoder != NULL;
+
+	if (valid) {
+		benchmark.stitch_count = pec_stitch_count(benchmark.decoder);
+		benchmark.x = malloc(sizeof(float) * benchmark.stitch_count);
+		benchmark.y = malloc(sizeof(float) * benchmark.stitch_count);
+		benchmark.type = malloc(benchmark.stitch_count);
+		valid = benchmark.x != NULL && benchmark.y != NULL &&
+			benchmark.type != NULL;
+	}
+
+	if (valid) {
+		printf("%s: %d stitches, %zu bytes, init %.1f ms\n", buf->name,
+			benchmark.stitch_count, size, 1e3 * init_seconds);
+
+		valid = print_run("pec_stitch_foreach", &benchmark,
+				run_foreach) &&
+			print_run("pec_stitch_foreach_batch", &benchmark,
+				run_foreach_batch) &&
+			print_run("pec_stitch_foreach_raw", &benchmark,
+				run_foreach_raw) &&
+			print_run("pec_decode_stitches", &benchmark,
+				run_decode_stitches);
+	}
+
+	if (!valid)
+		fprintf(stderr, "%s: Benchmark failed\n", buf->name);
+
+	free(benchmark.type);
+	free(benchmark.y);
+	free(benchmark.x);
+	pec_decoder_free((struct pec_decoder *)benchmark.decoder);
+	free(data);
+
+	return valid;
+}
+
+static void print_help()
+{
+	printf("Usage: pec-benchmark [OPTIONS]... <PES file>...\n"
+	       "\n"
+	       "The pec-benchmark tool measures PEC stitch decoding throughput. The stitches\n"
+	       "of each PES file are repeated to form a large PEC design.\n"
+	       "\n"
+	       "Options:\n"
+	       "\n"
+	       "  --help          Print this help text and exit.\n"
+	       "  --repeat <n>    Repeat the stitches n times, default 2000.\n");
+}
+
+int main(const int argc, const char **argv)
+{
+	int repeat_count = 2000;
+	bool valid = true;
+	int arg = 1;
+
+	if (argc == 1 || strcmp(argv[1], "--help") == 0) {
+		print_help();
+		return argc == 1 ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if (strcmp(argv[1], "--repeat") == 0) {
+		if (argc < 3 || (repeat_count = atoi(argv[2])) <= 0) {
+			fprintf(stderr, "pec-benchmark: Invalid repeat count\n");
+			return EXIT_FAILURE;
+		}
+		arg = 3;
+	}
+
+	for (; arg < argc; arg++) {
+		struct file_buffer buf = { .name = argv[arg] };
+
+		if (!read_path(buf.name, &buf)) {
+			perror(buf.name);
+			valid = false;
+			continue;
+		}
+
+		if (!benchmark_file(&buf, repeat_count))
+			valid = false;
+
+		free(buf.data);
+	}
+
+	return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -18,6 +18,7 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -77,33 +78,44 @@ static bool print_pec_stitch(const int stitch_index,
 	return true;
 }
 
-static void print_pec_thumbnail(const struct pec_decoder * const decoder,
+static bool print_pec_thumbnail(const struct pec_decoder * const decoder,
 	const int thumbnail_index)
 {
 	const int w = pec_thumbnail_width(decoder);
 	const int h = pec_thumbnail_height(decoder);
+	uint8_t * const bitmap = malloc(w * h + 1);
+	const bool valid = bitmap != NULL && pec_thumbnail_bitmap(decoder,
+		thumbnail_index, bitmap, w, PEC_THUMBNAIL_8BPP);
+
+	if (valid)
+		for (int y = 0; y < h; y++, putchar('\n')) {
+			printf("  ");
+			for (int x = 0; x < w; x++)
+				putchar(bitmap[x + w * y] ? '#' : '.');
+		}
 
-	for (int y = 0; y < h; y++, putchar('\n')) {
-		printf("  ");
-		for (int x = 0; x < w; x++)
-			putchar(pec_thumbnail_pixel(decoder,
-				thumbnail_index, x, y) ? '#' : '.');
-	}
+	free(bitmap);
+
+	return valid;
 }
 
-static void print_pec_thumbnails(const struct pec_decoder * const decoder)
+static bool print_pec_thumbnails(const struct pec_decoder * const decoder)
 {
 	const int thread_count = pec_thread_count(decoder);
 
 	printf("PEC thumbnail index 0\n");
-	print_pec_thumbnail(decoder, 0);
+	if (!print_pec_thumbnail(decoder, 0))
+		return false;
 
 	for (int i = 0; i < thread_count; i++) {
 		const struct pec_thread thread = pec_thread(decoder, i);
 
 		printf("PEC thumbnail index %d %s\n", i + 1, thread.name);
-		print_pec_thumbnail(decoder, i + 1);
+		if (!print_pec_thumbnail(decoder, i + 1))
+			return false;
 	}
+
+	return true;
 }
 
 static void print_hoop_size(const struct pes_decoder * const decoder)
@@ -204,7 +216,10 @@ static bool print_pec(const struct file_buffer * const buf,
 		pec_thumbnail_width(decoder),
 		pec_thumbnail_height(decoder));
 
-	print_pec_thumbnails(decoder);
+	if (!print_pec_thumbnails(decoder)) {
+		fprintf(stderr, "%s: PEC thumbnail error\n", buf->name);
+		valid = false;
+	}
 
 	return valid;
 }
@@ -222,7 +237,7 @@ static bool print_info(const struct file_buffer * const buf)
 		buf->data[4], buf->data[5], buf->data[6], buf->data[7]);
 
 	struct pes_decoder * const decoder =
-		pes_decoder_init(buf->data, buf->size);
+		pes_decoder_init_borrowed(buf->data, buf->size);
 	if (decoder == NULL) {
 		fprintf(stderr, "%s: File format error\n", buf->name);
 		return false;